@@ -0,0 +1,273 @@
+/*
+ * bench_ifnetshow_load.c
+ *
+ * Closed-loop TCP load generator for ifnetshow_agent: every connection
+ * sends a request, waits for the whole answer, and sends the next one at
+ * once, for a fixed duration. Reports the request rate and the latency
+ * distribution (each request's round trip; with protocol 1 it includes
+ * the connection setup) as one JSON line.
+ *
+ * Usage:
+ *    bench_ifnetshow_load [-a <agent IPv4>] [-c <connections>] [-d <seconds>]
+ *                         [-m <command>] [-P 1|2] [-B]
+ *
+ *   -P 2 (default) keeps one persistent protocol 2 connection per client,
+ *   -P 1 opens a connection per request; -B asks for binary answers
+ *   (protocol 2 only).
+ */
+
+#include "ifnetshow.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MAX_CONNECTIONS 1024
+
+struct load_config {
+    struct sockaddr_in agent;
+    const char        *command;
+    int                protocol;
+    int                binary;
+};
+
+/*
+ * struct load_client:
+ *   One closed-loop client and what it measured.
+ */
+struct load_client {
+    pthread_t                 thread;
+    const struct load_config *config;
+    struct latency_log        latencies;
+    unsigned long long        errors;
+};
+
+static atomic_int stop_clients;
+
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [-a <agent IPv4>] [-c <connections>] [-d <seconds>] "
+                    "[-m <command>] [-P 1|2] [-B]\n",
+            progname);
+    exit(EXIT_FAILURE);
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+static int connect_agent(const struct load_config *config) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, (const struct sockaddr *) &config->agent, sizeof(config->agent)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * request_once:
+ *   Protocol 1: connect, send the command, read until the agent closes.
+ */
+static int request_once(const struct load_config *config) {
+    int fd = connect_agent(config);
+    if (fd < 0)
+        return -1;
+    int ret = write_full(fd, config->command, strlen(config->command));
+    char buf[16384];
+    ssize_t n = 0;
+    while (ret == 0 && (n = read(fd, buf, sizeof(buf))) > 0)
+        ;
+    close(fd);
+    return ret == 0 && n == 0 ? 0 : -1;
+}
+
+/*
+ * open_framed:
+ *   Connect and negotiate protocol 2. Returns the socket, or -1.
+ */
+static int open_framed(const struct load_config *config) {
+    int fd = connect_agent(config);
+    if (fd < 0)
+        return -1;
+    char ok[sizeof(IFN_HELLO_OK) - 1];
+    if (write_full(fd, IFN_HELLO, strlen(IFN_HELLO)) < 0 || read_full(fd, ok, sizeof(ok)) < 0 ||
+        memcmp(ok, IFN_HELLO_OK, sizeof(ok)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * request_framed:
+ *   Protocol 2: send one request frame and read its answer frame.
+ */
+static int request_framed(int fd, const struct load_config *config) {
+    unsigned char hdr[IFN_FRAME_HDR_LEN];
+    size_t len = strlen(config->command);
+    ifn_frame_pack(hdr, (uint32_t) len, IFN_MSG_REQUEST, config->binary ? IFN_FLAG_BINARY : 0);
+    if (write_full(fd, hdr, sizeof(hdr)) < 0 || write_full(fd, config->command, len) < 0 ||
+        read_full(fd, hdr, sizeof(hdr)) < 0)
+        return -1;
+
+    uint32_t body_len;
+    uint16_t type, flags;
+    ifn_frame_unpack(hdr, &body_len, &type, &flags);
+    char buf[16384];
+    while (body_len > 0) {
+        size_t chunk = body_len < sizeof(buf) ? body_len : sizeof(buf);
+        if (read_full(fd, buf, chunk) < 0)
+            return -1;
+        body_len -= (uint32_t) chunk;
+    }
+    return type == IFN_MSG_RESPONSE ? 0 : -1;
+}
+
+static void *client_main(void *arg) {
+    struct load_client *client = arg;
+    const struct load_config *config = client->config;
+    int fd = -1;
+
+    while (!atomic_load_explicit(&stop_clients, memory_order_relaxed)) {
+        uint64_t start = bench_now_ns();
+        int ret;
+        if (config->protocol == 1) {
+            ret = request_once(config);
+        } else {
+            if (fd < 0)
+                fd = open_framed(config);
+            ret = fd < 0 ? -1 : request_framed(fd, config);
+            if (ret < 0 && fd >= 0) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (ret < 0) {
+            /* Do not spin on an agent that refuses connections. */
+            client->errors++;
+            usleep(1000);
+            continue;
+        }
+        latency_log_add(&client->latencies, bench_now_ns() - start);
+    }
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    struct load_config config;
+    memset(&config, 0, sizeof(config));
+    config.agent.sin_family = AF_INET;
+    config.agent.sin_port = htons(SERVER_PORT);
+    config.agent.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    config.command = "ALL";
+    config.protocol = 2;
+    int connections = 4;
+    double duration = 5;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if (inet_pton(AF_INET, argv[++i], &config.agent.sin_addr) != 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            connections = atoi(argv[++i]);
+            if (connections < 1 || connections > MAX_CONNECTIONS)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            duration = atof(argv[++i]);
+            if (duration <= 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            config.command = argv[++i];
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            config.protocol = atoi(argv[++i]);
+            if (config.protocol != 1 && config.protocol != 2)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-B") == 0) {
+            config.binary = 1;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (config.binary && config.protocol != 2)
+        usage(argv[0]);
+
+    struct load_client *clients = calloc((size_t) connections, sizeof(*clients));
+    if (clients == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < connections; i++) {
+        clients[i].config = &config;
+        latency_log_init(&clients[i].latencies);
+        if (pthread_create(&clients[i].thread, NULL, client_main, &clients[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
+    usleep((useconds_t)(duration * 1e6));
+    atomic_store(&stop_clients, 1);
+
+    struct latency_log all;
+    latency_log_init(&all);
+    unsigned long long errors = 0;
+    for (int i = 0; i < connections; i++) {
+        pthread_join(clients[i].thread, NULL);
+        latency_log_merge(&all, &clients[i].latencies);
+        errors += clients[i].errors;
+        latency_log_free(&clients[i].latencies);
+    }
+    double elapsed = (double)(bench_now_ns() - start) / 1e9;
+
+    printf("{\"bench\": \"ifnetshow_load\", \"command\": \"%s\", \"protocol\": %d, "
+           "\"binary\": %s, \"connections\": %d, \"duration_s\": %.3f, \"requests\": %zu, "
+           "\"errors\": %llu, \"req_per_s\": %.1f",
+           config.command, config.protocol, config.binary ? "true" : "false", connections,
+           elapsed, all.count, errors, (double) all.count / elapsed);
+    latency_log_print_json(&all, stdout);
+    printf("}\n");
+
+    int ret = all.count > 0 ? 0 : 1;
+    latency_log_free(&all);
+    free(clients);
+    return ret;
+}
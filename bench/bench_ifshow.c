@@ -0,0 +1,228 @@
+/*
+ * bench_ifshow.c
+ *
+ * Microbenchmarks of the ifshow library.
+ *
+ *   - get_prefix_length() over IPv4 and IPv6 netmasks of every length.
+ *   - show_all_interfaces() and show_interface_by_name() on the host, which
+ *     include taking the snapshot from the kernel.
+ *   - The same two queries on synthetic snapshots of 10 to 10,000
+ *     interfaces (each with an IPv4 and an IPv6 address): a host cannot be
+ *     given that many interfaces just for a benchmark, so the snapshot is
+ *     built with the loaders' builder instead, and the query is what
+ *     show_all_interfaces() / show_interface_by_name() do once it is
+ *     loaded. Building (finalizing) the snapshot is measured as well.
+ *
+ * Output goes to /dev/null; results are JSON Lines on stdout.
+ *
+ * Usage:
+ *    bench_ifshow [-t <min time per measurement ms>] [-n <max interfaces>]
+ */
+
+#include "ifshow.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* Keeps the compiler from dropping a result. */
+static volatile int sink;
+
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [-t <min time per measurement ms>] [-n <max interfaces>]\n",
+            progname);
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * report:
+ *   Print one measurement: ops operations took ns nanoseconds.
+ */
+static void report(const char *bench, const char *source, size_t ifaces, unsigned long long ops,
+                   uint64_t ns) {
+    printf("{\"bench\": \"%s\", \"source\": \"%s\", \"interfaces\": %zu, \"iterations\": %llu, "
+           "\"ns_per_op\": %.1f, \"ops_per_s\": %.0f}\n",
+           bench, source, ifaces, ops, (double) ns / (double) ops,
+           (double) ops * 1e9 / (double) ns);
+    fflush(stdout);
+}
+
+static void bench_prefix_length(uint64_t min_ns) {
+    /* Every IPv4 (/0-/32) and IPv6 (/0-/128) netmask. */
+    struct sockaddr_storage masks[33 + 129];
+    size_t count = 0;
+    for (int len = 0; len <= 32; len++, count++) {
+        struct sockaddr_in *m = (struct sockaddr_in *) &masks[count];
+        memset(m, 0, sizeof(masks[count]));
+        m->sin_family = AF_INET;
+        m->sin_addr.s_addr = len ? htonl(~0u << (32 - len)) : 0;
+    }
+    for (int len = 0; len <= 128; len++, count++) {
+        struct sockaddr_in6 *m = (struct sockaddr_in6 *) &masks[count];
+        memset(m, 0, sizeof(masks[count]));
+        m->sin6_family = AF_INET6;
+        for (int bit = 0; bit < len; bit++)
+            m->sin6_addr.s6_addr[bit / 8] |= (unsigned char)(0x80 >> (bit % 8));
+    }
+
+    unsigned long long ops = 0;
+    uint64_t start = bench_now_ns(), elapsed;
+    do {
+        int total = 0;
+        for (size_t i = 0; i < count; i++)
+            total += get_prefix_length((struct sockaddr *) &masks[i]);
+        sink = total;
+        ops += count;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < min_ns);
+    report("get_prefix_length", "synthetic", 0, ops, elapsed);
+}
+
+static void bench_live(uint64_t min_ns, FILE *devnull) {
+    struct ifshow_snapshot snap;
+    ifshow_snapshot_init(&snap);
+    size_t ifaces = 0;
+    if (ifshow_snapshot_load(&snap) == 0)
+        ifaces = snap.iface_count;
+    const char *name = ifaces > 0 ? snap.ifaces[0].name : "lo";
+
+    unsigned long long ops = 0;
+    uint64_t start = bench_now_ns(), elapsed;
+    do {
+        sink = show_all_interfaces(devnull);
+        ops++;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < min_ns);
+    report("show_all_interfaces", "live", ifaces, ops, elapsed);
+
+    ops = 0;
+    start = bench_now_ns();
+    do {
+        sink = show_interface_by_name(name, devnull);
+        ops++;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < min_ns);
+    report("show_interface_by_name", "live", ifaces, ops, elapsed);
+    ifshow_snapshot_free(&snap);
+}
+
+/*
+ * build_synthetic:
+ *   Fill snap with count interfaces "bench<N>", each with one IPv4 and one
+ *   IPv6 address, and finalize it. Returns 0, or -1 on allocation failure.
+ */
+static int build_synthetic(struct ifshow_snapshot *snap, size_t count) {
+    ifshow_snapshot_reset(snap);
+    for (size_t i = 0; i < count; i++) {
+        struct ifshow_iface iface;
+        memset(&iface, 0, sizeof(iface));
+        iface.ifindex = (unsigned int)(i + 1);
+        snprintf(iface.name, sizeof(iface.name), "bench%u", (unsigned int) i);
+        if (ifshow_snapshot_add_iface(snap, &iface) < 0)
+            return -1;
+
+        struct ifshow_addr addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.ifindex = iface.ifindex;
+        addr.family = AF_INET;
+        addr.prefix = 24;
+        addr.addr[0] = 10;
+        addr.addr[1] = (unsigned char)(i >> 16);
+        addr.addr[2] = (unsigned char)(i >> 8);
+        addr.addr[3] = (unsigned char) i;
+        if (ifshow_snapshot_add_addr(snap, &addr) < 0)
+            return -1;
+
+        memset(addr.addr, 0, sizeof(addr.addr));
+        addr.family = AF_INET6;
+        addr.prefix = 64;
+        addr.addr[0] = 0xfd;
+        addr.addr[13] = (unsigned char)(i >> 16);
+        addr.addr[14] = (unsigned char)(i >> 8);
+        addr.addr[15] = (unsigned char) i;
+        if (ifshow_snapshot_add_addr(snap, &addr) < 0)
+            return -1;
+    }
+    return ifshow_snapshot_finalize(snap);
+}
+
+static void bench_synthetic(size_t count, uint64_t min_ns, FILE *devnull) {
+    struct ifshow_snapshot snap;
+    ifshow_snapshot_init(&snap);
+
+    unsigned long long ops = 0;
+    uint64_t start = bench_now_ns(), elapsed;
+    do {
+        if (build_synthetic(&snap, count) < 0) {
+            perror("build_synthetic");
+            exit(EXIT_FAILURE);
+        }
+        ops++;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < min_ns);
+    report("snapshot_build", "synthetic", count, ops, elapsed);
+
+    ops = 0;
+    start = bench_now_ns();
+    do {
+        sink = ifshow_snapshot_print_all(&snap, devnull);
+        ops++;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < min_ns);
+    report("show_all_interfaces", "synthetic", count, ops, elapsed);
+
+    /* Look names up all over the table, and one that does not exist. */
+    char name[IF_NAMESIZE];
+    ops = 0;
+    start = bench_now_ns();
+    do {
+        size_t i = (size_t)(ops * 7919) % (count + 1);
+        if (i == count)
+            snprintf(name, sizeof(name), "missing");
+        else
+            snprintf(name, sizeof(name), "bench%u", (unsigned int) i);
+        sink = ifshow_snapshot_print_iface(&snap, name, devnull);
+        ops++;
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < min_ns);
+    report("show_interface_by_name", "synthetic", count, ops, elapsed);
+
+    ifshow_snapshot_free(&snap);
+}
+
+int main(int argc, char *argv[]) {
+    long min_ms = 200;
+    long max_ifaces = 10000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            min_ms = atol(argv[++i]);
+            if (min_ms < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            max_ifaces = atol(argv[++i]);
+            if (max_ifaces < 10)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    FILE *devnull = fopen("/dev/null", "w");
+    if (devnull == NULL) {
+        perror("fopen");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t min_ns = (uint64_t) min_ms * 1000000ULL;
+
+    bench_prefix_length(min_ns);
+    bench_live(min_ns, devnull);
+    for (long count = 10; count <= max_ifaces; count *= 10)
+        bench_synthetic((size_t) count, min_ns, devnull);
+
+    fclose(devnull);
+    return 0;
+}
@@ -0,0 +1,256 @@
+/*
+ * bench_neighbor_storm.c
+ *
+ * Discovery-storm generator for neighborshow_agent: sends a burst of
+ * requests, each with its own id, as fast as possible or at a fixed rate,
+ * and matches the responses to them. Reports how many were answered, the
+ * achieved send and answer rates and the response latency distribution as
+ * one JSON line.
+ *
+ * The target is the agent's address: 127.0.0.1 by default, or the far end
+ * of a veth pair when the agent runs in another network namespace (see
+ * bench/run_bench.sh).
+ *
+ * Usage:
+ *    bench_neighbor_storm [-a <agent IPv4>] [-n <requests>] [-r <requests/s>]
+ *                         [-H <hop>] [-w <wait ms>]
+ */
+
+#define _GNU_SOURCE
+
+#include "neighborshow.h"
+#include "bench_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Datagrams per sendmmsg()/recvmmsg() call. */
+#define STORM_BATCH 64
+
+struct storm {
+    int                 sockfd;
+    struct sockaddr_in  agent;
+    long                count;
+    int                 base_id;
+    _Atomic uint64_t   *sent_ns;       /* send time of every request, 0 until sent */
+    unsigned char      *answered;
+    struct latency_log  latencies;
+    unsigned long long  duplicates;
+    unsigned long long  foreign;       /* datagrams that are not our responses */
+    uint64_t            last_answer_ns;
+    atomic_int          stop;
+};
+
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [-a <agent IPv4>] [-n <requests>] [-r <requests/s>] [-H <hop>] "
+                    "[-w <wait ms>]\n",
+            progname);
+    fprintf(stderr, "  -r 0 (default) sends as fast as possible.\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * receive_main:
+ *   Match the responses to the requests until told to stop.
+ */
+static void *receive_main(void *arg) {
+    struct storm *st = arg;
+    static char buf[STORM_BATCH][MAX_BUFFER];
+    struct mmsghdr msgs[STORM_BATCH];
+    struct iovec iov[STORM_BATCH];
+
+    while (!atomic_load(&st->stop)) {
+        for (int i = 0; i < STORM_BATCH; i++) {
+            iov[i].iov_base = buf[i];
+            iov[i].iov_len = MAX_BUFFER - 1;
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int n = recvmmsg(st->sockfd, msgs, STORM_BATCH, MSG_WAITFORONE, NULL);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("recvmmsg");
+            continue;
+        }
+        uint64_t now = bench_now_ns();
+        for (int i = 0; i < n; i++) {
+            buf[i][msgs[i].msg_len] = '\0';
+            char prefix[32];
+            int id;
+            if (sscanf(buf[i], "%31s %d", prefix, &id) != 2 ||
+                strcmp(prefix, RESPONSE_PREFIX) != 0 ||
+                id - st->base_id < 0 || id - st->base_id >= st->count) {
+                st->foreign++;
+                continue;
+            }
+            long k = id - st->base_id;
+            uint64_t sent = atomic_load_explicit(&st->sent_ns[k], memory_order_acquire);
+            if (sent == 0) {
+                st->foreign++;
+            } else if (st->answered[k]) {
+                st->duplicates++;
+            } else {
+                st->answered[k] = 1;
+                latency_log_add(&st->latencies, now - sent);
+                st->last_answer_ns = now;
+            }
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
+    static struct storm storm;
+    struct storm *st = &storm;
+    st->agent.sin_family = AF_INET;
+    st->agent.sin_port = htons(NEIGHBOR_PORT);
+    st->agent.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    st->count = 20000;
+    double rate = 0;
+    int hop = 1;
+    long wait_ms = 1000;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if (inet_pton(AF_INET, argv[++i], &st->agent.sin_addr) != 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            st->count = atol(argv[++i]);
+            if (st->count < 1 || st->count > 100000000)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rate = atof(argv[++i]);
+            if (rate < 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-H") == 0 && i + 1 < argc) {
+            hop = atoi(argv[++i]);
+            if (hop < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            wait_ms = atol(argv[++i]);
+            if (wait_ms < 0)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    if ((st->sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("socket");
+        exit(EXIT_FAILURE);
+    }
+    int broadcastEnable = 1;
+    setsockopt(st->sockfd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable));
+    int rcvbuf = 8 * 1024 * 1024;
+    if (setsockopt(st->sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+        setsockopt(st->sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct timeval tv = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(st->sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    st->sent_ns = calloc((size_t) st->count, sizeof(*st->sent_ns));
+    st->answered = calloc((size_t) st->count, 1);
+    if (st->sent_ns == NULL || st->answered == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    latency_log_init(&st->latencies);
+    srand((unsigned int)(time(NULL) ^ getpid()));
+    st->base_id = rand() % 1000000000;
+    if (st->base_id > 2147483647 - st->count)
+        st->base_id -= (int) st->count;
+
+    pthread_t receiver;
+    if (pthread_create(&receiver, NULL, receive_main, st) != 0) {
+        perror("pthread_create");
+        exit(EXIT_FAILURE);
+    }
+
+    static char text[STORM_BATCH][64];
+    struct mmsghdr msgs[STORM_BATCH];
+    struct iovec iov[STORM_BATCH];
+    unsigned long long send_errors = 0;
+    uint64_t start = bench_now_ns();
+    long sent = 0;
+    while (sent < st->count) {
+        if (rate > 0) {
+            /* Pace the batches: request k leaves at start + k / rate. */
+            uint64_t due = start + (uint64_t)((double) sent * 1e9 / rate);
+            uint64_t now = bench_now_ns();
+            if (due > now) {
+                struct timespec ts = { .tv_sec = (time_t)((due - now) / 1000000000ULL),
+                                       .tv_nsec = (long)((due - now) % 1000000000ULL) };
+                nanosleep(&ts, NULL);
+            }
+        }
+        int batch = 0;
+        long limit = rate > 0 ? (long)(rate / 1000) + 1 : STORM_BATCH;
+        if (limit > STORM_BATCH)
+            limit = STORM_BATCH;
+        while (batch < limit && sent + batch < st->count) {
+            int len = snprintf(text[batch], sizeof(text[batch]), "%s %ld %d", REQUEST_PREFIX,
+                               st->base_id + sent + batch, hop);
+            iov[batch].iov_base = text[batch];
+            iov[batch].iov_len = (size_t) len;
+            memset(&msgs[batch], 0, sizeof(msgs[batch]));
+            msgs[batch].msg_hdr.msg_name = &st->agent;
+            msgs[batch].msg_hdr.msg_namelen = sizeof(st->agent);
+            msgs[batch].msg_hdr.msg_iov = &iov[batch];
+            msgs[batch].msg_hdr.msg_iovlen = 1;
+            batch++;
+        }
+        uint64_t now = bench_now_ns();
+        for (int i = 0; i < batch; i++)
+            atomic_store_explicit(&st->sent_ns[sent + i], now, memory_order_release);
+        int done = 0;
+        while (done < batch) {
+            int n = sendmmsg(st->sockfd, msgs + done, (unsigned int)(batch - done), 0);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                /* Count it and forget it: it will show as unanswered. */
+                send_errors++;
+                n = 1;
+            }
+            done += n;
+        }
+        sent += batch;
+    }
+    uint64_t send_end = bench_now_ns();
+
+    /* Wait for the stragglers. */
+    struct timespec ts = { .tv_sec = wait_ms / 1000, .tv_nsec = (wait_ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+    atomic_store(&st->stop, 1);
+    pthread_join(receiver, NULL);
+
+    char target[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &st->agent.sin_addr, target, sizeof(target));
+    double send_s = (double)(send_end - start) / 1e9;
+    uint64_t last = st->last_answer_ns > start ? st->last_answer_ns : send_end;
+    double answer_s = (double)(last - start) / 1e9;
+    size_t answered = st->latencies.count;
+    printf("{\"bench\": \"neighbor_storm\", \"target\": \"%s\", \"hop\": %d, \"rate_limit\": %.0f, "
+           "\"sent\": %ld, \"send_errors\": %llu, \"answered\": %zu, \"duplicates\": %llu, "
+           "\"foreign\": %llu, \"loss_pct\": %.3f, \"send_per_s\": %.1f, \"answer_per_s\": %.1f",
+           target, hop, rate, st->count, send_errors, answered, st->duplicates, st->foreign,
+           100.0 * (double)((size_t) st->count - answered) / (double) st->count,
+           (double) st->count / send_s, answer_s > 0 ? (double) answered / answer_s : 0);
+    latency_log_print_json(&st->latencies, stdout);
+    printf("}\n");
+
+    latency_log_free(&st->latencies);
+    free(st->sent_ns);
+    free(st->answered);
+    close(st->sockfd);
+    return answered > 0 ? 0 : 1;
+}
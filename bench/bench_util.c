@@ -0,0 +1,91 @@
+/*
+ * bench_util.c
+ *
+ * Clock and latency percentiles for the benchmarks (see bench_util.h).
+ */
+
+#include "bench_util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+void latency_log_init(struct latency_log *log) {
+    memset(log, 0, sizeof(*log));
+}
+
+static int reserve(struct latency_log *log, size_t count) {
+    if (count <= log->cap)
+        return 0;
+    size_t cap = log->cap ? log->cap : 1024;
+    while (cap < count)
+        cap *= 2;
+    uint64_t *ns = realloc(log->ns, cap * sizeof(*ns));
+    if (ns == NULL)
+        return -1;
+    log->ns = ns;
+    log->cap = cap;
+    return 0;
+}
+
+int latency_log_add(struct latency_log *log, uint64_t ns) {
+    if (reserve(log, log->count + 1) < 0)
+        return -1;
+    log->ns[log->count++] = ns;
+    log->sorted = 0;
+    return 0;
+}
+
+int latency_log_merge(struct latency_log *dst, const struct latency_log *src) {
+    if (src->count == 0)
+        return 0;
+    if (reserve(dst, dst->count + src->count) < 0)
+        return -1;
+    memcpy(dst->ns + dst->count, src->ns, src->count * sizeof(*src->ns));
+    dst->count += src->count;
+    dst->sorted = 0;
+    return 0;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+uint64_t latency_log_percentile(struct latency_log *log, double p) {
+    if (log->count == 0)
+        return 0;
+    if (!log->sorted) {
+        qsort(log->ns, log->count, sizeof(*log->ns), cmp_u64);
+        log->sorted = 1;
+    }
+    size_t rank = (size_t)(p / 100.0 * (double) log->count);
+    if (rank >= log->count)
+        rank = log->count - 1;
+    return log->ns[rank];
+}
+
+void latency_log_print_json(struct latency_log *log, FILE *stream) {
+    double sum = 0;
+    for (size_t i = 0; i < log->count; i++)
+        sum += (double) log->ns[i];
+    double mean = log->count ? sum / (double) log->count : 0;
+    fprintf(stream, ", \"samples\": %zu, \"mean_us\": %.3f, \"p50_us\": %.3f, \"p99_us\": %.3f, "
+                    "\"p999_us\": %.3f, \"max_us\": %.3f",
+            log->count, mean / 1e3,
+            (double) latency_log_percentile(log, 50) / 1e3,
+            (double) latency_log_percentile(log, 99) / 1e3,
+            (double) latency_log_percentile(log, 99.9) / 1e3,
+            (double) latency_log_percentile(log, 100) / 1e3);
+}
+
+void latency_log_free(struct latency_log *log) {
+    free(log->ns);
+    memset(log, 0, sizeof(*log));
+}
@@ -0,0 +1,52 @@
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Helpers shared by the benchmarks (see bench/run_bench.sh). Every benchmark
+ * prints its results as JSON Lines on stdout: one object per measurement,
+ * with a "bench" field naming it, so that runs can be stored and compared.
+ */
+
+/* CLOCK_MONOTONIC in nanoseconds. */
+uint64_t bench_now_ns(void);
+
+/*
+ * struct latency_log:
+ *   Latencies in nanoseconds, in a growable array. Percentiles sort it.
+ */
+struct latency_log {
+    uint64_t *ns;
+    size_t    count;
+    size_t    cap;
+    int       sorted;
+};
+
+void latency_log_init(struct latency_log *log);
+
+/* Returns 0, or -1 on allocation failure (the sample is lost). */
+int latency_log_add(struct latency_log *log, uint64_t ns);
+
+/* Append the samples of src to dst. Returns 0, or -1 on allocation failure. */
+int latency_log_merge(struct latency_log *dst, const struct latency_log *src);
+
+/*
+ * latency_log_percentile:
+ *   The sample at or below which p percent (0 to 100) of them lie, 0 if
+ *   there are none.
+ */
+uint64_t latency_log_percentile(struct latency_log *log, double p);
+
+/*
+ * latency_log_print_json:
+ *   Print the count, mean, p50, p99, p999 and max of the log, in
+ *   microseconds, as JSON members (without braces) prefixed by a comma.
+ */
+void latency_log_print_json(struct latency_log *log, FILE *stream);
+
+void latency_log_free(struct latency_log *log);
+
+#endif /* BENCH_UTIL_H */
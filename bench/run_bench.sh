@@ -0,0 +1,125 @@
+#!/bin/sh
+#
+# run_bench.sh
+#
+# Runs the benchmark suite (make bench) from the top of the tree:
+#   1. bench_ifshow          microbenchmarks of the ifshow library
+#   2. bench_ifnetshow_load  closed-loop TCP load on a local ifnetshow_agent
+#   3. bench_neighbor_storm  UDP discovery storm on a local neighborshow_agent
+#
+# Every result is one JSON object per line, written to stdout and appended
+# to $BENCH_OUT, after a "meta" line identifying the run (commit, compiler
+# flags, host). Settings, from the environment:
+#   BENCH_OUT       results file (default bench_results.jsonl)
+#   BENCH_DURATION  seconds per TCP load run (default 5)
+#   BENCH_REQUESTS  requests per UDP storm (default 20000)
+#   BENCH_WORKERS   ifnetshow_agent worker threads (default: number of CPUs)
+#   BENCH_NETNS     1 to run neighborshow_agent in its own network namespace
+#                   behind a veth pair instead of on loopback (needs root)
+#   BENCH_CFLAGS    recorded in the meta line (set by the Makefile)
+#
+# The agents listen on their fixed ports (12345/tcp, 54321/udp), so no other
+# instance may be running on this host.
+
+set -u
+
+OUT=${BENCH_OUT:-bench_results.jsonl}
+DURATION=${BENCH_DURATION:-5}
+REQUESTS=${BENCH_REQUESTS:-20000}
+CPUS=$(nproc 2>/dev/null || echo 1)
+WORKERS=${BENCH_WORKERS:-$CPUS}
+NETNS=${BENCH_NETNS:-0}
+LOG=$(mktemp -d /tmp/bench.XXXXXX)
+AGENT_PID=
+STATUS=0
+
+emit() {
+    tee -a "$OUT"
+}
+
+# run <benchmark...>: run a benchmark and emit its results; a benchmark that
+# fails (or crashes) fails the suite. Its output goes through a file so
+# that its own exit status is the one checked, not emit's.
+run() {
+    "$@" > "$LOG/run.out"
+    rc=$?
+    emit < "$LOG/run.out"
+    if [ "$rc" -ne 0 ]; then
+        echo "$1 failed (exit status $rc)." >&2
+        STATUS=1
+    fi
+}
+
+cleanup() {
+    [ -n "$AGENT_PID" ] && kill "$AGENT_PID" 2>/dev/null && wait "$AGENT_PID" 2>/dev/null
+    AGENT_PID=
+    if [ "$NETNS" = 1 ]; then
+        ip link del benchveth0 2>/dev/null
+        ip netns del benchns 2>/dev/null
+    fi
+}
+trap 'cleanup; rm -rf "$LOG"' EXIT INT TERM
+
+# wait_for <command...>: wait up to 5 s for the agent to be ready, that is
+# for the command to succeed, as long as the agent is running.
+wait_for() {
+    for _ in 1 2 3 4 5 6 7 8 9 10; do
+        "$@" > /dev/null 2>&1 && return 0
+        kill -0 "$AGENT_PID" 2>/dev/null || return 1
+        sleep 0.5
+    done
+    return 1
+}
+
+printf '{"bench": "meta", "commit": "%s", "cflags": "%s", "host": "%s", "kernel": "%s", "cpus": %s, "date": "%s"}\n' \
+    "$(git rev-parse --short HEAD 2>/dev/null || echo unknown)" "${BENCH_CFLAGS:-}" \
+    "$(uname -n)" "$(uname -r)" "$CPUS" "$(date -u +%Y-%m-%dT%H:%M:%SZ)" | emit
+
+# 1. Library microbenchmarks.
+run ./bench_ifshow
+
+# 2. TCP load on ifnetshow_agent.
+./ifnetshow_agent -w "$WORKERS" > "$LOG/ifnetshow_agent.log" 2>&1 &
+AGENT_PID=$!
+if wait_for ./bench_ifnetshow_load -c 1 -d 0.1; then
+    for conns in 1 16; do
+        run ./bench_ifnetshow_load -c "$conns" -d "$DURATION" -P 2 -m ALL
+        run ./bench_ifnetshow_load -c "$conns" -d "$DURATION" -P 2 -m ALL -B
+        run ./bench_ifnetshow_load -c "$conns" -d "$DURATION" -P 2 -m "IFNAME lo"
+        run ./bench_ifnetshow_load -c "$conns" -d "$DURATION" -P 1 -m ALL
+    done
+else
+    echo "ifnetshow_agent did not start (see below), skipping the TCP load." >&2
+    cat "$LOG/ifnetshow_agent.log" >&2
+    STATUS=1
+fi
+cleanup
+
+# 3. UDP discovery storm on neighborshow_agent.
+TARGET=127.0.0.1
+if [ "$NETNS" = 1 ]; then
+    ip netns add benchns &&
+    ip link add benchveth0 type veth peer name benchveth1 &&
+    ip link set benchveth1 netns benchns &&
+    ip addr add 10.231.0.1/30 dev benchveth0 &&
+    ip link set benchveth0 up &&
+    ip netns exec benchns ip addr add 10.231.0.2/30 dev benchveth1 &&
+    ip netns exec benchns ip link set benchveth1 up &&
+    ip netns exec benchns ip link set lo up || { echo "Cannot set up the namespace." >&2; exit 1; }
+    TARGET=10.231.0.2
+    ip netns exec benchns ./neighborshow_agent > "$LOG/neighborshow_agent.log" 2>&1 &
+else
+    ./neighborshow_agent > "$LOG/neighborshow_agent.log" 2>&1 &
+fi
+AGENT_PID=$!
+if wait_for grep -q listening "$LOG/neighborshow_agent.log"; then
+    run ./bench_neighbor_storm -a "$TARGET" -n "$REQUESTS"
+    run ./bench_neighbor_storm -a "$TARGET" -n "$REQUESTS" -r 10000
+else
+    echo "neighborshow_agent did not start (see below), skipping the UDP storm." >&2
+    cat "$LOG/neighborshow_agent.log" >&2
+    STATUS=1
+fi
+cleanup
+
+exit $STATUS
@@ -0,0 +1,255 @@
+/*
+ * log_ring.c
+ *
+ * Rate-limited logging through a lock-free ring drained by a background
+ * thread (see log_ring.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "log_ring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Longest message kept; longer ones are truncated. */
+#define LOG_TEXT_MAX 480
+
+/* How long the drain thread sleeps when the ring is empty. */
+#define LOG_DRAIN_INTERVAL_MS 20
+
+/*
+ * struct log_entry:
+ *   One slot of the ring. seq tells whose turn the slot is (bounded MPMC
+ *   queue after D. Vyukov): position for a producer, position + 1 once the
+ *   message is in it, position + LOG_RING_SLOTS once it was written out.
+ */
+struct log_entry {
+    _Atomic uint64_t seq;
+    struct timespec  time;
+    enum log_level   level;
+    const char      *site;
+    uint64_t         suppressed;
+    char             text[LOG_TEXT_MAX];
+};
+
+static const char *const level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+/*
+ * The ring. Producers announce themselves in writers before they look at
+ * stopping (both sequentially consistent): once the drain thread saw
+ * stopping and no writer, every later message sees stopping and goes to
+ * stderr, so none is left in a slot after the thread is gone. slots stays
+ * set after log_ring_stop().
+ */
+static struct {
+    struct log_entry *_Atomic slots;
+    _Atomic uint64_t  head;           /* next position to fill */
+    uint64_t          tail;           /* next position to write out (drain thread) */
+    _Atomic uint64_t  dropped;        /* ring full */
+    _Atomic int       writers;        /* producers between claiming and publishing */
+    _Atomic int       stopping;
+    FILE             *stream;
+    pthread_t         thread;
+} ring;
+
+static _Atomic int log_threshold = LOG_LEVEL_INFO;
+
+int log_level_parse(const char *name) {
+    for (int i = 0; i <= LOG_LEVEL_DEBUG; i++) {
+        if (strcasecmp(name, level_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int log_admit(struct log_site *site, enum log_level level) {
+    if ((int) level > atomic_load_explicit(&log_threshold, memory_order_relaxed))
+        return 0;
+
+    uint64_t n = atomic_fetch_add_explicit(&site->occurrences, 1, memory_order_relaxed);
+    if (site->sample > 1 && n % site->sample != 0)
+        goto suppress;
+
+    if (site->rate > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        long long now = (long long) ts.tv_sec;
+        long long window = atomic_load_explicit(&site->window, memory_order_relaxed);
+        /* Whoever moves the window on resets its count; a few racing
+         * messages may be counted in the old one, which does not matter. */
+        if (window != now &&
+            atomic_compare_exchange_strong_explicit(&site->window, &window, now,
+                                                    memory_order_relaxed, memory_order_relaxed))
+            atomic_store_explicit(&site->in_window, 0, memory_order_relaxed);
+        if (atomic_fetch_add_explicit(&site->in_window, 1, memory_order_relaxed) >= site->rate)
+            goto suppress;
+    }
+    return 1;
+
+suppress:
+    atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+    return 0;
+}
+
+static void write_entry(FILE *stream, const struct log_entry *e) {
+    struct tm tm;
+    char stamp[32];
+    gmtime_r(&e->time.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    fprintf(stream, "%s.%03ldZ %-5s %s: %s", stamp, e->time.tv_nsec / 1000000,
+            level_names[e->level], e->site, e->text);
+    if (e->suppressed > 0)
+        fprintf(stream, " (%llu similar suppressed)", (unsigned long long) e->suppressed);
+    fputc('\n', stream);
+}
+
+/*
+ * claim_slot:
+ *   Reserve the next free slot of the ring, or NULL if it is full.
+ */
+static struct log_entry *claim_slot(struct log_entry *slots, uint64_t *pos_out) {
+    uint64_t pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    for (;;) {
+        struct log_entry *e = &slots[pos % LOG_RING_SLOTS];
+        uint64_t seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        int64_t diff = (int64_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring.head, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed)) {
+                *pos_out = pos;
+                return e;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&ring.head, memory_order_relaxed);
+        }
+    }
+}
+
+void log_write(struct log_site *site, enum log_level level, const char *fmt, ...) {
+    int saved_errno = errno;
+    struct log_entry local;
+    struct log_entry *e = &local;
+    uint64_t pos = 0;
+
+    struct log_entry *slots = atomic_load_explicit(&ring.slots, memory_order_acquire);
+    if (slots != NULL) {
+        atomic_fetch_add(&ring.writers, 1);
+        if (atomic_load(&ring.stopping)) {
+            atomic_fetch_sub(&ring.writers, 1);
+        } else if ((e = claim_slot(slots, &pos)) == NULL) {
+            atomic_fetch_sub(&ring.writers, 1);
+            atomic_fetch_add_explicit(&ring.dropped, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&site->suppressed, 1, memory_order_relaxed);
+            errno = saved_errno;
+            return;
+        }
+    }
+
+    clock_gettime(CLOCK_REALTIME, &e->time);
+    e->level = level;
+    e->site = site->name;
+    e->suppressed = atomic_exchange_explicit(&site->suppressed, 0, memory_order_relaxed);
+    va_list ap;
+    va_start(ap, fmt);
+    errno = saved_errno;
+    vsnprintf(e->text, sizeof(e->text), fmt, ap);
+    va_end(ap);
+
+    if (e == &local) {
+        write_entry(stderr, e);
+    } else {
+        atomic_store_explicit(&e->seq, pos + 1, memory_order_release);
+        atomic_fetch_sub(&ring.writers, 1);
+    }
+    errno = saved_errno;
+}
+
+/*
+ * drain:
+ *   Write out the messages that are ready. Returns how many there were.
+ */
+static size_t drain(void) {
+    struct log_entry *slots = atomic_load_explicit(&ring.slots, memory_order_relaxed);
+    size_t written = 0;
+    for (;;) {
+        struct log_entry *e = &slots[ring.tail % LOG_RING_SLOTS];
+        if (atomic_load_explicit(&e->seq, memory_order_acquire) != ring.tail + 1)
+            break;
+        write_entry(ring.stream, e);
+        atomic_store_explicit(&e->seq, ring.tail + LOG_RING_SLOTS, memory_order_release);
+        ring.tail++;
+        written++;
+    }
+
+    uint64_t dropped = atomic_exchange_explicit(&ring.dropped, 0, memory_order_relaxed);
+    if (dropped > 0)
+        fprintf(ring.stream, "log: %llu messages dropped, the log ring was full\n",
+                (unsigned long long) dropped);
+    if (written > 0 || dropped > 0)
+        fflush(ring.stream);
+    return written;
+}
+
+static void *drain_thread(void *arg) {
+    (void) arg;
+    struct timespec pause = { .tv_sec = 0, .tv_nsec = LOG_DRAIN_INTERVAL_MS * 1000000L };
+    for (;;) {
+        /* Seen before draining: no writer then means every claimed slot
+         * was published, and no slot is claimed any more. */
+        int stopping = atomic_load(&ring.stopping);
+        int writers = atomic_load(&ring.writers);
+        if (drain() == 0) {
+            if (stopping && writers == 0 &&
+                atomic_load_explicit(&ring.head, memory_order_acquire) == ring.tail)
+                break;
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+int log_ring_start(enum log_level level, FILE *stream) {
+    atomic_store(&log_threshold, (int) level);
+    if (atomic_load(&ring.slots) != NULL)
+        return 0;
+
+    struct log_entry *slots = calloc(LOG_RING_SLOTS, sizeof(*slots));
+    if (slots == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    for (uint64_t i = 0; i < LOG_RING_SLOTS; i++)
+        atomic_init(&slots[i].seq, i);
+    ring.stream = stream;
+    ring.tail = 0;
+    atomic_store(&ring.head, 0);
+    atomic_store(&ring.writers, 0);
+    atomic_store(&ring.stopping, 0);
+
+    atomic_store_explicit(&ring.slots, slots, memory_order_release);
+
+    int err = pthread_create(&ring.thread, NULL, drain_thread, NULL);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        atomic_store(&ring.slots, NULL);
+        free(slots);
+        return -1;
+    }
+    return 0;
+}
+
+void log_ring_stop(void) {
+    if (atomic_load(&ring.slots) == NULL || atomic_load(&ring.stopping))
+        return;
+    /* Later messages go to stderr directly; the slots are left to the process. */
+    atomic_store(&ring.stopping, 1);
+    pthread_join(ring.thread, NULL);
+}
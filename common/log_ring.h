@@ -0,0 +1,88 @@
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Logging of the agents, off their serving threads.
+ *
+ * A message is formatted by the thread that logs it into a slot of a
+ * bounded in-memory ring (lock-free, any number of producers) and written
+ * out by a background thread, so a slow stdout or journal never blocks a
+ * request. When the ring is full the message is dropped and counted, never
+ * waited for.
+ *
+ * Every kind of message has a struct log_site giving its name, and how
+ * many of them may be logged per second and/or which fraction of them
+ * (one in sample). Messages held back by either are counted and the count
+ * is appended to the next one of the same kind that gets through. The
+ * LOG() macro evaluates its arguments only for messages that get through.
+ */
+
+enum log_level {
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG
+};
+
+struct log_site {
+    const char            *name;
+    unsigned int           rate;          /* messages per second, 0 for no limit */
+    unsigned int           sample;        /* log one in sample, 0 or 1 for all */
+    _Atomic uint64_t       occurrences;
+    _Atomic long long      window;        /* second the rate is counted in */
+    _Atomic unsigned int   in_window;
+    _Atomic uint64_t       suppressed;    /* since the last message logged */
+};
+
+#define LOG_SITE_INIT(name_, rate_, sample_) { .name = (name_), .rate = (rate_), .sample = (sample_) }
+
+#define LOG(level, site, ...)                                  \
+    do {                                                       \
+        if (log_admit(&(site), (level)))                       \
+            log_write(&(site), (level), __VA_ARGS__);          \
+    } while (0)
+
+/*
+ * log_ring_start:
+ *   Log messages of level and above to stream from now on, through a ring
+ *   of LOG_RING_SLOTS messages drained by a new thread. Before it is called,
+ *   after log_ring_stop() (or if it fails) messages are written to stderr
+ *   directly.
+ *   Returns 0, or -1 on error.
+ */
+#define LOG_RING_SLOTS 1024
+int log_ring_start(enum log_level level, FILE *stream);
+
+/*
+ * log_ring_stop:
+ *   Write out the messages still in the ring, including those being
+ *   written into it, and stop the thread.
+ */
+void log_ring_stop(void);
+
+/*
+ * log_level_parse:
+ *   "error", "warn", "info" or "debug". Returns -1 for anything else.
+ */
+int log_level_parse(const char *name);
+
+/*
+ * log_admit:
+ *   Whether a message of this kind and level is to be logged now (see
+ *   above); counts it as suppressed if not.
+ */
+int log_admit(struct log_site *site, enum log_level level);
+
+/*
+ * log_write:
+ *   Queue a message that log_admit() let through. The format may use %m
+ *   for the error of errno, which is preserved.
+ */
+void log_write(struct log_site *site, enum log_level level, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#endif /* LOG_RING_H */
@@ -0,0 +1,267 @@
+/*
+ * metrics.c
+ *
+ * Histograms and exposition of the agents' metrics (see metrics.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "metrics.h"
+#include "log_ring.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* Time one metrics_http_serve() call may take, and the largest request read. */
+#define HTTP_TIMEOUT_MS  200
+#define HTTP_MAX_REQUEST 4096
+
+/* Errors on the serving path go through the log ring (see log_ring.h). */
+static struct log_site log_metrics = LOG_SITE_INIT("metrics", 1, 1);
+
+/* Upper bound (inclusive) of the values of a bucket. */
+static uint64_t bucket_upper(unsigned int index) {
+    if (index < 2 * METRICS_SUB_BUCKETS)
+        return index;
+    unsigned int shift = index / METRICS_SUB_BUCKETS - 1;
+    uint64_t sub = index % METRICS_SUB_BUCKETS;
+    return ((METRICS_SUB_BUCKETS + sub) << shift) + (1ULL << shift) - 1;
+}
+
+void metrics_summary_add(struct metrics_summary *s, const struct metrics_histogram *h) {
+    for (unsigned int i = 0; i < METRICS_BUCKETS; i++)
+        s->buckets[i] += metrics_counter_read(&h->buckets[i]);
+    s->count += metrics_counter_read(&h->count);
+    s->sum += metrics_counter_read(&h->sum);
+    uint64_t max = metrics_counter_read(&h->max);
+    if (max > s->max)
+        s->max = max;
+}
+
+uint64_t metrics_summary_quantile(const struct metrics_summary *s, double q) {
+    /* The buckets are read one by one while they change: trust their sum. */
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < METRICS_BUCKETS; i++)
+        total += s->buckets[i];
+    if (total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(q * (double) total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < METRICS_BUCKETS; i++) {
+        seen += s->buckets[i];
+        if (seen > rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < s->max ? upper : s->max;
+        }
+    }
+    return s->max;
+}
+
+void metrics_write_summary(FILE *stream, const char *name, const struct metrics_summary *s) {
+    double mean = s->count ? (double) s->sum / (double) s->count : 0;
+    fprintf(stream, "%s: count %llu, mean %.1f us, p50 %.1f us, p90 %.1f us, p99 %.1f us, "
+                    "p99.9 %.1f us, max %.1f us\n",
+            name, (unsigned long long) s->count, mean / 1e3,
+            (double) metrics_summary_quantile(s, 0.5) / 1e3,
+            (double) metrics_summary_quantile(s, 0.9) / 1e3,
+            (double) metrics_summary_quantile(s, 0.99) / 1e3,
+            (double) metrics_summary_quantile(s, 0.999) / 1e3,
+            (double) s->max / 1e3);
+}
+
+void metrics_prom_header(FILE *stream, const char *name, const char *type, const char *help) {
+    fprintf(stream, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+void metrics_prom_value(FILE *stream, const char *name, const char *labels, uint64_t value) {
+    if (labels != NULL)
+        fprintf(stream, "%s{%s} %llu\n", name, labels, (unsigned long long) value);
+    else
+        fprintf(stream, "%s %llu\n", name, (unsigned long long) value);
+}
+
+void metrics_prom_histogram(FILE *stream, const char *name, const char *labels,
+                            const struct metrics_summary *s) {
+    const char *sep = labels != NULL ? "," : "";
+    if (labels == NULL)
+        labels = "";
+
+    /* Power-of-two boundaries from 2^10 ns: they fall between buckets. */
+    unsigned int i = 0;
+    uint64_t cumulative = 0;
+    for (unsigned int bits = 10; bits < METRICS_MAX_BITS; bits++) {
+        uint64_t bound = 1ULL << bits;
+        while (i < METRICS_BUCKETS && bucket_upper(i) < bound)
+            cumulative += s->buckets[i++];
+        fprintf(stream, "%s_bucket{%s%sle=\"%.9g\"} %llu\n", name, labels, sep,
+                (double) bound / 1e9, (unsigned long long) cumulative);
+        if (bound > s->max)
+            break;
+    }
+    uint64_t total = 0;
+    for (unsigned int k = 0; k < METRICS_BUCKETS; k++)
+        total += s->buckets[k];
+    fprintf(stream, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels, sep,
+            (unsigned long long) total);
+    fprintf(stream, "%s_sum%s%s%s %.9f\n", name, *labels ? "{" : "", labels, *labels ? "}" : "",
+            (double) s->sum / 1e9);
+    fprintf(stream, "%s_count%s%s%s %llu\n", name, *labels ? "{" : "", labels,
+            *labels ? "}" : "", (unsigned long long) total);
+}
+
+int metrics_http_listen(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((unsigned short) port);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        perror("metrics endpoint");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * wait_ready:
+ *   Wait until fd is ready for events, at the latest until deadline.
+ *   Returns 0 once it is, -1 on timeout or error.
+ */
+static int wait_ready(int fd, short events, long long deadline) {
+    for (;;) {
+        long long left = deadline - monotonic_ms();
+        if (left <= 0)
+            return -1;
+        struct pollfd pfd = { .fd = fd, .events = events, .revents = 0 };
+        int n = poll(&pfd, 1, (int) left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        return n > 0 ? 0 : -1;
+    }
+}
+
+static int write_full(int fd, const char *buf, size_t len, long long deadline) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (wait_ready(fd, POLLOUT, deadline) < 0)
+                return -1;
+            continue;
+        }
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/*
+ * serve_scrape:
+ *   One HTTP/1.0 exchange on a connected, non-blocking socket, given up
+ *   at deadline.
+ */
+static void serve_scrape(int fd, void (*render)(FILE *stream, void *ctx), void *ctx,
+                         long long deadline) {
+    /* Read the request head; only its first line matters. */
+    char request[HTTP_MAX_REQUEST + 1];
+    size_t len = 0;
+    while (len < HTTP_MAX_REQUEST) {
+        ssize_t n = recv(fd, request + len, HTTP_MAX_REQUEST - len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (wait_ready(fd, POLLIN, deadline) < 0)
+                return;     /* the request never completed */
+            continue;
+        }
+        if (n <= 0)
+            break;
+        len += (size_t) n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+            break;
+    }
+    request[len] = '\0';
+
+    char method[8], path[256];
+    int ok = sscanf(request, "%7s %255s", method, path) == 2 && strcmp(method, "GET") == 0 &&
+             (strcmp(path, "/metrics") == 0 || strcmp(path, "/") == 0);
+
+    /* Render the page; a client gets a 500 rather than nothing if it fails. */
+    char *body = NULL;
+    size_t body_len = 0;
+    int status = ok ? 200 : 404;
+    if (ok) {
+        FILE *stream = open_memstream(&body, &body_len);
+        if (stream != NULL)
+            render(stream, ctx);
+        if (stream == NULL || fclose(stream) != 0) {
+            LOG(LOG_LEVEL_ERROR, log_metrics, "Cannot render the metrics: %m");
+            status = 500;
+        }
+    }
+
+    char head[256];
+    int head_len;
+    if (status == 200)
+        head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.0 200 OK\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: %zu\r\n\r\n", body_len);
+    else if (status == 404)
+        head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.0 404 Not Found\r\n"
+                            "Content-Type: text/plain\r\n"
+                            "Content-Length: 10\r\n\r\nNot found\n");
+    else
+        head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.0 500 Internal Server Error\r\n"
+                            "Content-Type: text/plain\r\n"
+                            "Content-Length: 22\r\n\r\nInternal server error\n");
+    if (write_full(fd, head, (size_t) head_len, deadline) == 0 && status == 200)
+        write_full(fd, body, body_len, deadline);
+    free(body);
+}
+
+void metrics_http_serve(int listen_fd, void (*render)(FILE *stream, void *ctx), void *ctx) {
+    long long deadline = monotonic_ms() + HTTP_TIMEOUT_MS;
+    while (monotonic_ms() < deadline) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                LOG(LOG_LEVEL_ERROR, log_metrics, "accept (metrics): %m");
+            return;
+        }
+        serve_scrape(fd, render, ctx, deadline);
+        close(fd);
+    }
+}
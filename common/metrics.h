@@ -0,0 +1,139 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Metrics of the agents: counters and latency histograms that the serving
+ * threads update on every request, read now and then by whoever reports
+ * them (a STATS request, a Prometheus scrape).
+ *
+ * Every counter and histogram has a single writer, the thread that owns it
+ * (a multi-threaded agent gives each thread its own set and sums them when
+ * reporting). An update is then a relaxed load and store to memory no
+ * other thread writes: no lock, no atomic read-modify-write, no cache line
+ * bouncing between threads. Readers load the values relaxed; a report may
+ * miss the updates in flight but never sees a torn value.
+ */
+
+static inline void metrics_counter_add(_Atomic uint64_t *counter, uint64_t n) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+                          memory_order_relaxed);
+}
+
+static inline uint64_t metrics_counter_read(const _Atomic uint64_t *counter) {
+    return atomic_load_explicit((_Atomic uint64_t *) counter, memory_order_relaxed);
+}
+
+/*
+ * Histogram buckets are log-linear, as in HdrHistogram: values below 32 have
+ * a bucket each, and every power of two above is split into
+ * METRICS_SUB_BUCKETS buckets, so a bucket is at most 1/16th (6.25%) of
+ * its values wide. Values up to 2^METRICS_MAX_BITS - 1 (about 9 minutes in
+ * nanoseconds) are told apart; larger ones fall into the last bucket.
+ */
+#define METRICS_SUB_BITS    4
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_MAX_BITS    40
+#define METRICS_BUCKETS     ((METRICS_MAX_BITS - METRICS_SUB_BITS + 1) * METRICS_SUB_BUCKETS)
+
+/*
+ * struct metrics_histogram:
+ *   Distribution of values (nanoseconds) recorded by one thread.
+ */
+struct metrics_histogram {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t buckets[METRICS_BUCKETS];
+};
+
+/*
+ * struct metrics_summary:
+ *   Plain copy of one or more histograms (summed), for reporting.
+ */
+struct metrics_summary {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[METRICS_BUCKETS];
+};
+
+static inline unsigned int metrics_bucket(uint64_t value) {
+    if (value < 2 * METRICS_SUB_BUCKETS)
+        return (unsigned int) value;
+    unsigned int msb = 63 - (unsigned int) __builtin_clzll(value);
+    if (msb >= METRICS_MAX_BITS)
+        return METRICS_BUCKETS - 1;
+    unsigned int shift = msb - METRICS_SUB_BITS;
+    return (shift + 1) * METRICS_SUB_BUCKETS +
+           (unsigned int)((value >> shift) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/*
+ * metrics_histogram_record:
+ *   Record one value; only the owning thread may call it.
+ */
+static inline void metrics_histogram_record(struct metrics_histogram *h, uint64_t value) {
+    metrics_counter_add(&h->buckets[metrics_bucket(value)], 1);
+    metrics_counter_add(&h->count, 1);
+    metrics_counter_add(&h->sum, value);
+    if (value > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+}
+
+/*
+ * metrics_summary_add:
+ *   Add the current contents of h to s (which starts zeroed).
+ */
+void metrics_summary_add(struct metrics_summary *s, const struct metrics_histogram *h);
+
+/*
+ * metrics_summary_quantile:
+ *   The value below which the fraction q (0 to 1) of the recorded values
+ *   lie, to the precision of the buckets (their upper bound, never more
+ *   than the maximum recorded). 0 if nothing was recorded.
+ */
+uint64_t metrics_summary_quantile(const struct metrics_summary *s, double q);
+
+/*
+ * metrics_write_summary:
+ *   One text line: "<name>: count N, mean X us, p50 X us, p90 X us,
+ *   p99 X us, p99.9 X us, max X us".
+ */
+void metrics_write_summary(FILE *stream, const char *name, const struct metrics_summary *s);
+
+/*
+ * metrics_prom_header / metrics_prom_value / metrics_prom_histogram:
+ *   Prometheus text exposition format (version 0.0.4). The header (HELP and
+ *   TYPE lines) is written once per metric, before its samples; labels is
+ *   the inside of the braces ("type=\"all\"") or NULL. Histograms are
+ *   written in seconds, with a bucket at every power of two of
+ *   nanoseconds from 1 us up to the largest value recorded.
+ */
+void metrics_prom_header(FILE *stream, const char *name, const char *type, const char *help);
+void metrics_prom_value(FILE *stream, const char *name, const char *labels, uint64_t value);
+void metrics_prom_histogram(FILE *stream, const char *name, const char *labels,
+                            const struct metrics_summary *s);
+
+/*
+ * metrics_http_listen:
+ *   Listen for Prometheus scrapes on 127.0.0.1:port (non-blocking).
+ *   Returns the socket, or -1 on error.
+ */
+int metrics_http_listen(int port);
+
+/*
+ * metrics_http_serve:
+ *   Answer the scrapes pending on listen_fd: GET /metrics (or /) gets what
+ *   render writes, anything else a 404. The sockets are non-blocking and
+ *   the whole call has one deadline (HTTP_TIMEOUT_MS in metrics.c): a
+ *   scraper that trickles its request or stops reading is dropped when it
+ *   expires, and scrapes still pending wait for the next call.
+ */
+void metrics_http_serve(int listen_fd, void (*render)(FILE *stream, void *ctx), void *ctx);
+
+#endif /* METRICS_H */
@@ -0,0 +1,156 @@
+/*
+ * agent_metrics.c
+ *
+ * Counters and request latencies of the ifnetshow agent workers, and their
+ * STATS and Prometheus reports (see agent_metrics.h).
+ */
+
+#include "agent_metrics.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Names of the counters: in the Prometheus output, counters sharing a name
+ * (consecutive in the table) are one metric told apart by their labels.
+ */
+static const struct {
+    const char *text;
+    const char *prom;
+    const char *labels;
+    const char *help;
+} counter_names[AM_COUNTERS] = {
+    [AM_REQ_ALL]         = { "requests_all", "ifnetshow_requests_total", "command=\"all\"",
+                             "Requests received, by command." },
+    [AM_REQ_IFNAME]      = { "requests_ifname", "ifnetshow_requests_total",
+                             "command=\"ifname\"", NULL },
+    [AM_REQ_GENERATION]  = { "requests_generation", "ifnetshow_requests_total",
+                             "command=\"generation\"", NULL },
+    [AM_REQ_RATES]       = { "requests_rates", "ifnetshow_requests_total",
+                             "command=\"rates\"", NULL },
+    [AM_REQ_SUBSCRIBE]   = { "requests_subscribe", "ifnetshow_requests_total",
+                             "command=\"subscribe\"", NULL },
+    [AM_REQ_STATS]       = { "requests_stats", "ifnetshow_requests_total",
+                             "command=\"stats\"", NULL },
+    [AM_REQ_INVALID]     = { "requests_invalid", "ifnetshow_requests_total",
+                             "command=\"invalid\"", NULL },
+    [AM_ANSWER_CACHED]   = { "answers_cached", "ifnetshow_answers_total", "source=\"cache\"",
+                             "Interface answers, by where they came from." },
+    [AM_ANSWER_RENDERED] = { "answers_rendered", "ifnetshow_answers_total",
+                             "source=\"rendered\"", NULL },
+    [AM_BYTES_OUT]       = { "bytes_out", "ifnetshow_sent_bytes_total", NULL,
+                             "Bytes written to clients." },
+    [AM_PUSHES]          = { "pushes", "ifnetshow_pushes_total", NULL,
+                             "Subscription messages sent." },
+    [AM_CONN_ACCEPTED]   = { "connections_accepted", "ifnetshow_connections_total",
+                             "event=\"accepted\"", "Connections, by event." },
+    [AM_CONN_CLOSED]     = { "connections_closed", "ifnetshow_connections_total",
+                             "event=\"closed\"", NULL },
+    [AM_CONN_EXPIRED]    = { "connections_expired", "ifnetshow_connections_total",
+                             "event=\"expired\"", NULL },
+    [AM_CONN_SHED]       = { "connections_shed", "ifnetshow_connections_total",
+                             "event=\"shed\"", NULL },
+    [AM_ERR_ACCEPT]      = { "errors_accept", "ifnetshow_errors_total", "kind=\"accept\"",
+                             "Errors, by kind." },
+    [AM_ERR_IO]          = { "errors_io", "ifnetshow_errors_total", "kind=\"io\"", NULL },
+    [AM_ERR_PROTOCOL]    = { "errors_protocol", "ifnetshow_errors_total",
+                             "kind=\"protocol\"", NULL },
+};
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int agent_metrics_init(struct agent_metrics_set *set, size_t count) {
+    /* aligned_alloc() wants a multiple of the alignment, which the struct size is. */
+    set->shards = aligned_alloc(_Alignof(struct agent_metrics), count * sizeof(*set->shards));
+    if (set->shards == NULL)
+        return -1;
+    memset(set->shards, 0, count * sizeof(*set->shards));
+    set->count = count;
+    set->started_ms = monotonic_ms();
+    return 0;
+}
+
+void agent_metrics_free(struct agent_metrics_set *set) {
+    free(set->shards);
+    set->shards = NULL;
+    set->count = 0;
+}
+
+/* Sum of one counter over the workers. */
+static uint64_t counter_total(const struct agent_metrics_set *set, enum agent_counter c) {
+    uint64_t total = 0;
+    for (size_t i = 0; i < set->count; i++)
+        total += metrics_counter_read(&set->shards[i].counters[c]);
+    return total;
+}
+
+/*
+ * summarize:
+ *   Sum the request latencies of the workers into a new summary (too large
+ *   for a worker's stack), to be freed by the caller. NULL if out of memory.
+ */
+static struct metrics_summary *summarize(const struct agent_metrics_set *set) {
+    struct metrics_summary *s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+    for (size_t i = 0; i < set->count; i++)
+        metrics_summary_add(s, &set->shards[i].request_ns);
+    return s;
+}
+
+/* Connections accepted and not closed yet (read in that order, never negative). */
+static uint64_t connections_open(const struct agent_metrics_set *set) {
+    uint64_t closed = counter_total(set, AM_CONN_CLOSED);
+    uint64_t accepted = counter_total(set, AM_CONN_ACCEPTED);
+    return accepted > closed ? accepted - closed : 0;
+}
+
+void agent_metrics_write_text(const struct agent_metrics_set *set, FILE *stream) {
+    fprintf(stream, "uptime_seconds %lld\n", (monotonic_ms() - set->started_ms) / 1000);
+    fprintf(stream, "workers %zu\n", set->count);
+    for (int c = 0; c < AM_COUNTERS; c++)
+        fprintf(stream, "%s %llu\n", counter_names[c].text,
+                (unsigned long long) counter_total(set, (enum agent_counter) c));
+    fprintf(stream, "connections_open %llu\n", (unsigned long long) connections_open(set));
+
+    struct metrics_summary *s = summarize(set);
+    if (s != NULL) {
+        metrics_write_summary(stream, "request_duration", s);
+        free(s);
+    }
+}
+
+void agent_metrics_write_prom(FILE *stream, void *ctx) {
+    const struct agent_metrics_set *set = ctx;
+
+    metrics_prom_header(stream, "ifnetshow_uptime_seconds", "gauge",
+                        "Seconds since the agent started.");
+    metrics_prom_value(stream, "ifnetshow_uptime_seconds", NULL,
+                       (uint64_t)((monotonic_ms() - set->started_ms) / 1000));
+    metrics_prom_header(stream, "ifnetshow_workers", "gauge", "Worker threads.");
+    metrics_prom_value(stream, "ifnetshow_workers", NULL, set->count);
+
+    for (int c = 0; c < AM_COUNTERS; c++) {
+        if (counter_names[c].help != NULL)
+            metrics_prom_header(stream, counter_names[c].prom, "counter", counter_names[c].help);
+        metrics_prom_value(stream, counter_names[c].prom, counter_names[c].labels,
+                           counter_total(set, (enum agent_counter) c));
+    }
+    metrics_prom_header(stream, "ifnetshow_connections_open", "gauge",
+                        "Connections currently open.");
+    metrics_prom_value(stream, "ifnetshow_connections_open", NULL, connections_open(set));
+
+    struct metrics_summary *s = summarize(set);
+    if (s != NULL) {
+        metrics_prom_header(stream, "ifnetshow_request_duration_seconds", "histogram",
+                            "Time taken to answer a request, from parsing to the answer "
+                            "being queued.");
+        metrics_prom_histogram(stream, "ifnetshow_request_duration_seconds", NULL, s);
+        free(s);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef AGENT_METRICS_H
+#define AGENT_METRICS_H
+
+#include "metrics.h"
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* What the agent counts (see the table in agent_metrics.c for their names). */
+enum agent_counter {
+    AM_REQ_ALL,
+    AM_REQ_IFNAME,
+    AM_REQ_GENERATION,
+    AM_REQ_RATES,
+    AM_REQ_SUBSCRIBE,
+    AM_REQ_STATS,
+    AM_REQ_INVALID,
+    AM_ANSWER_CACHED,       /* served from the pre-rendered response cache */
+    AM_ANSWER_RENDERED,     /* rendered for the request (LINK / STATS details) */
+    AM_BYTES_OUT,
+    AM_PUSHES,              /* subscription messages queued */
+    AM_CONN_ACCEPTED,
+    AM_CONN_CLOSED,
+    AM_CONN_EXPIRED,
+    AM_CONN_SHED,
+    AM_ERR_ACCEPT,
+    AM_ERR_IO,
+    AM_ERR_PROTOCOL,
+    AM_COUNTERS
+};
+
+/*
+ * struct agent_metrics:
+ *   The counters of one worker thread and the time it took to answer its
+ *   requests (parsing and rendering, not sending). Only that worker writes
+ *   them (see metrics.h); each set starts on its own cache line so that
+ *   workers never write to the same line.
+ */
+struct agent_metrics {
+    _Atomic uint64_t         counters[AM_COUNTERS];
+    struct metrics_histogram request_ns;
+} __attribute__((aligned(64)));
+
+/*
+ * struct agent_metrics_set:
+ *   The metrics of every worker, summed when reported.
+ */
+struct agent_metrics_set {
+    struct agent_metrics *shards;
+    size_t                count;
+    long long             started_ms;   /* CLOCK_MONOTONIC */
+};
+
+static inline void agent_metrics_count(struct agent_metrics *m, enum agent_counter c,
+                                       uint64_t n) {
+    metrics_counter_add(&m->counters[c], n);
+}
+
+/*
+ * agent_metrics_init:
+ *   Allocate zeroed metrics for count workers. Returns 0, or -1 on error.
+ */
+int agent_metrics_init(struct agent_metrics_set *set, size_t count);
+void agent_metrics_free(struct agent_metrics_set *set);
+
+/*
+ * agent_metrics_write_text:
+ *   The answer to STATS: one "<name> <value>" line per counter, then the
+ *   request latency summary (see metrics_write_summary()).
+ */
+void agent_metrics_write_text(const struct agent_metrics_set *set, FILE *stream);
+
+/*
+ * agent_metrics_write_prom:
+ *   The same in the Prometheus text format; ctx is the set (a
+ *   metrics_http_serve() render callback).
+ */
+void agent_metrics_write_prom(FILE *stream, void *ctx);
+
+#endif /* AGENT_METRICS_H */
@@ -0,0 +1,968 @@
+/*
+ * agent_server.c
+ *
+ * Event loop of an ifnetshow_agent worker. Every socket is non-blocking and
+ * registered edge-triggered in the worker's epoll instance; each client has
+ * its own small read/write state machine, so a slow or stalled collector
+ * never delays the others. Protocol 2 clients keep their connection open and
+ * may pipeline framed requests (see ifnetshow.h). Several workers may run in parallel, each with its
+ * own SO_REUSEPORT listening socket; they only share the read-mostly
+ * interface view (see shared_view.c). Subscribers are pushed the delta
+ * messages of every new view as soon as the worker picks it up. Each worker
+ * counts and times what it does in its own metrics (see agent_metrics.h).
+ */
+
+#define _GNU_SOURCE
+
+#include "agent_server.h"
+#include "log_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+
+#define MAX_EVENTS 256
+
+/* Kinds of log messages, with their rate limits (see log_ring.h). */
+static struct log_site log_connection = LOG_SITE_INIT("connection", 10, 1);
+static struct log_site log_accept = LOG_SITE_INIT("accept", 1, 1);
+static struct log_site log_memory = LOG_SITE_INIT("memory", 1, 1);
+static struct log_site log_epoll = LOG_SITE_INIT("epoll", 1, 1);
+
+static time_t monotonic_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/* Activity lists: connections ordered from least to most recently active. */
+static void list_remove(struct connection *conn) {
+    struct conn_list *list = conn->list;
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        list->oldest = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    else
+        list->newest = conn->prev;
+    conn->prev = conn->next = NULL;
+}
+
+static void list_append(struct conn_list *list, struct connection *conn) {
+    conn->list = list;
+    conn->prev = list->newest;
+    conn->next = NULL;
+    if (list->newest)
+        list->newest->next = conn;
+    else
+        list->oldest = conn;
+    list->newest = conn;
+}
+
+static void touch_connection(struct connection *conn) {
+    conn->last_active = monotonic_now();
+    struct conn_list *list = conn->list;
+    list_remove(conn);
+    list_append(list, conn);
+}
+
+static void release_answer(struct answer *a) {
+    response_cache_release(a->pinned);
+    free(a->owned);
+    memset(a, 0, sizeof(*a));
+}
+
+static void close_connection(struct agent_server *srv, struct connection *conn) {
+    list_remove(conn);
+    close(conn->src.fd);    /* also removes it from the epoll set */
+    while (conn->out_count > 0) {
+        release_answer(&conn->out[conn->out_head]);
+        conn->out_head = (conn->out_head + 1) % MAX_PIPELINE;
+        conn->out_count--;
+    }
+    free(conn);
+    srv->conn_count--;
+    agent_metrics_count(srv->metrics, AM_CONN_CLOSED, 1);
+}
+
+/*
+ * queue_answer:
+ *   Reserve the next slot of the answer ring (the caller checked it is not full).
+ */
+static struct answer *queue_answer(struct connection *conn) {
+    struct answer *a = &conn->out[(conn->out_head + conn->out_count) % MAX_PIPELINE];
+    memset(a, 0, sizeof(*a));
+    conn->out_count++;
+    return a;
+}
+
+/*
+ * set_reply:
+ *   Format a short answer into a buffer owned by the answer.
+ */
+static void set_reply(struct answer *a, const char *fmt, ...) {
+    char buf[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        n = 0;
+    if ((size_t) n >= sizeof(buf))
+        n = sizeof(buf) - 1;
+    a->owned = malloc((size_t) n + 1);
+    if (a->owned == NULL) {
+        a->body = "";
+        a->body_len = 0;
+        return;
+    }
+    memcpy(a->owned, buf, (size_t) n + 1);
+    a->body = a->owned;
+    a->body_len = (size_t) n;
+}
+
+/*
+ * parse_detail:
+ *   Parse the optional "LINK" / "STATS" words following an ALL or IFNAME
+ *   command into IFSHOW_DETAIL_* bits. Returns -1 on any other word.
+ */
+static int parse_detail(const char *p, unsigned int *detail) {
+    char word[16];
+    int n;
+    *detail = 0;
+    while (sscanf(p, "%15s%n", word, &n) == 1) {
+        if (strcmp(word, "LINK") == 0)
+            *detail |= IFSHOW_DETAIL_LINK;
+        else if (strcmp(word, "STATS") == 0)
+            *detail |= IFSHOW_DETAIL_STATS;
+        else
+            return -1;
+        p += n;
+    }
+    return 0;
+}
+
+/*
+ * render_reply:
+ *   Render an answer that is not pre-rendered (one with details) from the
+ *   view's snapshot into a buffer owned by the answer.
+ */
+static void render_reply(struct answer *a, const struct ifshow_renderer *r,
+                         const struct ifshow_snapshot *snap, const char *ifname,
+                         unsigned int detail) {
+    size_t len = ifname ? ifshow_render_iface(r, snap, ifname, detail, NULL, 0)
+                        : ifshow_render_all(r, snap, detail, NULL, 0);
+    a->owned = malloc(len ? len : 1);
+    if (a->owned == NULL) {
+        a->body = "";
+        a->body_len = 0;
+        return;
+    }
+    if (ifname)
+        ifshow_render_iface(r, snap, ifname, detail, a->owned, len);
+    else
+        ifshow_render_all(r, snap, detail, a->owned, len);
+    a->body = a->owned;
+    a->body_len = len;
+}
+
+/*
+ * rates_reply:
+ *   Handle "RATES [<ifname>] [HISTORY]": write the rates computed by the
+ *   counter sampler into a buffer owned by the answer. The rings are read
+ *   as they are now, not as of the view's generation.
+ *   Returns 0 if the request was served, -1 if it was rejected.
+ */
+static int rates_reply(struct response_cache *rc, const char *args, struct answer *a) {
+    char word[2][128];
+    int words = sscanf(args, "%127s %127s", word[0], word[1]);
+    int history = 0;
+    const char *ifname = NULL;
+
+    if (words > 0 && strcmp(word[words - 1], "HISTORY") == 0) {
+        history = 1;
+        words--;
+    }
+    if (words > 1) {
+        set_reply(a, "Invalid command format.\n");
+        return -1;
+    }
+    if (words == 1)
+        ifname = word[0];
+    if (rc->rates == NULL) {
+        set_reply(a, "Rate sampling is disabled.\n");
+        return 0;
+    }
+
+    size_t len = 0;
+    FILE *stream = open_memstream(&a->owned, &len);
+    if (stream == NULL) {
+        set_reply(a, "Memory allocation error.\n");
+        return 0;
+    }
+    rate_table_write(rc->rates, &rc->snap, ifname, history, stream);
+    if (fclose(stream) != 0) {
+        a->owned = NULL;
+        set_reply(a, "Memory allocation error.\n");
+        return 0;
+    }
+    a->body = a->owned;
+    a->body_len = len;
+    return 0;
+}
+
+/*
+ * stats_reply:
+ *   Handle "STATS": write the metrics of all the workers into a buffer owned
+ *   by the answer.
+ */
+static void stats_reply(struct agent_server *srv, struct answer *a) {
+    size_t len = 0;
+    FILE *stream = open_memstream(&a->owned, &len);
+    if (stream == NULL) {
+        set_reply(a, "Memory allocation error.\n");
+        return;
+    }
+    agent_metrics_write_text(srv->metrics_set, stream);
+    if (fclose(stream) != 0) {
+        a->owned = NULL;
+        set_reply(a, "Memory allocation error.\n");
+        return;
+    }
+    a->body = a->owned;
+    a->body_len = len;
+}
+
+/*
+ * answer_request:
+ *   Processes one command received from the client and fills its answer.
+ *   The command can be:
+ *       "ALL [LINK] [STATS]"            -> list all interfaces.
+ *       "IFNAME <name> [LINK] [STATS]"  -> list the addresses for a specific interface.
+ *       "GENERATION"                    -> return the generation counter of the cache.
+ *       "RATES [<name>] [HISTORY]"      -> counter rates of all interfaces or one.
+ *       "STATS"                         -> the agent's metrics.
+ *
+ *   ALL and IFNAME answers point into the pre-rendered response cache, which is
+ *   pinned by the answer until it has been sent. Answers with LINK (link
+ *   state, MTU, hardware address) or STATS (counters, as of the last refresh,
+ *   taken from the newest sample of the rate table) are rendered per request
+ *   from the view's snapshot. With binary set (protocol 2 IFN_FLAG_BINARY)
+ *   they use the binary wire format; *binary is cleared if the answer is
+ *   text after all. *kind is set to the counter of the command.
+ *   Returns 0 if the request was served, -1 if it was rejected.
+ */
+static int answer_request(struct agent_server *srv, const char *request, struct answer *a,
+                          int *binary, enum agent_counter *kind) {
+    int want_binary = *binary;
+    *binary = 0;
+
+    char mode[16];
+    char ifname[128];
+    int is_all = 0;
+    int consumed = 0;
+    unsigned int detail;
+
+    memset(mode, 0, sizeof(mode));
+    memset(ifname, 0, sizeof(ifname));
+
+    if (strncmp(request, "GENERATION", 10) == 0) {
+        *kind = AM_REQ_GENERATION;
+        set_reply(a, "%llu\n", srv->view->generation);
+        return 0;
+    } else if (strncmp(request, "RATES", 5) == 0) {
+        *kind = AM_REQ_RATES;
+        return rates_reply(srv->view, request + 5, a);
+    } else if (strncmp(request, "STATS", 5) == 0) {
+        *kind = AM_REQ_STATS;
+        stats_reply(srv, a);
+        return 0;
+    } else if (strncmp(request, "ALL", 3) == 0) {
+        *kind = AM_REQ_ALL;
+        is_all = 1;
+        consumed = 3;
+    } else if (strncmp(request, "IFNAME", 6) == 0) {
+        *kind = AM_REQ_IFNAME;
+        // Expected format: "IFNAME <ifname> [LINK] [STATS]"
+        if (sscanf(request, "%15s %127s%n", mode, ifname, &consumed) != 2) {
+            set_reply(a, "Invalid command format.\n");
+            return -1;
+        }
+    } else {
+        set_reply(a, "Unknown command.\n");
+        return -1;
+    }
+    if (parse_detail(request + consumed, &detail) < 0) {
+        set_reply(a, "Invalid command format.\n");
+        return -1;
+    }
+
+    struct response_cache *rc = srv->view;
+    const char *buf;
+    size_t len;
+    if (detail != 0) {
+        /* The view's counters are those of its load: take the sampler's newest. */
+        const struct ifshow_snapshot *snap = &rc->snap;
+        if ((detail & IFSHOW_DETAIL_STATS) && rc->rates != NULL &&
+            ifshow_snapshot_copy(&srv->stats_snap, &rc->snap) == 0) {
+            rate_table_latest(rc->rates, &srv->stats_snap);
+            snap = &srv->stats_snap;
+        }
+        render_reply(a, want_binary ? &ifshow_binary_renderer : &ifshow_text_renderer,
+                     snap, is_all ? NULL : ifname, detail);
+        agent_metrics_count(srv->metrics, AM_ANSWER_RENDERED, 1);
+        *binary = want_binary;
+        return 0;
+    }
+    if (is_all) {
+        buf = want_binary ? rc->bin_all : rc->all;
+        len = want_binary ? rc->bin_all_len : rc->all_len;
+    } else if (response_cache_ifname(rc, ifname, want_binary, &buf, &len) < 0) {
+        if (want_binary) {
+            buf = (const char *) &rc->bin_empty;
+            len = sizeof(rc->bin_empty);
+        } else {
+            set_reply(a, "Interface '%s' not found or has no IP addresses.\n", ifname);
+            return 0;
+        }
+    }
+    *binary = want_binary;
+    a->pinned = response_cache_hold(rc);
+    a->body = buf;
+    a->body_len = len;
+    agent_metrics_count(srv->metrics, AM_ANSWER_CACHED, 1);
+    return 0;
+}
+
+/*
+ * process_request:
+ *   answer_request(), counted by command and timed.
+ */
+static int process_request(struct agent_server *srv, const char *request, struct answer *a,
+                           int *binary) {
+    uint64_t start = monotonic_ns();
+    enum agent_counter kind = AM_REQ_INVALID;
+    int ret = answer_request(srv, request, a, binary, &kind);
+    agent_metrics_count(srv->metrics, ret < 0 ? AM_REQ_INVALID : kind, 1);
+    metrics_histogram_record(&srv->metrics->request_ns, monotonic_ns() - start);
+    return ret;
+}
+
+/*
+ * queue_push:
+ *   Queue a subscription message rendered in the current view.
+ */
+static void queue_push(struct agent_server *srv, struct connection *conn,
+                       const char *text, size_t len) {
+    struct answer *a = queue_answer(conn);
+    agent_metrics_count(srv->metrics, AM_PUSHES, 1);
+    a->pinned = response_cache_hold(srv->view);
+    a->body = text;
+    a->body_len = len;
+    if (conn->state == CONN_FRAMED) {
+        ifn_frame_pack(a->hdr, (uint32_t) len, IFN_MSG_RESPONSE, 0);
+        a->hdr_len = IFN_FRAME_HDR_LEN;
+    }
+}
+
+/*
+ * push_updates:
+ *   Bring a subscriber up to the current view: the missed deltas if they are
+ *   still in the view's history and fit in the answer ring, a full snapshot
+ *   otherwise. Returns the number of messages queued.
+ */
+static int push_updates(struct agent_server *srv, struct connection *conn) {
+    struct response_cache *rc = srv->view;
+    if (!conn->subscribed || conn->sub_seq == rc->generation || conn->out_count == MAX_PIPELINE)
+        return 0;
+
+    size_t first, count;
+    if (response_cache_deltas(rc, conn->sub_seq, &first, &count) == 0 &&
+        count <= MAX_PIPELINE - conn->out_count) {
+        for (size_t i = first; i < first + count; i++)
+            queue_push(srv, conn, rc->deltas[i].text, rc->deltas[i].len);
+    } else {
+        queue_push(srv, conn, rc->sub_snapshot, rc->sub_snapshot_len);
+        count = 1;
+    }
+    conn->sub_seq = rc->generation;
+    return (int) count;
+}
+
+/*
+ * start_subscription:
+ *   Handle "SUBSCRIBE [<epoch> <generation>]": the connection stays open and
+ *   is moved to the subscribers. A client that gives the epoch and
+ *   generation of the last message it received resumes from there.
+ *   Returns 0, or -1 (with an error answer queued) if the request is invalid.
+ */
+static int start_subscription(struct agent_server *srv, struct connection *conn,
+                              const char *request) {
+    unsigned long long epoch, seq;
+    int fields = sscanf(request, "SUBSCRIBE %llx %llu", &epoch, &seq);
+    if (fields == 1 || (fields <= 0 && strspn(request + 9, " \r\n") != strlen(request + 9))) {
+        agent_metrics_count(srv->metrics, AM_REQ_INVALID, 1);
+        struct answer *a = queue_answer(conn);
+        set_reply(a, "Invalid command format.\n");
+        if (conn->state == CONN_FRAMED) {
+            ifn_frame_pack(a->hdr, (uint32_t) a->body_len, IFN_MSG_ERROR, 0);
+            a->hdr_len = IFN_FRAME_HDR_LEN;
+        }
+        return -1;
+    }
+
+    agent_metrics_count(srv->metrics, AM_REQ_SUBSCRIBE, 1);
+    conn->subscribed = 1;
+    conn->sub_seq = fields == 2 && epoch == srv->view->epoch ? seq : ~0ULL;
+    if (conn->state == CONN_READING)
+        conn->state = CONN_SUBSCRIBED;
+    list_remove(conn);
+    list_append(&srv->subscribers, conn);
+
+    /* Subscribers are never idle-expired: let TCP find dead peers instead. */
+    int on = 1, idle = 60, interval = 10, probes = 3;
+    setsockopt(conn->src.fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+    setsockopt(conn->src.fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(conn->src.fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+    setsockopt(conn->src.fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+
+    push_updates(srv, conn);
+    return 0;
+}
+
+/*
+ * fill_input:
+ *   Read what is available into the input buffer, unless the answer ring is
+ *   full (back-pressure: the client must read its answers first).
+ *   Returns the number of bytes read, or -1 on error. *paused is set when
+ *   reading was skipped because of back-pressure.
+ */
+static ssize_t fill_input(struct connection *conn, int *paused) {
+    ssize_t total = 0;
+    *paused = 0;
+    if (conn->peer_closed || conn->state == CONN_CLOSING)
+        return 0;
+    if (conn->out_count == MAX_PIPELINE) {
+        *paused = 1;
+        return 0;
+    }
+    conn->drained = 0;
+    while (conn->in_len < sizeof(conn->in) - 1) {
+        ssize_t n = read(conn->src.fd, conn->in + conn->in_len, sizeof(conn->in) - 1 - conn->in_len);
+        if (n > 0) {
+            conn->in_len += (size_t) n;
+            total += n;
+            continue;
+        }
+        if (n == 0) {
+            conn->peer_closed = 1;
+            break;
+        }
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            conn->drained = 1;
+            break;
+        }
+        return -1;
+    }
+    return total;
+}
+
+static void consume_input(struct connection *conn, size_t len) {
+    memmove(conn->in, conn->in + len, conn->in_len - len);
+    conn->in_len -= len;
+}
+
+/*
+ * consume_handshake:
+ *   In CONN_READING, tell a protocol 2 hello from a protocol 1 command.
+ *   As in the original protocol, a protocol 1 command is whatever the client
+ *   sent in its first burst; it is not newline-terminated.
+ *   Returns the number of requests handled (0 or 1).
+ */
+static int consume_handshake(struct agent_server *srv, struct connection *conn) {
+    size_t hello_len = strlen(IFN_HELLO);
+    int complete = conn->drained || conn->peer_closed || conn->in_len == sizeof(conn->in) - 1;
+
+    if (conn->in_len == 0)
+        return 0;
+    if (conn->in_len < hello_len && memcmp(conn->in, IFN_HELLO, conn->in_len) == 0 &&
+        !conn->peer_closed && conn->in_len < sizeof(conn->in) - 1)
+        return 0;   /* could still become a hello */
+
+    if (conn->in_len >= hello_len && memcmp(conn->in, IFN_HELLO, hello_len) == 0) {
+        struct answer *a = queue_answer(conn);
+        a->body = IFN_HELLO_OK;
+        a->body_len = strlen(IFN_HELLO_OK);
+        consume_input(conn, hello_len);
+        conn->state = CONN_FRAMED;
+        list_remove(conn);
+        list_append(&srv->persistent, conn);
+        return 1;
+    }
+
+    if (!complete)
+        return 0;
+    conn->in[conn->in_len] = '\0';
+    if (strncmp(conn->in, "SUBSCRIBE", 9) == 0) {
+        conn->in_len = 0;
+        if (start_subscription(srv, conn, conn->in) < 0)
+            conn->state = CONN_CLOSING;
+        return 1;
+    }
+    int binary = 0;
+    process_request(srv, conn->in, queue_answer(conn), &binary);
+    conn->in_len = 0;
+    /* One command per connection: close once the answer is out. */
+    conn->state = CONN_CLOSING;
+    return 1;
+}
+
+/*
+ * consume_frames:
+ *   In CONN_FRAMED, answer every complete request frame while there is room
+ *   in the answer ring. Returns the number of requests handled, or -1 on a
+ *   protocol error.
+ */
+static int consume_frames(struct agent_server *srv, struct connection *conn) {
+    int handled = 0;
+    while (conn->out_count < MAX_PIPELINE && conn->in_len >= IFN_FRAME_HDR_LEN) {
+        uint32_t len;
+        uint16_t type, flags;
+        ifn_frame_unpack((const unsigned char *) conn->in, &len, &type, &flags);
+        if (len > IFN_MAX_REQUEST)
+            return -1;
+        if (conn->in_len < IFN_FRAME_HDR_LEN + len)
+            break;
+
+        char request[IFN_MAX_REQUEST + 1];
+        memcpy(request, conn->in + IFN_FRAME_HDR_LEN, len);
+        request[len] = '\0';
+        consume_input(conn, IFN_FRAME_HDR_LEN + len);
+
+        if (type == IFN_MSG_REQUEST && strncmp(request, "SUBSCRIBE", 9) == 0) {
+            start_subscription(srv, conn, request);
+            handled++;
+            continue;
+        }
+
+        struct answer *a = queue_answer(conn);
+        uint16_t answer_type = IFN_MSG_RESPONSE;
+        int binary = (flags & IFN_FLAG_BINARY) != 0;
+        if (type != IFN_MSG_REQUEST) {
+            agent_metrics_count(srv->metrics, AM_REQ_INVALID, 1);
+            set_reply(a, "Unknown message type.\n");
+            answer_type = IFN_MSG_ERROR;
+            binary = 0;
+        } else if (process_request(srv, request, a, &binary) < 0) {
+            answer_type = IFN_MSG_ERROR;
+        }
+        ifn_frame_pack(a->hdr, (uint32_t) a->body_len, answer_type,
+                       binary ? IFN_FLAG_BINARY : 0);
+        a->hdr_len = IFN_FRAME_HDR_LEN;
+        handled++;
+    }
+    return handled;
+}
+
+/*
+ * flush_answers:
+ *   Write as many queued answers as the socket accepts, gathering them into
+ *   one sendmsg() call.
+ *   Returns 1 when everything was sent, 0 if the socket is full, -1 on error.
+ */
+static int flush_answers(struct agent_server *srv, struct connection *conn) {
+    while (conn->out_count > 0) {
+        struct iovec iov[2 * MAX_PIPELINE];
+        int iovcnt = 0;
+        for (unsigned int i = 0; i < conn->out_count; i++) {
+            struct answer *a = &conn->out[(conn->out_head + i) % MAX_PIPELINE];
+            size_t sent = a->sent;
+            if (sent < a->hdr_len) {
+                iov[iovcnt].iov_base = a->hdr + sent;
+                iov[iovcnt].iov_len = a->hdr_len - sent;
+                iovcnt++;
+                sent = a->hdr_len;
+            }
+            if (sent - a->hdr_len < a->body_len) {
+                iov[iovcnt].iov_base = (char *) a->body + (sent - a->hdr_len);
+                iov[iovcnt].iov_len = a->body_len - (sent - a->hdr_len);
+                iovcnt++;
+            }
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t) iovcnt;
+        ssize_t n = iovcnt > 0 ? sendmsg(conn->src.fd, &msg, MSG_NOSIGNAL) : 0;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+
+        /* Retire the answers that are now completely sent. */
+        size_t written = (size_t) n;
+        agent_metrics_count(srv->metrics, AM_BYTES_OUT, written);
+        while (conn->out_count > 0) {
+            struct answer *a = &conn->out[conn->out_head];
+            size_t left = a->hdr_len + a->body_len - a->sent;
+            if (written < left) {
+                a->sent += written;
+                break;
+            }
+            written -= left;
+            release_answer(a);
+            conn->out_head = (conn->out_head + 1) % MAX_PIPELINE;
+            conn->out_count--;
+        }
+    }
+    return 1;
+}
+
+/*
+ * handle_connection:
+ *   Run the connection's state machine as far as possible: read, answer the
+ *   complete requests, write. With edge-triggered events the loop only stops
+ *   once it has to wait for the socket (more input or room to write).
+ */
+static void handle_connection(struct agent_server *srv, struct connection *conn, unsigned int events) {
+    if (events & EPOLLERR) {
+        agent_metrics_count(srv->metrics, AM_ERR_IO, 1);
+        close_connection(srv, conn);
+        return;
+    }
+    touch_connection(conn);
+
+    for (;;) {
+        int paused;
+        ssize_t got = fill_input(conn, &paused);
+        if (got < 0) {
+            agent_metrics_count(srv->metrics, AM_ERR_IO, 1);
+            close_connection(srv, conn);
+            return;
+        }
+
+        int handled;
+        if (conn->state == CONN_READING)
+            handled = consume_handshake(srv, conn);
+        else if (conn->state == CONN_FRAMED)
+            handled = consume_frames(srv, conn);
+        else
+            handled = 0;
+        if (conn->state == CONN_SUBSCRIBED)
+            conn->in_len = 0;    /* nothing more is expected from the client */
+        if (handled < 0) {
+            agent_metrics_count(srv->metrics, AM_ERR_PROTOCOL, 1);
+            close_connection(srv, conn);
+            return;
+        }
+        /* A protocol 2 request may follow the hello in the same burst. */
+        if (handled > 0 && conn->state == CONN_FRAMED) {
+            int more = consume_frames(srv, conn);
+            if (more < 0) {
+                agent_metrics_count(srv->metrics, AM_ERR_PROTOCOL, 1);
+                close_connection(srv, conn);
+                return;
+            }
+            handled += more;
+        }
+        if (handled >= 0)
+            handled += push_updates(srv, conn);
+
+        int flushed = flush_answers(srv, conn);
+        if (flushed < 0) {
+            agent_metrics_count(srv->metrics, AM_ERR_IO, 1);
+            close_connection(srv, conn);
+            return;
+        }
+        if (conn->out_count == 0 &&
+            (conn->state == CONN_CLOSING || (conn->peer_closed && handled == 0))) {
+            close_connection(srv, conn);
+            return;
+        }
+        if (flushed == 0)
+            return;    /* wait for EPOLLOUT */
+        if (got == 0 && handled == 0 && !paused)
+            return;    /* wait for EPOLLIN */
+    }
+}
+
+/*
+ * shed_connection:
+ *   Out of file descriptors: use the spare descriptor to accept and
+ *   immediately close one pending connection, so the client is not left
+ *   hanging in the backlog.
+ */
+static void shed_connection(struct agent_server *srv, int listen_fd) {
+    if (srv->spare_fd < 0)
+        return;
+    close(srv->spare_fd);
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd >= 0) {
+        close(fd);
+        agent_metrics_count(srv->metrics, AM_CONN_SHED, 1);
+    }
+    srv->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+}
+
+/*
+ * format_addr:
+ *   "addr:port" for IPv4 clients (including those reaching a dual-stack
+ *   socket as ::ffff:a.b.c.d), "[addr]:port" for IPv6 ones.
+ */
+static const char *format_addr(const struct sockaddr_storage *addr, char *buf, size_t len) {
+    char ip[INET6_ADDRSTRLEN] = "?";
+    int port = 0;
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) addr;
+        port = ntohs(sin6->sin6_port);
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            inet_ntop(AF_INET, &sin6->sin6_addr.s6_addr[12], ip, sizeof(ip));
+        } else {
+            inet_ntop(AF_INET6, &sin6->sin6_addr, ip, sizeof(ip));
+            snprintf(buf, len, "[%s]:%d", ip, port);
+            return buf;
+        }
+    } else if (addr->ss_family == AF_INET) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) addr;
+        port = ntohs(sin->sin_port);
+        inet_ntop(AF_INET, &sin->sin_addr, ip, sizeof(ip));
+    }
+    snprintf(buf, len, "%s:%d", ip, port);
+    return buf;
+}
+
+static void accept_connections(struct agent_server *srv, int listen_fd) {
+    for (;;) {
+        struct sockaddr_storage client_addr;
+        socklen_t client_len = sizeof(client_addr);
+        int fd = accept4(listen_fd, (struct sockaddr *)&client_addr, &client_len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            LOG(LOG_LEVEL_ERROR, log_accept, "accept: %m");
+            agent_metrics_count(srv->metrics, AM_ERR_ACCEPT, 1);
+            if (errno == EMFILE || errno == ENFILE) {
+                shed_connection(srv, listen_fd);
+                continue;
+            }
+            return;
+        }
+
+        struct connection *conn = calloc(1, sizeof(*conn));
+        if (conn == NULL) {
+            LOG(LOG_LEVEL_ERROR, log_memory, "calloc: %m");
+            close(fd);
+            continue;
+        }
+        conn->src.kind = SOURCE_CONNECTION;
+        conn->src.fd = fd;
+        conn->state = CONN_READING;
+        conn->last_active = monotonic_now();
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = &conn->src;
+        if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            LOG(LOG_LEVEL_ERROR, log_epoll, "epoll_ctl: %m");
+            close(fd);
+            free(conn);
+            continue;
+        }
+        list_append(&srv->pending, conn);
+        srv->conn_count++;
+        agent_metrics_count(srv->metrics, AM_CONN_ACCEPTED, 1);
+
+        /* Log the client's address (formatted only if the message is kept). */
+        char client[INET6_ADDRSTRLEN + 8];
+        LOG(LOG_LEVEL_INFO, log_connection, "Accepted connection from %s",
+            format_addr(&client_addr, client, sizeof(client)));
+    }
+}
+
+/*
+ * notify_subscribers:
+ *   A new view was picked up: push it to every subscriber.
+ */
+static void notify_subscribers(struct agent_server *srv) {
+    struct connection *conn = srv->subscribers.oldest;
+    while (conn != NULL) {
+        struct connection *next = conn->next;
+        push_updates(srv, conn);
+        if (flush_answers(srv, conn) < 0) {
+            agent_metrics_count(srv->metrics, AM_ERR_IO, 1);
+            close_connection(srv, conn);
+        }
+        conn = next;
+    }
+}
+
+/*
+ * expire_connections:
+ *   Close connections that have been silent for CONN_IDLE_TIMEOUT seconds
+ *   (KEEPALIVE_IDLE_TIMEOUT for protocol 2 connections).
+ */
+static void expire_connections(struct agent_server *srv) {
+    time_t now = monotonic_now();
+    while (srv->pending.oldest != NULL &&
+           now - srv->pending.oldest->last_active >= CONN_IDLE_TIMEOUT) {
+        agent_metrics_count(srv->metrics, AM_CONN_EXPIRED, 1);
+        close_connection(srv, srv->pending.oldest);
+    }
+    while (srv->persistent.oldest != NULL &&
+           now - srv->persistent.oldest->last_active >= KEEPALIVE_IDLE_TIMEOUT) {
+        agent_metrics_count(srv->metrics, AM_CONN_EXPIRED, 1);
+        close_connection(srv, srv->persistent.oldest);
+    }
+}
+
+int agent_server_init(struct agent_server *srv, const int *listen_fds, size_t listen_count,
+                      struct shared_view *shared,
+                      struct view_reader *reader, struct agent_metrics_set *metrics,
+                      size_t index) {
+    memset(srv, 0, sizeof(*srv));
+    ifshow_snapshot_init(&srv->stats_snap);
+    srv->shared = shared;
+    srv->reader = reader;
+    srv->metrics = &metrics->shards[index];
+    srv->metrics_set = metrics;
+    srv->view = shared_view_acquire(shared, reader, NULL);
+    srv->wakeup.kind = SOURCE_WAKEUP;
+    srv->wakeup.fd = reader->wake_fd;
+    if (listen_count > AGENT_MAX_LISTENERS) {
+        fprintf(stderr, "agent_server_init: too many listening sockets\n");
+        return -1;
+    }
+    for (size_t i = 0; i < listen_count; i++) {
+        int flags = fcntl(listen_fds[i], F_GETFL, 0);
+        if (flags < 0 || fcntl(listen_fds[i], F_SETFL, flags | O_NONBLOCK) < 0) {
+            perror("fcntl");
+            return -1;
+        }
+        srv->listeners[i].kind = SOURCE_LISTENER;
+        srv->listeners[i].fd = listen_fds[i];
+    }
+    srv->listener_count = listen_count;
+
+    srv->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (srv->epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+
+    struct epoll_event ev;
+    for (size_t i = 0; i < listen_count; i++) {
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = &srv->listeners[i];
+        if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, listen_fds[i], &ev) < 0) {
+            perror("epoll_ctl");
+            close(srv->epfd);
+            return -1;
+        }
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &srv->wakeup;
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, reader->wake_fd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(srv->epfd);
+        return -1;
+    }
+
+    srv->spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return 0;
+}
+
+int agent_server_run(struct agent_server *srv) {
+    struct epoll_event events[MAX_EVENTS];
+
+    for (;;) {
+        /* Wake up once a second while connections are open to expire idle ones. */
+        int timeout = srv->conn_count > 0 ? 1000 : -1;
+        int n = epoll_wait(srv->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG(LOG_LEVEL_ERROR, log_epoll, "epoll_wait: %m");
+            return -1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct event_source *src = events[i].data.ptr;
+            switch (src->kind) {
+            case SOURCE_LISTENER:
+                accept_connections(srv, src->fd);
+                break;
+            case SOURCE_WAKEUP: {
+                uint64_t count;
+                while (read(srv->wakeup.fd, &count, sizeof(count)) > 0)
+                    ;
+                break;
+            }
+            case SOURCE_CONNECTION:
+                handle_connection(srv, (struct connection *) src, events[i].events);
+                break;
+            }
+        }
+
+        /* Pick up a newly published view (and let the old one be reclaimed). */
+        struct response_cache *old = srv->view;
+        srv->view = shared_view_acquire(srv->shared, srv->reader, srv->view);
+        if (srv->view != old)
+            notify_subscribers(srv);
+        expire_connections(srv);
+    }
+}
+
+static void *server_thread(void *arg) {
+    agent_server_run(arg);
+    return NULL;
+}
+
+int agent_server_start(struct agent_server *srv) {
+    int err = pthread_create(&srv->thread, NULL, server_thread, srv);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        return -1;
+    }
+    return 0;
+}
+
+void agent_server_close(struct agent_server *srv) {
+    while (srv->pending.oldest != NULL)
+        close_connection(srv, srv->pending.oldest);
+    while (srv->persistent.oldest != NULL)
+        close_connection(srv, srv->persistent.oldest);
+    while (srv->subscribers.oldest != NULL)
+        close_connection(srv, srv->subscribers.oldest);
+    response_cache_release(srv->view);
+    srv->view = NULL;
+    ifshow_snapshot_free(&srv->stats_snap);
+    if (srv->spare_fd >= 0)
+        close(srv->spare_fd);
+    close(srv->epfd);
+}
@@ -0,0 +1,144 @@
+#ifndef AGENT_SERVER_H
+#define AGENT_SERVER_H
+
+#include "ifnetshow.h"
+#include "agent_metrics.h"
+#include "response_cache.h"
+#include "shared_view.h"
+
+#include <pthread.h>
+
+#include <stddef.h>
+#include <time.h>
+
+#define BUFFER_SIZE (IFN_FRAME_HDR_LEN + IFN_MAX_REQUEST + 1)
+
+/* Seconds a connection may stay silent before it is closed. */
+#define CONN_IDLE_TIMEOUT      10
+#define KEEPALIVE_IDLE_TIMEOUT 300   /* protocol 2 connections */
+
+/* Answers that may be queued on one connection. */
+#define MAX_PIPELINE 16
+
+/* What an epoll event refers to. */
+enum source_kind {
+    SOURCE_LISTENER,
+    SOURCE_WAKEUP,
+    SOURCE_CONNECTION
+};
+
+/* Listening sockets of a worker at most (one per bound address). */
+#define AGENT_MAX_LISTENERS 16
+
+struct event_source {
+    enum source_kind kind;
+    int              fd;
+};
+
+enum conn_state {
+    CONN_READING,   /* waiting for a protocol 1 request or the protocol 2 hello */
+    CONN_FRAMED,    /* protocol 2: pipelined frames until the client closes */
+    CONN_SUBSCRIBED,/* protocol 1 SUBSCRIBE: only pushes, input is ignored */
+    CONN_CLOSING    /* send what is queued, then close */
+};
+
+/*
+ * struct answer:
+ *   One queued answer: an optional protocol 2 frame header followed by the
+ *   body, which either lives in a pinned response cache, in a buffer owned by
+ *   the answer, or in static storage.
+ */
+struct answer {
+    unsigned char          hdr[IFN_FRAME_HDR_LEN];
+    size_t                 hdr_len;      /* 0 for protocol 1 answers */
+    const char            *body;
+    size_t                 body_len;
+    size_t                 sent;         /* bytes of hdr + body already written */
+    struct response_cache *pinned;
+    char                  *owned;
+};
+
+struct conn_list {
+    struct connection *oldest, *newest;
+};
+
+/*
+ * struct connection:
+ *   Per-client state machine of the event loop. Requests are parsed from
+ *   in[] and their answers queued in the out[] ring (at most MAX_PIPELINE;
+ *   reading pauses while it is full).
+ *   A subscriber (SUBSCRIBE, in protocol 1 or 2) has seen the table up to
+ *   generation sub_seq; newer generations are pushed as room in the ring allows.
+ */
+struct connection {
+    struct event_source src;
+    enum conn_state     state;
+    int                 peer_closed;
+    int                 drained;      /* the last read stopped on EAGAIN */
+    char                in[BUFFER_SIZE];
+    size_t              in_len;
+    struct answer       out[MAX_PIPELINE];
+    unsigned int        out_head;
+    unsigned int        out_count;
+    int                 subscribed;
+    unsigned long long  sub_seq;
+    time_t              last_active;
+    struct conn_list   *list;         /* activity list the connection is on */
+    struct connection  *prev, *next;
+};
+
+/*
+ * struct agent_server:
+ *   One worker of the agent: a non-blocking, edge-triggered epoll loop with
+ *   its own (SO_REUSEPORT) listening sockets, one per bound address (a
+ *   single dual-stack socket by default), serving its clients
+ *   concurrently from the shared interface view. The wakeup source is the
+ *   eventfd signalled when a new view is published.
+ *   Connections are kept on activity lists (oldest first) so each kind can
+ *   be expired with its own idle timeout; subscribers never expire (dead
+ *   peers are detected with TCP keepalives).
+ *   metrics are this worker's own; metrics_set (all workers) is only read,
+ *   to answer STATS.
+ */
+struct agent_server {
+    int                    epfd;
+    int                    spare_fd;      /* released to shed connections on EMFILE */
+    struct event_source    listeners[AGENT_MAX_LISTENERS];
+    size_t                 listener_count;
+    struct event_source    wakeup;
+    struct shared_view    *shared;
+    struct view_reader    *reader;
+    struct response_cache *view;          /* view held by this worker */
+    struct ifshow_snapshot stats_snap;    /* view's snapshot with fresh counters, for STATS */
+    struct conn_list       pending;       /* protocol 1 / handshake */
+    struct conn_list       persistent;    /* protocol 2 */
+    struct conn_list       subscribers;   /* SUBSCRIBE */
+    size_t                 conn_count;
+    struct agent_metrics  *metrics;
+    const struct agent_metrics_set *metrics_set;
+    pthread_t              thread;
+};
+
+/*
+ * agent_server_init:
+ *   Set up a worker for listen_count (at most AGENT_MAX_LISTENERS) already
+ *   listening sockets, reading the shared view through the given reader
+ *   slot and recording into the index-th metrics of metrics.
+ *   Returns 0 on success, -1 on error.
+ */
+int agent_server_init(struct agent_server *srv, const int *listen_fds, size_t listen_count,
+                      struct shared_view *shared,
+                      struct view_reader *reader, struct agent_metrics_set *metrics,
+                      size_t index);
+
+/*
+ * agent_server_run:
+ *   Serve clients forever. Returns -1 only if the event loop fails.
+ *   agent_server_start() runs it in a new thread.
+ */
+int agent_server_run(struct agent_server *srv);
+int agent_server_start(struct agent_server *srv);
+
+void agent_server_close(struct agent_server *srv);
+
+#endif /* AGENT_SERVER_H */
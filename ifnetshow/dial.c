@@ -0,0 +1,308 @@
+/*
+ * dial.c
+ *
+ * Connection of ifnetshow_client to one agent over IPv6 or IPv4, racing
+ * the address families (see dial.h). Host names are looked up in detached
+ * threads, one per family, that share a small reference-counted record
+ * with the caller: a caller that gives up on its timeout does not wait for
+ * a slow resolver, the last one out frees the record.
+ */
+
+#define _GNU_SOURCE
+
+#include "dial.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+/* The lookups, in the order their families are preferred. */
+enum { LOOKUP_INET6, LOOKUP_INET, LOOKUPS };
+
+struct lookup;
+
+/*
+ * struct lookup_query:
+ *   The getaddrinfo() of one family. done is only read by the caller, once
+ *   the index of the query came through the notification pipe.
+ */
+struct lookup_query {
+    struct lookup   *lookup;
+    int              family;
+    struct addrinfo *result;
+    int              error;
+    int              done;
+};
+
+/*
+ * struct lookup:
+ *   Shared by the caller and the lookup threads. A thread writes the index
+ *   of its query to the pipe once the result is set.
+ */
+struct lookup {
+    atomic_int          refs;
+    int                 notify[2];
+    char               *host;
+    char                port[8];
+    struct lookup_query queries[LOOKUPS];
+};
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void lookup_release(struct lookup *l) {
+    if (atomic_fetch_sub(&l->refs, 1) != 1)
+        return;
+    for (int i = 0; i < LOOKUPS; i++) {
+        if (l->queries[i].result != NULL)
+            freeaddrinfo(l->queries[i].result);
+    }
+    close(l->notify[0]);
+    close(l->notify[1]);
+    free(l->host);
+    free(l);
+}
+
+static void *lookup_thread(void *arg) {
+    struct lookup_query *q = arg;
+    struct lookup *l = q->lookup;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = q->family;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    q->error = getaddrinfo(l->host, l->port, &hints, &q->result);
+
+    unsigned char index = (unsigned char)(q - l->queries);
+    while (write(l->notify[1], &index, 1) < 0 && errno == EINTR)
+        ;
+    lookup_release(l);
+    return NULL;
+}
+
+/*
+ * lookup_start:
+ *   Resolve host: a literal at once, a name in the background. Returns the
+ *   lookup (held once by the caller), or NULL on error.
+ */
+static struct lookup *lookup_start(const char *host, int port) {
+    struct lookup *l = calloc(1, sizeof(*l));
+    if (l == NULL || (l->host = strdup(host)) == NULL || pipe2(l->notify, O_CLOEXEC) < 0) {
+        perror("lookup");
+        if (l != NULL)
+            free(l->host);
+        free(l);
+        return NULL;
+    }
+    snprintf(l->port, sizeof(l->port), "%d", port);
+    l->queries[LOOKUP_INET6].family = AF_INET6;
+    l->queries[LOOKUP_INET].family = AF_INET;
+    atomic_init(&l->refs, 1);
+
+    struct addrinfo hints, *literal;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(host, l->port, &hints, &literal) == 0) {
+        int own = literal->ai_family == AF_INET6 ? LOOKUP_INET6 : LOOKUP_INET;
+        l->queries[own].result = literal;
+        for (int i = 0; i < LOOKUPS; i++) {
+            l->queries[i].error = i == own ? 0 : EAI_NONAME;
+            l->queries[i].done = 1;
+        }
+        return l;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < LOOKUPS; i++) {
+        struct lookup_query *q = &l->queries[i];
+        pthread_t thread;
+        q->lookup = l;
+        atomic_fetch_add(&l->refs, 1);
+        int err = pthread_create(&thread, &attr, lookup_thread, q);
+        if (err != 0) {
+            atomic_fetch_sub(&l->refs, 1);
+            q->error = EAI_AGAIN;
+            q->done = 1;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return l;
+}
+
+/* Whether a query has another address to try. */
+static int has_next(const struct addrinfo *const next[LOOKUPS], const int tried[LOOKUPS], int i) {
+    return next[i] != NULL && tried[i] < DIAL_MAX_ADDRS;
+}
+
+int dial_connect(const char *host, int port, int timeout_ms) {
+    struct lookup *l = lookup_start(host, port);
+    if (l == NULL)
+        return -1;
+
+    const struct addrinfo *next[LOOKUPS] = { NULL, NULL };
+    int tried[LOOKUPS] = { 0, 0 };
+    int attempts[LOOKUPS * DIAL_MAX_ADDRS];      /* connections in progress, -1 once over */
+    size_t attempt_count = 0;
+    int last_family = LOOKUP_INET;         /* so that IPv6 goes first */
+    long long start = monotonic_ms();
+    long long deadline = start + timeout_ms;
+    long long next_attempt = start;
+    long long inet_done_at = -1;           /* IPv4 answered while IPv6 had not */
+    int last_error = 0;
+    int winner = -1;
+
+    for (int i = 0; i < LOOKUPS; i++) {
+        if (l->queries[i].done)
+            next[i] = l->queries[i].result;
+    }
+
+    for (;;) {
+        long long now = monotonic_ms();
+        int inet6_done = l->queries[LOOKUP_INET6].done;
+        int inet_done = l->queries[LOOKUP_INET].done;
+
+        /* Start the next attempt when it is due, alternating the families. */
+        int resolved = inet6_done ||
+                       (inet_done && now >= inet_done_at + DIAL_RESOLUTION_DELAY_MS);
+        if (resolved && now >= next_attempt) {
+            int pick = 1 - last_family;
+            if (!has_next(next, tried, pick))
+                pick = last_family;
+            if (has_next(next, tried, pick)) {
+                const struct addrinfo *ai = next[pick];
+                next[pick] = ai->ai_next;
+                tried[pick]++;
+                last_family = pick;
+                int fd = socket(ai->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+                if (fd < 0) {
+                    last_error = errno;
+                    continue;
+                }
+                if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                    winner = fd;
+                    break;
+                }
+                if (errno != EINPROGRESS) {
+                    last_error = errno;
+                    close(fd);
+                    continue;       /* try the next address at once */
+                }
+                attempts[attempt_count++] = fd;
+                next_attempt = now + DIAL_ATTEMPT_DELAY_MS;
+            }
+        }
+
+        int candidates = has_next(next, tried, LOOKUP_INET6) || has_next(next, tried, LOOKUP_INET);
+        size_t active = 0;
+        for (size_t i = 0; i < attempt_count; i++)
+            active += attempts[i] >= 0;
+        if (active == 0 && !candidates && inet6_done && inet_done)
+            break;          /* nothing left to try */
+        if (now >= deadline) {
+            last_error = ETIMEDOUT;
+            break;
+        }
+
+        /* Sleep until an event, the next attempt or the end of the resolution delay. */
+        long long wake = deadline;
+        if (candidates && resolved && next_attempt < wake)
+            wake = next_attempt;
+        if (!inet6_done && inet_done && inet_done_at + DIAL_RESOLUTION_DELAY_MS < wake)
+            wake = inet_done_at + DIAL_RESOLUTION_DELAY_MS;
+        int timeout = wake > now ? (int)(wake - now) : 0;
+
+        struct pollfd pfd[1 + LOOKUPS * DIAL_MAX_ADDRS];
+        int *polled[1 + LOOKUPS * DIAL_MAX_ADDRS];
+        nfds_t nfds = 0;
+        if (!inet6_done || !inet_done) {
+            pfd[nfds].fd = l->notify[0];
+            pfd[nfds].events = POLLIN;
+            polled[nfds++] = NULL;
+        }
+        for (size_t i = 0; i < attempt_count; i++) {
+            if (attempts[i] < 0)
+                continue;
+            pfd[nfds].fd = attempts[i];
+            pfd[nfds].events = POLLOUT;
+            polled[nfds++] = &attempts[i];
+        }
+        int ready = poll(pfd, nfds, timeout);
+        if (ready < 0 && errno != EINTR) {
+            last_error = errno;
+            break;
+        }
+        if (ready <= 0)
+            continue;
+
+        now = monotonic_ms();
+        for (nfds_t i = 0; i < nfds && winner < 0; i++) {
+            if (pfd[i].revents == 0)
+                continue;
+            if (polled[i] == NULL) {
+                unsigned char index;
+                if (read(l->notify[0], &index, 1) == 1 && index < LOOKUPS) {
+                    l->queries[index].done = 1;
+                    next[index] = l->queries[index].result;
+                    if (index == LOOKUP_INET && !l->queries[LOOKUP_INET6].done)
+                        inet_done_at = now;
+                }
+                continue;
+            }
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(*polled[i], SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                err = errno;
+            if (err == 0) {
+                winner = *polled[i];
+                *polled[i] = -1;
+            } else {
+                last_error = err;
+                close(*polled[i]);
+                *polled[i] = -1;
+                next_attempt = now;     /* do not wait for the attempt delay */
+            }
+        }
+        if (winner >= 0)
+            break;
+    }
+
+    for (size_t i = 0; i < attempt_count; i++) {
+        if (attempts[i] >= 0)
+            close(attempts[i]);
+    }
+    if (winner < 0) {
+        if (tried[LOOKUP_INET6] + tried[LOOKUP_INET] == 0 && last_error == 0) {
+            int error = l->queries[LOOKUP_INET].error ? l->queries[LOOKUP_INET].error
+                                                      : l->queries[LOOKUP_INET6].error;
+            fprintf(stderr, "%s: %s\n", host, gai_strerror(error));
+        } else {
+            fprintf(stderr, "connect to %s: %s\n", host, strerror(last_error));
+        }
+        lookup_release(l);
+        return -1;
+    }
+    lookup_release(l);
+
+    int flags = fcntl(winner, F_GETFL, 0);
+    if (flags < 0 || fcntl(winner, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+        perror("fcntl");
+        close(winner);
+        return -1;
+    }
+    return winner;
+}
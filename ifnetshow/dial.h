@@ -0,0 +1,30 @@
+#ifndef DIAL_H
+#define DIAL_H
+
+/*
+ * Delays of the connection race (RFC 8305): how long an IPv4 answer waits
+ * for the IPv6 one before connecting starts, and how long an attempt runs
+ * alone before the next address is tried alongside it.
+ */
+#define DIAL_RESOLUTION_DELAY_MS 50
+#define DIAL_ATTEMPT_DELAY_MS    250
+
+/* Addresses of each family tried at most. */
+#define DIAL_MAX_ADDRS 16
+
+/*
+ * dial_connect:
+ *   Open a TCP connection to host (an IPv4 or IPv6 literal, or a host name)
+ *   on port, within timeout_ms, the "Happy Eyeballs" way. A name is looked
+ *   up for IPv6 and IPv4 addresses at the same time, in background threads,
+ *   and connecting starts as soon as the IPv6 addresses are known (or
+ *   DIAL_RESOLUTION_DELAY_MS after the IPv4 ones). Attempts alternate
+ *   between the families, a new one starting every DIAL_ATTEMPT_DELAY_MS or
+ *   as soon as the previous one failed, and the first connection
+ *   established wins; the others are abandoned.
+ *   Returns a connected, blocking socket, or -1 after printing why it
+ *   could not connect on stderr.
+ */
+int dial_connect(const char *host, int port, int timeout_ms);
+
+#endif /* DIAL_H */
@@ -0,0 +1,473 @@
+/*
+ * fanout.c
+ *
+ * Fleet mode of ifnetshow_client: one process queries thousands of agents
+ * concurrently. Every target gets a non-blocking socket registered in a
+ * single epoll instance and walks a small connect/send/receive state
+ * machine. At most a fixed number of targets are in flight; the rest are
+ * started as earlier ones finish. Targets in flight are kept in start
+ * order, which is also deadline order, so timeouts are found at the head.
+ * Targets are IPv4 or IPv6 addresses; host names are resolved once, when
+ * the list is built.
+ */
+
+#include "fanout.h"
+#include "ifnetshow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#define MAX_EVENTS 256
+
+enum target_state {
+    TARGET_CONNECTING,
+    TARGET_SENDING,
+    TARGET_RECEIVING
+};
+
+/*
+ * struct target_conn:
+ *   One target in flight and the answer received from it so far.
+ */
+struct target_conn {
+    int                     fd;
+    struct sockaddr_storage addr;
+    socklen_t               addr_len;
+    enum target_state       state;
+    size_t                  sent;
+    char                   *buf;
+    size_t                  len;
+    size_t                  cap;
+    long long               deadline;
+    struct target_conn     *prev, *next;
+};
+
+struct fanout_run_state {
+    const struct fanout_options *opts;
+    size_t                       command_len;
+    int                          epfd;
+    struct target_conn          *slots;
+    struct target_conn         **free_slots;
+    size_t                       free_count;
+    struct target_conn          *oldest, *newest;
+    long                         failures;
+    long                         answered;
+};
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void fanout_targets_init(struct fanout_targets *targets) {
+    memset(targets, 0, sizeof(*targets));
+}
+
+void fanout_targets_free(struct fanout_targets *targets) {
+    free(targets->ranges);
+    memset(targets, 0, sizeof(*targets));
+}
+
+/* Bytes of an address; the last 4 are the ones a range walks through. */
+static size_t addr_size(int family) {
+    return family == AF_INET6 ? 16 : 4;
+}
+
+static uint32_t load_low(const unsigned char *first, int family) {
+    uint32_t low;
+    memcpy(&low, first + addr_size(family) - 4, sizeof(low));
+    return ntohl(low);
+}
+
+static void store_low(unsigned char *first, int family, uint32_t low) {
+    low = htonl(low);
+    memcpy(first + addr_size(family) - 4, &low, sizeof(low));
+}
+
+/*
+ * add_range:
+ *   Add the block of the given prefix length (-1 for the address alone)
+ *   around the address sa. Returns 0, or -1 if the prefix is not supported
+ *   or on allocation failure.
+ */
+static int add_range(struct fanout_targets *targets, const struct sockaddr *sa, int prefix) {
+    struct fanout_range range;
+    memset(&range, 0, sizeof(range));
+    range.family = sa->sa_family;
+    int bits;
+    if (sa->sa_family == AF_INET6) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
+        memcpy(range.first, &sin6->sin6_addr, 16);
+        range.scope_id = sin6->sin6_scope_id;
+        bits = 128;
+    } else {
+        memcpy(range.first, &((const struct sockaddr_in *) sa)->sin_addr, 4);
+        bits = 32;
+    }
+    if (prefix < 0)
+        prefix = bits;
+    /* A block walks through the last 32 bits of the address at most. */
+    if (prefix > bits || prefix < bits - 32)
+        return -1;
+
+    int host_bits = bits - prefix;
+    uint32_t mask = host_bits == 32 ? 0 : 0xffffffffu << host_bits;
+    uint32_t low = load_low(range.first, range.family) & mask;
+    range.count = (uint64_t) 1 << host_bits;
+    if (range.family == AF_INET && prefix < 31) {
+        /* Skip the network and broadcast addresses. */
+        low++;
+        range.count -= 2;
+    }
+    store_low(range.first, range.family, low);
+
+    if (targets->range_count == targets->range_cap) {
+        size_t cap = targets->range_cap ? targets->range_cap * 2 : 16;
+        struct fanout_range *p = realloc(targets->ranges, cap * sizeof(*p));
+        if (p == NULL)
+            return -1;
+        targets->ranges = p;
+        targets->range_cap = cap;
+    }
+    targets->ranges[targets->range_count++] = range;
+    targets->total += range.count;
+    return 0;
+}
+
+int fanout_add_target(struct fanout_targets *targets, const char *spec) {
+    char text[INET6_ADDRSTRLEN + IF_NAMESIZE + 8];
+    if (strlen(spec) >= sizeof(text))
+        return -1;
+    strcpy(text, spec);
+
+    int prefix = -1;
+    char *slash = strchr(text, '/');
+    if (slash != NULL) {
+        char *end;
+        *slash = '\0';
+        long p = strtol(slash + 1, &end, 10);
+        if (*end != '\0' || end == slash + 1 || p < 0 || p > 128)
+            return -1;
+        prefix = (int) p;
+    }
+
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (getaddrinfo(text, NULL, &hints, &ai) != 0)
+        return -1;
+    int ret = add_range(targets, ai->ai_addr, prefix);
+    freeaddrinfo(ai);
+    return ret;
+}
+
+int fanout_add_name(struct fanout_targets *targets, const char *name) {
+    struct addrinfo hints, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_ADDRCONFIG;
+    int err = getaddrinfo(name, NULL, &hints, &ai);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", name, gai_strerror(err));
+        return -1;
+    }
+    int ret = add_range(targets, ai->ai_addr, -1);
+    freeaddrinfo(ai);
+    return ret;
+}
+
+int fanout_add_file(struct fanout_targets *targets, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return -1;
+    }
+    char line[256];
+    int lineno = 0;
+    int ret = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineno++;
+        char *p = line + strspn(line, " \t");
+        p[strcspn(p, " \t\r\n#")] = '\0';
+        if (*p == '\0')
+            continue;
+        if (fanout_add_target(targets, p) < 0 &&
+            (strchr(p, '/') != NULL || fanout_add_name(targets, p) < 0)) {
+            fprintf(stderr, "%s:%d: invalid target '%s'\n", path, lineno, p);
+            ret = -1;
+            break;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+/* Make room for the requested concurrency in the descriptor limit. */
+static void reserve_fds(int concurrency) {
+    struct rlimit rl;
+    rlim_t need = (rlim_t) concurrency + 16;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < need) {
+        rl.rlim_cur = need < rl.rlim_max ? need : rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            perror("setrlimit");
+    }
+}
+
+/* finish_target: report the outcome of a target and give its slot back. */
+static void finish_target(struct fanout_run_state *st, struct target_conn *tc, const char *error) {
+    char addr[NI_MAXHOST];
+    if (getnameinfo((struct sockaddr *) &tc->addr, tc->addr_len, addr, sizeof(addr), NULL, 0,
+                    NI_NUMERICHOST) != 0)
+        strcpy(addr, "?");
+    if (error == NULL) {
+        printf("[%s]\n", addr);
+        fwrite(tc->buf, 1, tc->len, stdout);
+        if (tc->len > 0 && tc->buf[tc->len - 1] != '\n')
+            putchar('\n');
+        fflush(stdout);
+        st->answered++;
+    } else {
+        fprintf(stderr, "[%s] %s\n", addr, error);
+        st->failures++;
+    }
+
+    if (tc->prev)
+        tc->prev->next = tc->next;
+    else
+        st->oldest = tc->next;
+    if (tc->next)
+        tc->next->prev = tc->prev;
+    else
+        st->newest = tc->prev;
+
+    close(tc->fd);    /* also removes it from the epoll set */
+    tc->fd = -1;
+    tc->len = 0;
+    st->free_slots[st->free_count++] = tc;
+}
+
+/* start_target: open a non-blocking connection to the offset-th address of r. */
+static void start_target(struct fanout_run_state *st, const struct fanout_range *r,
+                         uint64_t offset, long long now) {
+    struct target_conn *tc = st->free_slots[--st->free_count];
+    unsigned char addr[16];
+    memcpy(addr, r->first, sizeof(addr));
+    store_low(addr, r->family, load_low(addr, r->family) + (uint32_t) offset);
+    memset(&tc->addr, 0, sizeof(tc->addr));
+    if (r->family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &tc->addr;
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(SERVER_PORT);
+        memcpy(&sin6->sin6_addr, addr, 16);
+        sin6->sin6_scope_id = r->scope_id;
+        tc->addr_len = sizeof(*sin6);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *) &tc->addr;
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(SERVER_PORT);
+        memcpy(&sin->sin_addr, addr, 4);
+        tc->addr_len = sizeof(*sin);
+    }
+    tc->state = TARGET_CONNECTING;
+    tc->sent = 0;
+    tc->len = 0;
+    tc->deadline = now + st->opts->timeout_ms;
+    tc->prev = st->newest;
+    tc->next = NULL;
+    if (st->newest)
+        st->newest->next = tc;
+    else
+        st->oldest = tc;
+    st->newest = tc;
+
+    tc->fd = socket(r->family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (tc->fd < 0) {
+        finish_target(st, tc, strerror(errno));
+        return;
+    }
+
+    if (connect(tc->fd, (struct sockaddr *) &tc->addr, tc->addr_len) < 0 &&
+        errno != EINPROGRESS) {
+        finish_target(st, tc, strerror(errno));
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLOUT;
+    ev.data.ptr = tc;
+    if (epoll_ctl(st->epfd, EPOLL_CTL_ADD, tc->fd, &ev) < 0)
+        finish_target(st, tc, strerror(errno));
+}
+
+/*
+ * receive_answer:
+ *   Read what is available. Returns 1 once the agent has closed the
+ *   connection (the answer is complete), 0 if more is expected, -1 on error.
+ */
+static int receive_answer(struct target_conn *tc) {
+    for (;;) {
+        if (tc->cap - tc->len < 1024) {
+            size_t cap = tc->cap ? tc->cap * 2 : 4096;
+            char *p = realloc(tc->buf, cap);
+            if (p == NULL)
+                return -1;
+            tc->buf = p;
+            tc->cap = cap;
+        }
+        ssize_t n = read(tc->fd, tc->buf + tc->len, tc->cap - tc->len);
+        if (n > 0) {
+            tc->len += (size_t) n;
+            continue;
+        }
+        if (n == 0)
+            return 1;
+        if (errno == EINTR)
+            continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        return -1;
+    }
+}
+
+/* handle_target: advance the state machine of tc after an epoll event. */
+static void handle_target(struct fanout_run_state *st, struct target_conn *tc) {
+    if (tc->state == TARGET_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(tc->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = errno;
+        if (err != 0) {
+            finish_target(st, tc, strerror(err));
+            return;
+        }
+        tc->state = TARGET_SENDING;
+    }
+
+    if (tc->state == TARGET_SENDING) {
+        while (tc->sent < st->command_len) {
+            ssize_t n = send(tc->fd, st->opts->command + tc->sent,
+                             st->command_len - tc->sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    return;
+                finish_target(st, tc, strerror(errno));
+                return;
+            }
+            tc->sent += (size_t) n;
+        }
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = tc;
+        if (epoll_ctl(st->epfd, EPOLL_CTL_MOD, tc->fd, &ev) < 0) {
+            finish_target(st, tc, strerror(errno));
+            return;
+        }
+        tc->state = TARGET_RECEIVING;
+        return;
+    }
+
+    int ret = receive_answer(tc);
+    if (ret > 0)
+        finish_target(st, tc, NULL);
+    else if (ret < 0)
+        finish_target(st, tc, strerror(errno));
+}
+
+long fanout_run(const struct fanout_targets *targets, const struct fanout_options *opts) {
+    struct fanout_run_state st;
+    memset(&st, 0, sizeof(st));
+    st.opts = opts;
+    st.command_len = strlen(opts->command);
+
+    size_t slots = (size_t) opts->concurrency;
+    if ((uint64_t) slots > targets->total)
+        slots = (size_t) targets->total;
+    if (slots == 0)
+        return 0;
+    reserve_fds((int) slots);
+
+    st.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (st.epfd < 0) {
+        perror("epoll_create1");
+        return -1;
+    }
+    st.slots = calloc(slots, sizeof(struct target_conn));
+    st.free_slots = malloc(slots * sizeof(struct target_conn *));
+    if (st.slots == NULL || st.free_slots == NULL) {
+        perror("malloc");
+        free(st.slots);
+        free(st.free_slots);
+        close(st.epfd);
+        return -1;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        st.slots[i].fd = -1;
+        st.free_slots[st.free_count++] = &st.slots[slots - 1 - i];
+    }
+
+    long long started = monotonic_ms();
+    size_t range = 0;
+    uint64_t offset = 0;
+    struct epoll_event events[MAX_EVENTS];
+
+    for (;;) {
+        long long now = monotonic_ms();
+
+        /* Top up the in-flight set. */
+        while (st.free_count > 0 && range < targets->range_count) {
+            const struct fanout_range *r = &targets->ranges[range];
+            if (offset == r->count) {
+                range++;
+                offset = 0;
+                continue;
+            }
+            start_target(&st, r, offset, now);
+            offset++;
+        }
+        if (st.oldest == NULL)
+            break;
+
+        long long wait = st.oldest->deadline - now;
+        int n = epoll_wait(st.epfd, events, MAX_EVENTS, wait > 0 ? (int) wait : 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++)
+            handle_target(&st, events[i].data.ptr);
+
+        /* The oldest target in flight has the earliest deadline. */
+        now = monotonic_ms();
+        while (st.oldest != NULL && st.oldest->deadline <= now)
+            finish_target(&st, st.oldest, "timed out");
+    }
+
+    fprintf(stderr, "%ld of %llu targets answered in %.2fs\n", st.answered,
+            (unsigned long long) targets->total, (monotonic_ms() - started) / 1000.0);
+
+    for (size_t i = 0; i < slots; i++) {
+        if (st.slots[i].fd >= 0)
+            close(st.slots[i].fd);
+        free(st.slots[i].buf);
+    }
+    free(st.slots);
+    free(st.free_slots);
+    close(st.epfd);
+    return st.failures;
+}
@@ -0,0 +1,83 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * struct fanout_range:
+ *   A run of consecutive IPv4 or IPv6 addresses (first in network order,
+ *   with the scope of a link-local IPv6 address). A single address is a
+ *   range of count 1; a CIDR block is expanded lazily while querying.
+ */
+struct fanout_range {
+    int           family;
+    unsigned char first[16];
+    uint32_t      scope_id;
+    uint64_t      count;
+};
+
+/*
+ * struct fanout_targets:
+ *   Every agent a fan-out query is sent to.
+ */
+struct fanout_targets {
+    struct fanout_range *ranges;
+    size_t               range_count;
+    size_t               range_cap;
+    uint64_t             total;
+};
+
+/*
+ * struct fanout_options:
+ *   command     : protocol 1 command sent to every agent ("ALL", "IFNAME eth0")
+ *   timeout_ms  : per-target budget, from connect to the end of the answer
+ *   concurrency : maximum number of targets queried at the same time
+ */
+struct fanout_options {
+    const char *command;
+    int         timeout_ms;
+    int         concurrency;
+};
+
+void fanout_targets_init(struct fanout_targets *targets);
+void fanout_targets_free(struct fanout_targets *targets);
+
+/*
+ * fanout_add_target:
+ *   Add an IPv4 or IPv6 address ("10.0.0.5", "2001:db8::5", "fe80::5%eth0")
+ *   or CIDR block ("10.0.0.0/24", "2001:db8::/120"). For IPv4 blocks shorter
+ *   than /31 the network and broadcast addresses are skipped; IPv6 blocks
+ *   must be /96 or longer.
+ *   Returns 0 on success, -1 if spec is invalid or on allocation failure.
+ */
+int fanout_add_target(struct fanout_targets *targets, const char *spec);
+
+/*
+ * fanout_add_name:
+ *   Resolve a host name (blocking) and add its preferred address, the
+ *   first getaddrinfo() returns. Returns 0 on success, -1 if the name
+ *   cannot be resolved (reported on stderr) or on allocation failure.
+ */
+int fanout_add_name(struct fanout_targets *targets, const char *name);
+
+/*
+ * fanout_add_file:
+ *   Add every target listed in path, one per line: addresses, blocks or
+ *   host names. Blank lines and lines starting with '#' are ignored.
+ *   Returns 0 on success, -1 on error.
+ */
+int fanout_add_file(struct fanout_targets *targets, const char *path);
+
+/*
+ * fanout_run:
+ *   Query every target concurrently from one epoll loop with non-blocking
+ *   sockets, keeping at most opts->concurrency connections in flight.
+ *   Each answer is written to stdout as soon as it is complete, preceded
+ *   by a "[<addr>]" line; failures and timeouts are reported on stderr.
+ *
+ *   Returns the number of targets that did not answer, or -1 on error.
+ */
+long fanout_run(const struct fanout_targets *targets, const struct fanout_options *opts);
+
+#endif /* FANOUT_H */
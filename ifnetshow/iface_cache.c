@@ -0,0 +1,192 @@
+/*
+ * iface_cache.c
+ *
+ * Interface/address table of ifnetshow_agent, kept up to date by rtnetlink
+ * multicast notifications instead of being recomputed for every request.
+ */
+
+#include "iface_cache.h"
+#include "ifshow_netlink.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+/*
+ * same_snapshot:
+ *   Compare two finalized snapshots. Counters are not compared: they change
+ *   all the time and do not make a new generation.
+ */
+static int same_snapshot(const struct ifshow_snapshot *a, const struct ifshow_snapshot *b) {
+    if (a->iface_count != b->iface_count || a->addr_count != b->addr_count)
+        return 0;
+    for (size_t i = 0; i < a->iface_count; i++) {
+        if (a->ifaces[i].ifindex != b->ifaces[i].ifindex ||
+            strcmp(a->ifaces[i].name, b->ifaces[i].name) != 0 ||
+            a->ifaces[i].addr_count != b->ifaces[i].addr_count ||
+            memcmp(&a->ifaces[i].link, &b->ifaces[i].link, sizeof(struct ifshow_link)) != 0)
+            return 0;
+    }
+    size_t n = a->addr_count;
+    return n == 0 ||
+           (memcmp(a->addr_ifindex, b->addr_ifindex, n * sizeof(unsigned int)) == 0 &&
+            memcmp(a->addr_family, b->addr_family, n) == 0 &&
+            memcmp(a->addr_prefix, b->addr_prefix, n) == 0 &&
+            memcmp(a->addr_bytes, b->addr_bytes, n * IFSHOW_ADDR_MAX) == 0);
+}
+
+/*
+ * reload:
+ *   Replace the whole table with a fresh dump. Used at startup, when the
+ *   notification socket overflowed (ENOBUFS), and when notifications are not
+ *   available at all. The dump goes into the spare buffer, which is then
+ *   swapped with the table (so the counters are always fresh); both keep
+ *   their memory, so once warmed up a reload does not allocate.
+ *   Returns 1 if the table changed, 0 if not, -1 on error.
+ */
+static int reload(struct iface_cache *cache) {
+    ifshow_snapshot_reset(&cache->spare);
+    if (ifshow_snapshot_load(&cache->spare) < 0)
+        return -1;
+    int changed = !same_snapshot(&cache->spare, &cache->snap);
+    struct ifshow_snapshot swap = cache->snap;
+    cache->snap = cache->spare;
+    cache->spare = swap;
+    if (changed)
+        cache->generation++;
+    return changed;
+}
+
+int iface_cache_open(struct iface_cache *cache) {
+    memset(cache, 0, sizeof(*cache));
+    ifshow_snapshot_init(&cache->snap);
+    ifshow_snapshot_init(&cache->spare);
+    cache->epoch = ((unsigned long long) time(NULL) << 20) ^ (unsigned long long) getpid();
+
+    /* Subscribe before dumping so that no change can fall in between. */
+    cache->nl_fd = ifshow_nl_open();
+    if (cache->nl_fd >= 0) {
+        static const int groups[] = { RTNLGRP_LINK, RTNLGRP_IPV4_IFADDR, RTNLGRP_IPV6_IFADDR };
+        for (size_t i = 0; i < sizeof(groups) / sizeof(groups[0]); i++) {
+            if (setsockopt(cache->nl_fd, SOL_NETLINK, NETLINK_ADD_MEMBERSHIP,
+                           &groups[i], sizeof(groups[i])) < 0) {
+                perror("setsockopt (NETLINK_ADD_MEMBERSHIP)");
+                close(cache->nl_fd);
+                cache->nl_fd = -1;
+                break;
+            }
+        }
+    }
+    if (cache->nl_fd < 0)
+        fprintf(stderr, "Interface notifications unavailable, reloading the table periodically.\n");
+
+    if (reload(cache) < 0) {
+        iface_cache_close(cache);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * apply_message:
+ *   Apply one notification to the table. Returns 1 if it changed something.
+ */
+static int apply_message(struct iface_cache *cache, const struct nlmsghdr *nh) {
+    struct ifshow_iface iface;
+    struct ifshow_addr addr;
+
+    switch (nh->nlmsg_type) {
+    case RTM_NEWLINK:
+        if (ifshow_nl_parse_link(nh, &iface) < 0)
+            return 0;
+        return ifshow_snapshot_update_iface(&cache->snap, &iface);
+    case RTM_DELLINK:
+        if (ifshow_nl_parse_link(nh, &iface) < 0)
+            return 0;
+        return ifshow_snapshot_remove_iface(&cache->snap, iface.ifindex);
+    case RTM_NEWADDR:
+        if (ifshow_nl_parse_addr(nh, &addr) < 0)
+            return 0;
+        return ifshow_snapshot_update_addr(&cache->snap, &addr);
+    case RTM_DELADDR:
+        if (ifshow_nl_parse_addr(nh, &addr) < 0)
+            return 0;
+        return ifshow_snapshot_remove_addr(&cache->snap, &addr);
+    default:
+        return 0;
+    }
+}
+
+int iface_cache_process(struct iface_cache *cache) {
+    if (cache->nl_fd < 0)
+        return 0;
+
+    char buffer[IFSHOW_NL_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+    int changes = 0;
+    int resync = 0;
+
+    for (;;) {
+        ssize_t n = recv(cache->nl_fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            if (errno == ENOBUFS) {
+                /* Notifications were lost: the table must be reloaded. */
+                resync = 1;
+                continue;
+            }
+            perror("recv (netlink)");
+            return -1;
+        }
+
+        int remaining = (int) n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *) buffer; NLMSG_OK(nh, remaining);
+             nh = NLMSG_NEXT(nh, remaining)) {
+            int ret = apply_message(cache, nh);
+            if (ret < 0)
+                resync = 1;
+            else
+                changes += ret;
+        }
+    }
+
+    if (resync) {
+        int ret = reload(cache);
+        return ret < 0 ? -1 : changes + ret;
+    }
+    if (changes > 0) {
+        if (ifshow_snapshot_finalize(&cache->snap) < 0)
+            return reload(cache) < 0 ? -1 : changes;
+        cache->generation++;
+    }
+    return changes;
+}
+
+int iface_cache_refresh_stats(struct iface_cache *cache) {
+    if (cache->nl_fd < 0)
+        return 0;       /* the caller's iface_cache_get() reloads everything */
+    return ifshow_snapshot_load_stats(&cache->snap);
+}
+
+const struct ifshow_snapshot *iface_cache_get(struct iface_cache *cache) {
+    if (cache->nl_fd < 0)
+        reload(cache);
+    return &cache->snap;
+}
+
+void iface_cache_close(struct iface_cache *cache) {
+    if (cache->nl_fd >= 0)
+        close(cache->nl_fd);
+    cache->nl_fd = -1;
+    ifshow_snapshot_free(&cache->snap);
+    ifshow_snapshot_free(&cache->spare);
+}
@@ -0,0 +1,63 @@
+#ifndef IFACE_CACHE_H
+#define IFACE_CACHE_H
+
+#include "ifshow.h"
+
+/*
+ * struct iface_cache:
+ *   In-memory interface/address table of the agent. It is loaded once and
+ *   then kept fresh by rtnetlink notifications (RTNLGRP_LINK,
+ *   RTNLGRP_IPV4_IFADDR and RTNLGRP_IPV6_IFADDR), so requests can be answered
+ *   without querying the kernel. Interface counters are the exception: they
+ *   are refreshed on demand with iface_cache_refresh_stats().
+ *
+ *   generation is incremented every time the table actually changes; epoch
+ *   is drawn when the cache is opened, so generations of two runs of the
+ *   agent cannot be mistaken for each other.
+ */
+struct iface_cache {
+    int                    nl_fd;       /* notification socket, -1 if unavailable */
+    struct ifshow_snapshot snap;
+    struct ifshow_snapshot spare;       /* recycled buffer for full reloads */
+    unsigned long long     generation;
+    unsigned long long     epoch;
+};
+
+/*
+ * iface_cache_open:
+ *   Subscribe to interface notifications, then load the initial table.
+ *   If netlink notifications cannot be used the cache still works, but
+ *   iface_cache_get() reloads the table on every call, so it must then be
+ *   called periodically.
+ *
+ *   Returns 0 on success, -1 if the initial table could not be loaded.
+ */
+int iface_cache_open(struct iface_cache *cache);
+
+/*
+ * iface_cache_process:
+ *   Drain the pending notifications (non-blocking) and apply them to the
+ *   table. Call it whenever nl_fd becomes readable.
+ *
+ *   Returns the number of changes applied, or -1 on error.
+ */
+int iface_cache_process(struct iface_cache *cache);
+
+/*
+ * iface_cache_refresh_stats:
+ *   Bring the interface counters of the table up to date (one RTM_GETLINK
+ *   dump). Counters are not covered by notifications and do not change the
+ *   generation, so the caller decides how often this is worth doing.
+ *   Returns 0 on success, -1 on error.
+ */
+int iface_cache_refresh_stats(struct iface_cache *cache);
+
+/*
+ * iface_cache_get:
+ *   Return the current table.
+ */
+const struct ifshow_snapshot *iface_cache_get(struct iface_cache *cache);
+
+void iface_cache_close(struct iface_cache *cache);
+
+#endif /* IFACE_CACHE_H */
@@ -0,0 +1,67 @@
+#ifndef IFNETSHOW_H
+#define IFNETSHOW_H
+
+#include "ifshow_render.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+/* TCP port of the ifnetshow agent */
+#define SERVER_PORT 12345
+
+/*
+ * Protocol 1 (original): the client connects, writes one command ("ALL",
+ * "IFNAME <name>", ...) without terminator and reads the text answer until the
+ * agent closes the connection.
+ *
+ * Protocol 2: the client opens with the IFN_HELLO line. An agent that speaks
+ * it answers IFN_HELLO_OK; an older agent answers "Unknown command." and
+ * closes, so the client can fall back to protocol 1. After the handshake both
+ * sides exchange frames on the same connection, which stays open: an 8-byte
+ * header (payload length, message type, flags; all in network byte order)
+ * followed by the payload. Requests may be pipelined; answers come back in
+ * request order.
+ */
+#define IFN_HELLO    "IFNSHOW/2\n"
+#define IFN_HELLO_OK "IFNSHOW/2 OK\n"
+
+#define IFN_FRAME_HDR_LEN 8
+
+/* Largest request payload accepted by the agent */
+#define IFN_MAX_REQUEST 1016
+
+/* Message types */
+#define IFN_MSG_REQUEST  1   /* client -> agent: command text */
+#define IFN_MSG_RESPONSE 2   /* agent -> client: answer to a request */
+#define IFN_MSG_ERROR    3   /* agent -> client: the request was rejected */
+
+/* Frame flags */
+#define IFN_FLAG_BINARY  0x0001  /* request: answer in binary; response: answer is binary */
+
+/*
+ * Binary answer (protocol 2 requests carrying IFN_FLAG_BINARY, for "ALL" and
+ * "IFNAME <name>"): the binary rendering of the agent's snapshot, see
+ * ifshow_render.h. Its generation field is the agent's generation.
+ */
+
+static inline void ifn_frame_pack(unsigned char *hdr, uint32_t len, uint16_t type, uint16_t flags) {
+    uint32_t nlen = htonl(len);
+    uint16_t ntype = htons(type), nflags = htons(flags);
+    memcpy(hdr, &nlen, 4);
+    memcpy(hdr + 4, &ntype, 2);
+    memcpy(hdr + 6, &nflags, 2);
+}
+
+static inline void ifn_frame_unpack(const unsigned char *hdr, uint32_t *len, uint16_t *type, uint16_t *flags) {
+    uint32_t nlen;
+    uint16_t ntype, nflags;
+    memcpy(&nlen, hdr, 4);
+    memcpy(&ntype, hdr + 4, 2);
+    memcpy(&nflags, hdr + 6, 2);
+    *len = ntohl(nlen);
+    *type = ntohs(ntype);
+    *flags = ntohs(nflags);
+}
+
+#endif /* IFNETSHOW_H */
@@ -3,153 +3,470 @@
  *
  * Persistent agent (server) for ifnetshow.
  * It listens for connections on a fixed port and returns network interface
- * information from the local machine.
+ * information from the local machine. By default it listens on one
+ * dual-stack IPv6 socket, which IPv4 clients reach too (on an IPv4-only
+ * host, on an IPv4 socket); -a restricts it to the given addresses, one
+ * socket per address.
  *
- * Supported commands (sent as plain text):
- *   - "ALL"
+ * Supported commands (sent as plain text, or as protocol 2 frames over a
+ * persistent connection, see ifnetshow.h):
+ *   - "ALL [LINK] [STATS]"
  *         => List all network interfaces with their IPv4/IPv6 addresses.
- *   - "IFNAME <ifname>"
+ *   - "IFNAME <ifname> [LINK] [STATS]"
  *         => List the addresses (with prefix) for the specified interface.
+ *   LINK adds the link state, flags, MTU and hardware address of the
+ *   interfaces, STATS their rx/tx counters (refreshed every -s milliseconds);
+ *   with either of them interfaces without addresses are listed too.
+ *   - "GENERATION"
+ *         => Return the generation counter of the interface table, which is
+ *            incremented whenever an interface or address changes.
+ *   - "RATES [<ifname>] [HISTORY]"
+ *         => Rx/tx bits, packets, errors and drops per second of every
+ *            interface (or one), computed by the agent from the counters it
+ *            samples every -s milliseconds with CLOCK_MONOTONIC timestamps.
+ *            HISTORY adds the rates of the previous intervals still kept.
+ *   - "STATS"
+ *         => The agent's metrics: requests by command, cache use, bytes
+ *            sent, connections, errors and request latency percentiles.
+ *   - "SUBSCRIBE [<epoch> <generation>]"
+ *         => Keep the connection open: send the whole table once, then push
+ *            the changes of every new generation. Given the epoch and
+ *            generation of the last message received, a reconnecting client
+ *            only gets the changes it missed.
  *
- * The agent reuses the code from ifshow by including "ifshow.h".
+ * The agent reuses the code from ifshow by including "ifshow.h". Interface
+ * data is kept in memory (see iface_cache.c) and refreshed by rtnetlink
+ * notifications, so requests are served without querying the kernel, and the
+ * answers themselves are cached already rendered (see response_cache.c).
+ * Clients are served concurrently by epoll event loops (see agent_server.c):
+ * with -w N, N worker threads each accept on their own SO_REUSEPORT socket,
+ * while the main thread follows the netlink notifications and publishes each
+ * new generation of the table to the workers (see shared_view.c).
+ * With -m <port>, the main thread also serves the metrics in the Prometheus
+ * text format on 127.0.0.1:<port>/metrics.
+ * Messages logged while serving (connections, errors, table changes) go
+ * through an in-memory ring written to stdout by a background thread, so
+ * a slow stdout never blocks a worker; -l sets the level logged.
+ *
+ * Usage:
+ *    ifnetshow_agent [-a <address>]... [-b <backlog>] [-w <workers>] [-s <stats interval ms>]
+ *                    [-m <metrics port>] [-l error|warn|info|debug]
  *
  * Compile with:
- *    gcc -o ifnetshow_agent ifnetshow_agent.c ifshow.c
+ *    gcc -o ifnetshow_agent -pthread ifnetshow_agent.c agent_server.c agent_metrics.c metrics.c log_ring.c shared_view.c iface_cache.c response_cache.c rate_sampler.c ifshow.c ifshow_snapshot.c ifshow_netlink.c ifshow_render.c
  */
 
 #include "ifshow.h"
+#include "ifnetshow.h"
+#include "iface_cache.h"
+#include "response_cache.h"
+#include "shared_view.h"
+#include "agent_server.h"
+#include "agent_metrics.h"
+#include "metrics.h"
+#include "log_ring.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
-#include <ifaddrs.h>
-#include <arpa/inet.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
+
+#define MAX_WORKERS 256
+
+/* How often the table is reloaded when netlink notifications are unavailable. */
+#define FALLBACK_RELOAD_MS 1000
 
-#define SERVER_PORT 12345
-#define BUFFER_SIZE 1024
+/* How often replaced views are checked for reclamation. */
+#define RECLAIM_INTERVAL_MS 100
+
+/* Default interval between two refreshes of the interface counters. */
+#define STATS_INTERVAL_MS 1000
 
 /*
- * process_request:
- *   Processes the command received from the client.
- *   The command can be:
- *       "ALL"            -> list all interfaces.
- *       "IFNAME <name>"  -> list the addresses for a specific interface.
- *
- *   This function opens a FILE stream on the client socket descriptor and then
- *   calls the appropriate ifshow function.
+ * struct listen_addrs:
+ *   The local addresses given with -a (SERVER_PORT included); every worker
+ *   gets one listening socket per address.
  */
-void process_request(int client_fd, const char *request) {
-    char mode[16];
-    char ifname[128];
-    int is_all = 0;
-
-    memset(mode, 0, sizeof(mode));
-    memset(ifname, 0, sizeof(ifname));
-
-    if (strncmp(request, "ALL", 3) == 0) {
-        is_all = 1;
-    } else if (strncmp(request, "IFNAME", 6) == 0) {
-        // Expected format: "IFNAME <ifname>"
-        if (sscanf(request, "%s %s", mode, ifname) != 2) {
-            dprintf(client_fd, "Invalid command format.\n");
-            return;
-        }
-    } else {
-        dprintf(client_fd, "Unknown command.\n");
-        return;
+struct listen_addrs {
+    struct sockaddr_storage addr[AGENT_MAX_LISTENERS];
+    socklen_t               len[AGENT_MAX_LISTENERS];
+    size_t                  count;
+};
+
+static struct log_site log_table = LOG_SITE_INIT("table", 0, 1);
+
+/* usage:
+ * Prints the correct command-line usage and exits.
+ */
+void usage(const char *progname) {
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "  %s [-a <address>]... [-b <backlog>] [-w <workers>] [-s <stats interval ms>]\n"
+                    "      [-m <metrics port>] [-l error|warn|info|debug]\n",
+            progname);
+    fprintf(stderr, "  -a listens on the given address or host name only (repeatable); by default\n");
+    fprintf(stderr, "  the agent listens on all IPv6 and IPv4 addresses.\n");
+    fprintf(stderr, "  -s sets how often the interface counters are refreshed and sampled for RATES\n");
+    fprintf(stderr, "  (0 disables both).\n");
+    fprintf(stderr, "  -m serves Prometheus metrics on 127.0.0.1:<metrics port>/metrics.\n");
+    fprintf(stderr, "  -l sets the least severe messages logged (default info).\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * raise_fd_limit:
+ *   Allow as many open descriptors as the hard limit permits, so that
+ *   thousands of concurrent collectors can be served.
+ */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+            perror("setrlimit");
     }
+}
 
-    /* Convert the client socket descriptor into a FILE stream
-     * so that we can use our ifshow functions which print to a stream.
-     */
-    FILE *stream = fdopen(client_fd, "w");
-    if (stream == NULL) {
-        perror("fdopen");
-        return;
+/*
+ * add_listen_addr:
+ *   Resolve an -a argument (an address or a host name) and add every local
+ *   address it stands for. Returns 0, or -1 on error (reported on stderr).
+ */
+static int add_listen_addr(struct listen_addrs *addrs, const char *host) {
+    char port[8];
+    snprintf(port, sizeof(port), "%d", SERVER_PORT);
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+    for (struct addrinfo *ai = res; ai != NULL; ai = ai->ai_next) {
+        if (addrs->count == AGENT_MAX_LISTENERS) {
+            fprintf(stderr, "Too many listening addresses (at most %d)\n", AGENT_MAX_LISTENERS);
+            freeaddrinfo(res);
+            return -1;
+        }
+        memcpy(&addrs->addr[addrs->count], ai->ai_addr, ai->ai_addrlen);
+        addrs->len[addrs->count++] = ai->ai_addrlen;
     }
+    freeaddrinfo(res);
+    return 0;
+}
 
-    if (is_all) {
-        show_all_interfaces(stream);
+/*
+ * default_listen_addr:
+ *   The wildcard address: IPv6 (dual-stack) unless the host has no IPv6.
+ */
+static void default_listen_addr(struct listen_addrs *addrs) {
+    memset(&addrs->addr[0], 0, sizeof(addrs->addr[0]));
+    int fd = socket(AF_INET6, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0) {
+        close(fd);
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &addrs->addr[0];
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_addr = in6addr_any;
+        sin6->sin6_port = htons(SERVER_PORT);
+        addrs->len[0] = sizeof(*sin6);
     } else {
-        show_interface_by_name(ifname, stream);
+        struct sockaddr_in *sin = (struct sockaddr_in *) &addrs->addr[0];
+        sin->sin_family = AF_INET;
+        sin->sin_addr.s_addr = INADDR_ANY;
+        sin->sin_port = htons(SERVER_PORT);
+        addrs->len[0] = sizeof(*sin);
     }
-
-    fflush(stream);
-    /* Note: Do not fclose(stream) here if you do not want to close client_fd automatically.
-     * In this example, we will let the main loop close the socket.
-     */
+    addrs->count = 1;
 }
 
-int main() {
-    int sockfd, client_fd;
-    struct sockaddr_in serv_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+/*
+ * create_listener:
+ *   Create a TCP socket listening on addr. An IPv6 socket also accepts IPv4
+ *   clients unless v6only is set (explicit -a addresses, which must not
+ *   clash with an IPv4 address given next to them).
+ *   With SO_REUSEPORT every worker gets its own socket on the same port and
+ *   the kernel spreads incoming connections between them.
+ */
+static int create_listener(const struct sockaddr *addr, socklen_t len, int v6only, int backlog) {
+    int sockfd;
 
     /* Create a TCP socket. */
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
+    if ((sockfd = socket(addr->sa_family, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
         perror("socket");
-        exit(EXIT_FAILURE);
+        return -1;
     }
 
-    /* Allow immediate reuse of the port. */
+    /* Allow immediate reuse of the port, and one socket per worker. */
     int opt = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0) {
+    if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0 ||
+        setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(opt)) < 0) {
         perror("setsockopt");
-        exit(EXIT_FAILURE);
+        close(sockfd);
+        return -1;
+    }
+    if (addr->sa_family == AF_INET6 &&
+        setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+        perror("setsockopt IPV6_V6ONLY");
+        close(sockfd);
+        return -1;
     }
 
-    /* Bind the socket to all local interfaces on SERVER_PORT. */
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = INADDR_ANY;
-    serv_addr.sin_port = htons(SERVER_PORT);
-
-    if (bind(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
+    if (bind(sockfd, addr, len) < 0) {
         perror("bind");
-        exit(EXIT_FAILURE);
+        close(sockfd);
+        return -1;
     }
 
     /* Listen for incoming connections. */
-    if (listen(sockfd, 5) < 0) {
+    if (listen(sockfd, backlog) < 0) {
         perror("listen");
-        exit(EXIT_FAILURE);
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static unsigned long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static long long monotonic_ms(void) {
+    return (long long)(monotonic_ns() / 1000000);
+}
+
+/*
+ * run_updater:
+ *   Main thread loop: apply interface notifications to the table, publish a
+ *   freshly rendered view to the workers whenever its generation changes, and
+ *   reclaim the views they no longer use. current is a reference to the last
+ *   published view, from which the next one inherits its delta history.
+ *   Every stats_ms (if not 0) the counters are refreshed, sampled into the
+ *   rate table rates, and a view of the same generation is published with
+ *   them. rates is rebuilt whenever the generation changes, as the set of
+ *   interfaces may have changed.
+ *   Scrapes of the metrics endpoint metrics_fd (if not -1) are answered
+ *   from metrics.
+ */
+static int run_updater(struct iface_cache *cache, struct shared_view *shared,
+                       struct response_cache *current, struct rate_table *rates,
+                       int stats_ms, int metrics_fd, struct agent_metrics_set *metrics) {
+    unsigned long long published = cache->generation;
+    long long next_stats = monotonic_ms() + stats_ms;
+    long long next_reload = monotonic_ms() + FALLBACK_RELOAD_MS;
+
+    for (;;) {
+        int timeout = -1;
+        if (cache->nl_fd < 0) {
+            long long left = next_reload - monotonic_ms();
+            timeout = left > 0 ? (int) left : 0;
+        }
+        if (shared->retired != NULL && (timeout < 0 || timeout > RECLAIM_INTERVAL_MS))
+            timeout = RECLAIM_INTERVAL_MS;
+        if (stats_ms > 0) {
+            long long left = next_stats - monotonic_ms();
+            if (left < 0)
+                left = 0;
+            if (timeout < 0 || timeout > left)
+                timeout = (int) left;
+        }
+
+        struct pollfd pfd[2];
+        pfd[0].fd = cache->nl_fd;
+        pfd[0].events = POLLIN;
+        pfd[0].revents = 0;
+        pfd[1].fd = metrics_fd;           /* ignored by poll() when -1 */
+        pfd[1].events = POLLIN;
+        pfd[1].revents = 0;
+        if (poll(pfd, 2, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return -1;
+        }
+
+        if (pfd[1].revents & POLLIN)
+            metrics_http_serve(metrics_fd, agent_metrics_write_prom, metrics);
+
+        if (cache->nl_fd < 0) {
+            /* Without notifications the whole table, counters included, is
+             * reloaded every FALLBACK_RELOAD_MS and for every counter sample. */
+            long long now = monotonic_ms();
+            if (now >= next_reload || (stats_ms > 0 && now >= next_stats)) {
+                iface_cache_get(cache);
+                next_reload = now + FALLBACK_RELOAD_MS;
+            }
+        } else if (pfd[0].revents & POLLIN) {
+            iface_cache_process(cache);
+        }
+
+        if (rates != NULL && cache->generation != published) {
+            struct rate_table *rt = rate_table_build(&cache->snap, rates);
+            if (rt != NULL) {
+                rate_table_release(rates);
+                rates = rt;
+            }
+        }
+
+        /* Counters only go to the rate rings: the view is not rebuilt for them. */
+        if (stats_ms > 0 && monotonic_ms() >= next_stats) {
+            /* Time the sample at the middle of the dump that read it. */
+            unsigned long long start = monotonic_ns();
+            int refreshed = iface_cache_refresh_stats(cache) == 0;
+            unsigned long long end = monotonic_ns();
+            if (refreshed && rates != NULL)
+                rate_table_record(rates, &cache->snap, start + (end - start) / 2);
+            next_stats = (long long)(end / 1000000) + stats_ms;
+        }
+
+        if (cache->generation != published) {
+            struct response_cache *rc = response_cache_build(&cache->snap, cache->epoch,
+                                                             cache->generation, current, rates);
+            if (rc != NULL) {
+                response_cache_release(current);
+                current = response_cache_hold(rc);
+                shared_view_publish(shared, rc);
+                LOG(LOG_LEVEL_INFO, log_table, "Interface table changed (generation %llu)",
+                    cache->generation);
+                published = cache->generation;
+            }
+        }
+        shared_view_reclaim(shared);
     }
+}
 
-    printf("Agent server listening on port %d...\n", SERVER_PORT);
+int main(int argc, char *argv[]) {
+    int backlog = SOMAXCONN;
+    int workers = 1;
+    int stats_ms = STATS_INTERVAL_MS;
+    int metrics_port = 0;
+    int log_level = LOG_LEVEL_INFO;
+    struct listen_addrs addrs;
+    addrs.count = 0;
 
-    /* Main loop: accept and process client connections. */
-    while (1) {
-        client_fd = accept(sockfd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0) {
-            perror("accept");
-            continue;
+    // Parse command-line arguments.
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if (add_listen_addr(&addrs, argv[++i]) < 0)
+                exit(EXIT_FAILURE);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            backlog = atoi(argv[++i]);
+            if (backlog < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+            if (workers < 1 || workers > MAX_WORKERS)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            stats_ms = atoi(argv[++i]);
+            if (stats_ms < 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            metrics_port = atoi(argv[++i]);
+            if (metrics_port < 1 || metrics_port > 65535)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            log_level = log_level_parse(argv[++i]);
+            if (log_level < 0)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
         }
+    }
 
-        /* Optionally, print the client's IP address. */
-        char client_ip[INET_ADDRSTRLEN];
-        inet_ntop(AF_INET, &client_addr.sin_addr, client_ip, sizeof(client_ip));
-        printf("Accepted connection from %s:%d\n", client_ip, ntohs(client_addr.sin_port));
-
-        /* Read the client's request. */
-        char buffer[BUFFER_SIZE];
-        memset(buffer, 0, BUFFER_SIZE);
-        int n = read(client_fd, buffer, BUFFER_SIZE - 1);
-        if (n < 0) {
-            perror("read");
-            close(client_fd);
-            continue;
+    int dual_stack = addrs.count == 0;
+    if (dual_stack)
+        default_listen_addr(&addrs);
+
+    raise_fd_limit();
+    if (log_ring_start((enum log_level) log_level, stdout) < 0)
+        exit(EXIT_FAILURE);
+
+    /* Load the interface table and subscribe to its changes. */
+    struct iface_cache cache;
+    if (iface_cache_open(&cache) < 0) {
+        fprintf(stderr, "Error retrieving interface information.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Counter samples for RATES, taken at every refresh of the counters. */
+    struct rate_table *rates = NULL;
+    if (stats_ms > 0) {
+        rates = rate_table_build(&cache.snap, NULL);
+        if (rates == NULL) {
+            fprintf(stderr, "Memory allocation error.\n");
+            exit(EXIT_FAILURE);
         }
+        rate_table_record(rates, &cache.snap, monotonic_ns());
+    }
 
-        process_request(client_fd, buffer);
+    struct response_cache *first = response_cache_build(&cache.snap, cache.epoch,
+                                                        cache.generation, NULL, rates);
+    struct shared_view shared;
+    if (first == NULL || shared_view_init(&shared, (size_t) workers, first) < 0) {
+        fprintf(stderr, "Memory allocation error.\n");
+        exit(EXIT_FAILURE);
+    }
 
-        close(client_fd);
+    /* Listening sockets, an event loop and a set of metrics per worker thread. */
+    struct agent_server *servers = calloc((size_t) workers, sizeof(struct agent_server));
+    struct agent_metrics_set metrics;
+    if (servers == NULL || agent_metrics_init(&metrics, (size_t) workers) < 0) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    int metrics_fd = -1;
+    if (metrics_port > 0 && (metrics_fd = metrics_http_listen(metrics_port)) < 0)
+        exit(EXIT_FAILURE);
+    for (int i = 0; i < workers; i++) {
+        int listen_fds[AGENT_MAX_LISTENERS];
+        for (size_t j = 0; j < addrs.count; j++) {
+            listen_fds[j] = create_listener((struct sockaddr *) &addrs.addr[j], addrs.len[j],
+                                            !dual_stack, backlog);
+            if (listen_fds[j] < 0)
+                exit(EXIT_FAILURE);
+        }
+        if (agent_server_init(&servers[i], listen_fds, addrs.count, &shared, &shared.readers[i],
+                              &metrics, (size_t) i) < 0 ||
+            agent_server_start(&servers[i]) < 0)
+            exit(EXIT_FAILURE);
     }
 
-    close(sockfd);
-    return 0;
+    char where[AGENT_MAX_LISTENERS * (NI_MAXHOST + 4)] = "";
+    if (dual_stack) {
+        snprintf(where, sizeof(where), "%s",
+                 addrs.addr[0].ss_family == AF_INET6 ? "IPv6 and IPv4" : "IPv4 only");
+    } else {
+        for (size_t j = 0; j < addrs.count; j++) {
+            char host[NI_MAXHOST];
+            if (getnameinfo((struct sockaddr *) &addrs.addr[j], addrs.len[j], host, sizeof(host),
+                            NULL, 0, NI_NUMERICHOST) != 0)
+                strcpy(host, "?");
+            size_t used = strlen(where);
+            snprintf(where + used, sizeof(where) - used, "%s%s", j > 0 ? ", " : "", host);
+        }
+    }
+    printf("Agent server listening on port %d, %s (backlog %d, %d worker%s)...\n",
+           SERVER_PORT, where, backlog, workers, workers > 1 ? "s" : "");
+    if (metrics_fd >= 0)
+        printf("Metrics on http://127.0.0.1:%d/metrics\n", metrics_port);
+
+    /* Main loop: keep the interface table fresh for the workers. */
+    int ret = run_updater(&cache, &shared, response_cache_hold(first), rates, stats_ms,
+                          metrics_fd, &metrics);
+
+    /* The updater only returns on fatal errors; the workers die with the process. */
+    iface_cache_close(&cache);
+    log_ring_stop();
+    return ret < 0 ? EXIT_FAILURE : 0;
 }
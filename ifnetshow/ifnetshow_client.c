@@ -1,47 +1,439 @@
 /*
  * ifnetshow_client.c
  *
- * This is the client program that connects to a remote machine (specified by its IP address)
- * and requests network interface information from the persistent agent.
+ * This is the client program that connects to a remote machine (specified by its IPv4 or
+ * IPv6 address or its host name) and requests network interface information from the
+ * persistent agent. Names are resolved for both families at once and the connection
+ * attempts race, IPv6 first (see dial.h).
  *
  * Usage:
  *   ifnetshow -n <addr> -i <ifname>   (to list the IPv4/IPv6 prefixes for the specified interface)
  *   ifnetshow -n <addr> -a             (to list all network interfaces and their IPv4/IPv6 prefixes)
+ *   add -l for the link state, flags, MTU and hardware address of the
+ *   interfaces, -s for their rx/tx counters (both list interfaces without
+ *   addresses too)
+ *
+ * Fleet mode: -n may be repeated and may name a CIDR block (-n 10.0.0.0/24,
+ * -n 2001:db8::/120), and -f <file> reads targets from a file (one per line).
+ * Host names are resolved once, up front, to their preferred address. With more than one
+ * target every agent is queried concurrently (see fanout.c) and each answer
+ * is printed under a "[<addr>]" line as soon as it arrives.
+ *   -c <n>             at most <n> targets in flight (default 256)
+ *   -t <sec>           per-target timeout (default 3, fractions allowed)
+ *
+ * Options:
+ *   --interval <sec>   repeat the request every <sec> seconds (fractions allowed)
+ *   --count <n>        stop after <n> requests (default: 1, or unlimited with --interval)
+ *   --keepalive        send every request over one persistent protocol 2
+ *                      connection instead of one connection per request; falls
+ *                      back to one connection per request with older agents
+ *   --binary           ask for the compact binary answer (implies --keepalive)
+ *                      and render it locally; falls back to text with older agents
+ *   --raw              with --binary, write the binary answer as received
+ *   --watch            subscribe to the agent (SUBSCRIBE): print the whole
+ *                      table once, then every change as it happens; on a lost
+ *                      connection, reconnect and resume where it stopped
  *
  * Compile with:
- *     gcc ifnetshow_client.c -o ifnetshow
+ *     gcc -pthread ifnetshow_client.c fanout.c dial.c ifshow.c ifshow_snapshot.c ifshow_netlink.c ifshow_render.c -o ifnetshow
  */
 
+#include "ifshow.h"
+#include "ifnetshow.h"
+#include "fanout.h"
+#include "dial.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 
-#define SERVER_PORT 12345
 #define BUFFER_SIZE 1024
 
+/* Time given to resolving the agent's name and connecting to it. */
+#define CONNECT_TIMEOUT_MS 10000
+
+#define FANOUT_CONCURRENCY 256
+#define FANOUT_TIMEOUT     3.0
+
+/* Reconnection delay of --watch, doubled after each failure up to the max. */
+#define WATCH_RETRY_MIN 1
+#define WATCH_RETRY_MAX 30
+
 /* usage:
  * Prints the correct command-line usage and exits.
  */
 void usage(const char *progname) {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  %s -n <addr> -i <ifname>\n", progname);
-    fprintf(stderr, "  %s -n <addr> -a\n", progname);
+    fprintf(stderr, "  %s -n <addr> -i <ifname> [-l] [-s] [--interval <sec>] [--count <n>]"
+                    " [--keepalive] [--binary [--raw]]\n", progname);
+    fprintf(stderr, "  %s -n <addr> -a [-l] [-s] [--interval <sec>] [--count <n>] [--keepalive]"
+                    " [--binary [--raw]]\n", progname);
+    fprintf(stderr, "  %s -n <addr> -a | -i <ifname> -r [--history] [--interval <sec>] [--count <n>]"
+                    " [--keepalive]\n", progname);
+    fprintf(stderr, "  %s -n <addr> --watch\n", progname);
+    fprintf(stderr, "  %s -n <addr|name|cidr> [-n ...] [-f <file>] [-c <n>] [-t <sec>] -a | -i <ifname>"
+                    " [-l] [-s]\n", progname);
     exit(EXIT_FAILURE);
 }
 
+/*
+ * connect_agent:
+ *   Open a TCP connection to the agent, an IPv6 or IPv4 address or a host
+ *   name, racing the address families (see dial.h). Returns the socket, or -1.
+ */
+static int connect_agent(const char *remote_addr) {
+    return dial_connect(remote_addr, SERVER_PORT, CONNECT_TIMEOUT_MS);
+}
+
+static int write_full(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/* read_full: returns 0 once len bytes were read, -1 on error or end of stream. */
+static int read_full(int fd, void *buf, size_t len) {
+    char *p = buf;
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= (size_t) n;
+    }
+    return 0;
+}
+
+/*
+ * query_once:
+ *   Protocol 1: one connection, one command, answer until the agent closes.
+ */
+static int query_once(const char *remote_addr, const char *command) {
+    int sockfd = connect_agent(remote_addr);
+    if (sockfd < 0)
+        return -1;
+
+    // Send the command to the agent.
+    if (write_full(sockfd, command, strlen(command)) < 0) {
+        perror("write");
+        close(sockfd);
+        return -1;
+    }
+
+    // Read the response from the agent and display it.
+    char buffer[BUFFER_SIZE];
+    ssize_t n;
+    while ((n = read(sockfd, buffer, BUFFER_SIZE - 1)) > 0) {
+        buffer[n] = '\0';
+        printf("%s", buffer);
+    }
+    if (n < 0) {
+        perror("read");
+    }
+    fflush(stdout);
+
+    close(sockfd);
+    return n < 0 ? -1 : 0;
+}
+
+/*
+ * open_keepalive:
+ *   Connect and negotiate protocol 2. Returns the socket, -1 on error, or
+ *   -2 if the agent only speaks protocol 1.
+ */
+static int open_keepalive(const char *remote_addr) {
+    int sockfd = connect_agent(remote_addr);
+    if (sockfd < 0)
+        return -1;
+    if (write_full(sockfd, IFN_HELLO, strlen(IFN_HELLO)) < 0) {
+        perror("write");
+        close(sockfd);
+        return -1;
+    }
+
+    /* Read the one-line answer to the hello. */
+    char line[64];
+    size_t len = 0;
+    while (len < sizeof(line) - 1) {
+        ssize_t n = read(sockfd, line + len, 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        if (line[len++] == '\n')
+            break;
+    }
+    line[len] = '\0';
+    if (strcmp(line, IFN_HELLO_OK) != 0) {
+        close(sockfd);
+        return -2;
+    }
+    return sockfd;
+}
+
+/*
+ * print_binary:
+ *   Render a binary answer (see ifshow_render.h) as the agent would have in text:
+ *   the records are loaded into a snapshot, which is printed with the ifshow
+ *   text renderer and the details the answer carries. ifname is NULL for an
+ *   ALL answer. Returns 0, or -1 if the answer is malformed.
+ */
+static int print_binary(const unsigned char *body, size_t len, const char *ifname) {
+    struct ifshow_bin_header hdr;
+    if (len < sizeof(hdr))
+        return -1;
+    memcpy(&hdr, body, sizeof(hdr));
+    if (ntohl(hdr.magic) != IFSHOW_BIN_MAGIC || ntohs(hdr.version) != IFSHOW_BIN_VERSION)
+        return -1;
+    unsigned int detail = ntohs(hdr.detail);
+    uint32_t iface_count = ntohl(hdr.iface_count);
+    size_t off = sizeof(hdr);
+
+    struct ifshow_snapshot snap;
+    ifshow_snapshot_init(&snap);
+    int ret = -1;
+    for (uint32_t i = 0; i < iface_count; i++) {
+        struct ifshow_bin_iface rec;
+        if (len - off < sizeof(rec))
+            goto out;
+        memcpy(&rec, body + off, sizeof(rec));
+        off += sizeof(rec);
+
+        struct ifshow_iface iface;
+        memset(&iface, 0, sizeof(iface));
+        iface.ifindex = ntohl(rec.ifindex);
+        memcpy(iface.name, rec.name, sizeof(iface.name) - 1);
+        if (detail & IFSHOW_DETAIL_LINK) {
+            struct ifshow_bin_link l;
+            if (len - off < sizeof(l))
+                goto out;
+            memcpy(&l, body + off, sizeof(l));
+            off += sizeof(l);
+            iface.link.flags = ntohl(l.flags);
+            iface.link.mtu = ntohl(l.mtu);
+            iface.link.type = ntohs(l.type);
+            iface.link.operstate = l.operstate;
+            iface.link.hwaddr_len = l.hwaddr_len;
+            memcpy(iface.link.hwaddr, l.hwaddr, sizeof(iface.link.hwaddr));
+        }
+        if (detail & IFSHOW_DETAIL_STATS) {
+            struct ifshow_bin_stats st;
+            if (len - off < sizeof(st))
+                goto out;
+            memcpy(&st, body + off, sizeof(st));
+            off += sizeof(st);
+            iface.stats.rx_bytes = be64toh(st.rx_bytes);
+            iface.stats.rx_packets = be64toh(st.rx_packets);
+            iface.stats.rx_errors = be64toh(st.rx_errors);
+            iface.stats.rx_dropped = be64toh(st.rx_dropped);
+            iface.stats.tx_bytes = be64toh(st.tx_bytes);
+            iface.stats.tx_packets = be64toh(st.tx_packets);
+            iface.stats.tx_errors = be64toh(st.tx_errors);
+            iface.stats.tx_dropped = be64toh(st.tx_dropped);
+        }
+        if (ifshow_snapshot_add_iface(&snap, &iface) < 0)
+            goto out;
+
+        uint32_t addr_count = ntohl(rec.addr_count);
+        if ((len - off) / sizeof(struct ifshow_bin_addr) < addr_count)
+            goto out;
+        for (uint32_t j = 0; j < addr_count; j++) {
+            struct ifshow_bin_addr a;
+            memcpy(&a, body + off, sizeof(a));
+            off += sizeof(a);
+            struct ifshow_addr addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.ifindex = iface.ifindex;
+            addr.family = a.family == IFSHOW_BIN_FAMILY_INET ? AF_INET : AF_INET6;
+            addr.prefix = a.prefix;
+            memcpy(addr.addr, a.addr, sizeof(addr.addr));
+            if (ifshow_snapshot_add_addr(&snap, &addr) < 0)
+                goto out;
+        }
+    }
+    if (ifshow_snapshot_finalize(&snap) < 0)
+        goto out;
+    snap.generation = be64toh(hdr.generation);
+    ret = ifshow_snapshot_print(&snap, &ifshow_text_renderer, ifname, detail, stdout);
+
+out:
+    ifshow_snapshot_free(&snap);
+    return ret;
+}
+
+/*
+ * query_framed:
+ *   Protocol 2: send one request frame and print the answer frame. With
+ *   binary set, the binary answer is requested and rendered locally (or
+ *   written as is when raw is set); ifname is the interface of an IFNAME
+ *   request, NULL for ALL.
+ */
+static int query_framed(int sockfd, const char *command, int binary, int raw,
+                        const char *ifname) {
+    unsigned char hdr[IFN_FRAME_HDR_LEN];
+    size_t len = strlen(command);
+    ifn_frame_pack(hdr, (uint32_t) len, IFN_MSG_REQUEST, binary ? IFN_FLAG_BINARY : 0);
+    if (write_full(sockfd, hdr, sizeof(hdr)) < 0 || write_full(sockfd, command, len) < 0) {
+        perror("write");
+        return -1;
+    }
+
+    uint32_t body_len;
+    uint16_t type, flags;
+    if (read_full(sockfd, hdr, sizeof(hdr)) < 0) {
+        fprintf(stderr, "Connection to the agent lost.\n");
+        return -1;
+    }
+    ifn_frame_unpack(hdr, &body_len, &type, &flags);
+
+    if (type == IFN_MSG_RESPONSE && (flags & IFN_FLAG_BINARY) && !raw) {
+        unsigned char *body = malloc(body_len ? body_len : 1);
+        if (body == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        if (read_full(sockfd, body, body_len) < 0) {
+            fprintf(stderr, "Connection to the agent lost.\n");
+            free(body);
+            return -1;
+        }
+        int ret = print_binary(body, body_len, ifname);
+        free(body);
+        fflush(stdout);
+        if (ret < 0)
+            fprintf(stderr, "Malformed binary answer.\n");
+        return ret;
+    }
+
+    FILE *out = type == IFN_MSG_RESPONSE ? stdout : stderr;
+    char buffer[BUFFER_SIZE];
+    while (body_len > 0) {
+        size_t chunk = body_len < sizeof(buffer) ? body_len : sizeof(buffer);
+        if (read_full(sockfd, buffer, chunk) < 0) {
+            fprintf(stderr, "Connection to the agent lost.\n");
+            return -1;
+        }
+        fwrite(buffer, 1, chunk, out);
+        body_len -= (uint32_t) chunk;
+    }
+    fflush(out);
+    return 0;
+}
+
+/*
+ * watch_once:
+ *   One SUBSCRIBE connection: print every message until the connection is
+ *   lost. *epoch and *seq track the last complete message, so that the next
+ *   connection resumes from it (both 0 before the first one).
+ *   Returns 1 if messages were received, 0 if the connection failed before
+ *   that, or -1 if the agent does not support subscriptions.
+ */
+static int watch_once(const char *remote_addr, unsigned long long *epoch,
+                      unsigned long long *seq) {
+    int sockfd = connect_agent(remote_addr);
+    if (sockfd < 0)
+        return 0;
+
+    char command[64];
+    if (*epoch != 0)
+        snprintf(command, sizeof(command), "SUBSCRIBE %llx %llu", *epoch, *seq);
+    else
+        strcpy(command, "SUBSCRIBE");
+    if (write_full(sockfd, command, strlen(command)) < 0) {
+        perror("write");
+        close(sockfd);
+        return 0;
+    }
+
+    FILE *in = fdopen(sockfd, "r");
+    if (in == NULL) {
+        perror("fdopen");
+        close(sockfd);
+        return 0;
+    }
+    char line[256];
+    unsigned long long msg_epoch = 0, msg_seq = 0, from;
+    int received = 0;
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if (sscanf(line, "SNAPSHOT %llx %llu", &msg_epoch, &msg_seq) == 2 ||
+            sscanf(line, "DELTA %llx %llu %llu", &msg_epoch, &from, &msg_seq) == 3) {
+            received = 1;
+        } else if (!received) {
+            /* An older agent answers "Unknown command." and closes. */
+            fprintf(stderr, "%s", line);
+            fclose(in);
+            return -1;
+        } else if (strcmp(line, "END\n") == 0) {
+            *epoch = msg_epoch;
+            *seq = msg_seq;
+        }
+        fputs(line, stdout);
+        if (strcmp(line, "END\n") == 0)
+            fflush(stdout);
+    }
+    fclose(in);
+    return received;
+}
+
+/* Sleep until the absolute CLOCK_MONOTONIC time *next, then advance it. */
+static void wait_interval(struct timespec *next, double interval) {
+    long long ns = next->tv_nsec + (long long)(interval * 1e9);
+    next->tv_sec += (time_t)(ns / 1000000000LL);
+    next->tv_nsec = (long)(ns % 1000000000LL);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, next, NULL) == EINTR)
+        ;
+}
+
 int main(int argc, char *argv[]) {
     char *remote_addr = NULL;
     char *ifname = NULL;
     int list_all = 0;
+    int link_details = 0;
+    int stats = 0;
+    int rates = 0;
+    int history = 0;
+    int keepalive = 0;
+    int binary = 0;
+    int raw = 0;
+    int watch = 0;
+    double interval = 0;
+    long count = -1;
+    struct fanout_targets targets;
+    int target_specs = 0;
+    const char **names;         /* -n host names, resolved in fleet mode */
+    int name_count = 0;
+    int concurrency = FANOUT_CONCURRENCY;
+    double timeout = FANOUT_TIMEOUT;
+
+    fanout_targets_init(&targets);
+    names = calloc((size_t) argc, sizeof(*names));
+    if (names == NULL) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
 
     // The expected command-line options are:
-    //   -n <addr> (remote agent IP address)
+    //   -n <addr> (remote agent address or name), -f <file> (fleet mode)
     //   -i <ifname> or -a
-    if (argc < 4) {
+    if (argc < 3) {
         usage(argv[0]);
     }
 
@@ -54,6 +446,26 @@ int main(int argc, char *argv[]) {
             } else {
                 usage(argv[0]);
             }
+            if (fanout_add_target(&targets, remote_addr) < 0) {
+                if (strchr(remote_addr, '/') != NULL) {
+                    fprintf(stderr, "Invalid target '%s'\n", remote_addr);
+                    exit(EXIT_FAILURE);
+                }
+                names[name_count++] = remote_addr;
+            }
+            target_specs++;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            if (fanout_add_file(&targets, argv[++i]) < 0)
+                exit(EXIT_FAILURE);
+            target_specs += 2;    /* a file always means fleet mode */
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            concurrency = atoi(argv[++i]);
+            if (concurrency < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            timeout = atof(argv[++i]);
+            if (timeout <= 0)
+                usage(argv[0]);
         } else if (strcmp(argv[i], "-i") == 0) {
             if (i + 1 < argc) {
                 ifname = argv[i + 1];
@@ -63,15 +475,63 @@ int main(int argc, char *argv[]) {
             }
         } else if (strcmp(argv[i], "-a") == 0) {
             list_all = 1;
+        } else if (strcmp(argv[i], "-l") == 0) {
+            link_details = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            stats = 1;
+        } else if (strcmp(argv[i], "-r") == 0) {
+            rates = 1;
+        } else if (strcmp(argv[i], "--history") == 0) {
+            history = 1;
+        } else if (strcmp(argv[i], "--keepalive") == 0) {
+            keepalive = 1;
+        } else if (strcmp(argv[i], "--binary") == 0) {
+            binary = 1;
+            keepalive = 1;
+        } else if (strcmp(argv[i], "--raw") == 0) {
+            raw = 1;
+        } else if (strcmp(argv[i], "--watch") == 0) {
+            watch = 1;
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = atof(argv[++i]);
+            if (interval <= 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = atol(argv[++i]);
+            if (count < 1)
+                usage(argv[0]);
         } else {
             usage(argv[0]);
         }
     }
 
     // Ensure that a remote address is provided.
-    if (remote_addr == NULL) {
+    if (target_specs == 0) {
         usage(argv[0]);
     }
+    int single = target_specs == 1 && targets.total + (uint64_t) name_count == 1;
+    // --watch follows the whole table of a single agent.
+    if (watch) {
+        if (!single || list_all || ifname != NULL ||
+            keepalive || interval > 0 || link_details || stats || rates || history)
+            usage(argv[0]);
+        fanout_targets_free(&targets);
+        free(names);
+        unsigned long long epoch = 0, seq = 0;
+        int delay = WATCH_RETRY_MIN;
+        for (;;) {
+            int ret = watch_once(remote_addr, &epoch, &seq);
+            if (ret < 0)
+                return EXIT_FAILURE;
+            if (ret > 0)
+                delay = WATCH_RETRY_MIN;
+            fprintf(stderr, "Connection to the agent lost, reconnecting in %d s...\n", delay);
+            sleep((unsigned int) delay);
+            if (ret == 0 && delay < WATCH_RETRY_MAX)
+                delay = delay * 2 < WATCH_RETRY_MAX ? delay * 2 : WATCH_RETRY_MAX;
+        }
+    }
+
     // Must specify either -i or -a (but not both).
     if (list_all == 0 && ifname == NULL) {
         usage(argv[0]);
@@ -79,56 +539,96 @@ int main(int argc, char *argv[]) {
     if (list_all == 1 && ifname != NULL) {
         usage(argv[0]);
     }
-
-    // Create a TCP socket.
-    int sockfd;
-    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
-        perror("socket");
-        exit(EXIT_FAILURE);
-    }
-
-    // Set up the remote server address structure.
-    struct sockaddr_in serv_addr;
-    memset(&serv_addr, 0, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(SERVER_PORT);
-    if (inet_pton(AF_INET, remote_addr, &serv_addr.sin_addr) <= 0) {
-        perror("inet_pton");
-        exit(EXIT_FAILURE);
+    if (raw && !binary) {
+        usage(argv[0]);
     }
-
-    // Connect to the remote agent.
-    if (connect(sockfd, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) {
-        perror("connect");
-        exit(EXIT_FAILURE);
+    // Rates are computed by the agent and only exist as text.
+    if ((history && !rates) || (rates && (link_details || stats || binary))) {
+        usage(argv[0]);
     }
+    // Without --interval a single request is sent; with it, run until --count.
+    if (count < 0)
+        count = interval > 0 ? 0 : 1;
 
     // Build the command string to send to the agent.
     char command[256];
     memset(command, 0, sizeof(command));
-    if (list_all) {
+    if (rates) {
+        if (list_all)
+            strcpy(command, "RATES");
+        else
+            snprintf(command, sizeof(command), "RATES %s", ifname);
+        if (history)
+            strncat(command, " HISTORY", sizeof(command) - strlen(command) - 1);
+    } else if (list_all) {
         strcpy(command, "ALL");
     } else {
         snprintf(command, sizeof(command), "IFNAME %s", ifname);
     }
+    if (link_details)
+        strncat(command, " LINK", sizeof(command) - strlen(command) - 1);
+    if (stats)
+        strncat(command, " STATS", sizeof(command) - strlen(command) - 1);
 
-    // Send the command to the agent.
-    if (write(sockfd, command, strlen(command)) < 0) {
-        perror("write");
-        exit(EXIT_FAILURE);
+    // Several targets (or a CIDR block): query the whole fleet at once.
+    if (!single) {
+        if (keepalive || interval > 0)
+            usage(argv[0]);
+        for (int i = 0; i < name_count; i++) {
+            if (fanout_add_name(&targets, names[i]) < 0)
+                exit(EXIT_FAILURE);
+        }
+        free(names);
+        struct fanout_options opts;
+        opts.command = command;
+        opts.timeout_ms = (int)(timeout * 1000);
+        opts.concurrency = concurrency;
+        long failed = fanout_run(&targets, &opts);
+        fanout_targets_free(&targets);
+        return failed == 0 ? 0 : EXIT_FAILURE;
     }
+    fanout_targets_free(&targets);
+    free(names);
 
-    // Read the response from the agent and display it.
-    char buffer[BUFFER_SIZE];
-    int n;
-    while ((n = read(sockfd, buffer, BUFFER_SIZE - 1)) > 0) {
-        buffer[n] = '\0';
-        printf("%s", buffer);
-    }
-    if (n < 0) {
-        perror("read");
+    int sockfd = -1;
+    int failures = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    for (long done = 0; count == 0 || done < count; done++) {
+        if (done > 0)
+            wait_interval(&next, interval);
+
+        int ret;
+        if (keepalive) {
+            if (sockfd < 0)
+                sockfd = open_keepalive(remote_addr);
+            if (sockfd == -2) {
+                fprintf(stderr, "Agent does not support persistent connections, "
+                                "using one connection per request%s.\n",
+                        binary ? " and text answers" : "");
+                binary = 0;
+                keepalive = 0;
+                sockfd = -1;
+                ret = query_once(remote_addr, command);
+            } else if (sockfd < 0) {
+                ret = -1;
+            } else {
+                ret = query_framed(sockfd, command, binary, raw, ifname);
+                if (ret < 0) {
+                    /* Reconnect on the next request. */
+                    close(sockfd);
+                    sockfd = -1;
+                }
+            }
+        } else {
+            ret = query_once(remote_addr, command);
+        }
+        if (ret < 0)
+            failures++;
     }
 
-    close(sockfd);
-    return 0;
+    if (sockfd >= 0)
+        close(sockfd);
+    return failures > 0 && count == 1 ? EXIT_FAILURE : 0;
 }
@@ -0,0 +1,184 @@
+/*
+ * rate_sampler.c
+ *
+ * Per-interface history of counter samples, from which the agent computes
+ * throughput itself instead of leaving collectors to diff counters they
+ * scraped at jittery times (see rate_sampler.h).
+ */
+
+#include "rate_sampler.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct rate_table *rate_table_build(const struct ifshow_snapshot *snap,
+                                    const struct rate_table *prev) {
+    struct rate_table *rt = calloc(1, sizeof(*rt));
+    if (rt == NULL)
+        return NULL;
+    atomic_init(&rt->refs, 1);
+    rt->rings = calloc(snap->iface_count ? snap->iface_count : 1, sizeof(struct rate_ring));
+    if (rt->rings == NULL) {
+        free(rt);
+        return NULL;
+    }
+    rt->ring_count = snap->iface_count;
+
+    /* Both lists are sorted by ifindex: carry the old rings over in one merge. */
+    size_t j = 0;
+    for (size_t i = 0; i < snap->iface_count; i++) {
+        struct rate_ring *ring = &rt->rings[i];
+        ring->ifindex = snap->ifaces[i].ifindex;
+        atomic_init(&ring->seq, 0);
+        while (prev != NULL && j < prev->ring_count && prev->rings[j].ifindex < ring->ifindex)
+            j++;
+        if (prev != NULL && j < prev->ring_count && prev->rings[j].ifindex == ring->ifindex) {
+            /* prev is only written by the caller's thread, so no lock is needed. */
+            ring->count = prev->rings[j].count;
+            memcpy(ring->samples, prev->rings[j].samples, sizeof(ring->samples));
+        }
+    }
+    return rt;
+}
+
+/*
+ * ring_push:
+ *   Write one sample under the sequence lock.
+ */
+static void ring_push(struct rate_ring *ring, const struct ifshow_stats *stats,
+                      unsigned long long t_ns) {
+    unsigned int seq = atomic_load_explicit(&ring->seq, memory_order_relaxed);
+    atomic_store_explicit(&ring->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    struct rate_sample *s = &ring->samples[ring->count % RATE_HISTORY];
+    s->t_ns = t_ns;
+    s->stats = *stats;
+    ring->count++;
+
+    atomic_store_explicit(&ring->seq, seq + 2, memory_order_release);
+}
+
+void rate_table_record(struct rate_table *rt, const struct ifshow_snapshot *snap,
+                       unsigned long long t_ns) {
+    size_t j = 0;
+    for (size_t i = 0; i < snap->iface_count && j < rt->ring_count; i++) {
+        unsigned int ifindex = snap->ifaces[i].ifindex;
+        while (j < rt->ring_count && rt->rings[j].ifindex < ifindex)
+            j++;
+        if (j < rt->ring_count && rt->rings[j].ifindex == ifindex)
+            ring_push(&rt->rings[j], &snap->ifaces[i].stats, t_ns);
+    }
+}
+
+/*
+ * ring_read:
+ *   Copy the newest samples of a ring (at most max, newest first) into out,
+ *   retrying until the copy did not overlap a write. Returns the number of
+ *   samples copied.
+ */
+static size_t ring_read(const struct rate_ring *ring, struct rate_sample *out, size_t max) {
+    for (;;) {
+        unsigned int seq = atomic_load_explicit(&ring->seq, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();      /* the writer is a few stores away from done */
+            continue;
+        }
+        unsigned long long count = ring->count;
+        size_t n = count < max ? (size_t) count : max;
+        for (size_t i = 0; i < n; i++)
+            out[i] = ring->samples[(count - 1 - i) % RATE_HISTORY];
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&ring->seq, memory_order_relaxed) == seq)
+            return n;
+    }
+}
+
+static const struct rate_ring *find_ring(const struct rate_table *rt, unsigned int ifindex) {
+    size_t lo = 0, hi = rt->ring_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (rt->rings[mid].ifindex < ifindex)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < rt->ring_count && rt->rings[lo].ifindex == ifindex ? &rt->rings[lo] : NULL;
+}
+
+void rate_table_latest(const struct rate_table *rt, struct ifshow_snapshot *snap) {
+    for (size_t i = 0; i < snap->iface_count; i++) {
+        struct rate_sample newest;
+        const struct rate_ring *ring = find_ring(rt, snap->ifaces[i].ifindex);
+        if (ring != NULL && ring_read(ring, &newest, 1) == 1)
+            snap->ifaces[i].stats = newest.stats;
+    }
+}
+
+/* Growth of a counter between two samples; a counter that went back was reset. */
+static double per_second(unsigned long long from, unsigned long long to, double seconds) {
+    return to >= from ? (double)(to - from) / seconds : 0.0;
+}
+
+/*
+ * write_interval:
+ *   Write the rates between an older and a newer sample.
+ */
+static void write_interval(FILE *stream, const struct rate_sample *old,
+                           const struct rate_sample *cur) {
+    const struct ifshow_stats *a = &old->stats, *b = &cur->stats;
+    double s = cur->t_ns > old->t_ns ? (double)(cur->t_ns - old->t_ns) / 1e9 : 1e-9;
+    fprintf(stream, "rx %.0f bps %.1f pps %.2f err/s %.2f drop/s, "
+                    "tx %.0f bps %.1f pps %.2f err/s %.2f drop/s (%.3f s)\n",
+            per_second(a->rx_bytes, b->rx_bytes, s) * 8, per_second(a->rx_packets, b->rx_packets, s),
+            per_second(a->rx_errors, b->rx_errors, s), per_second(a->rx_dropped, b->rx_dropped, s),
+            per_second(a->tx_bytes, b->tx_bytes, s) * 8, per_second(a->tx_packets, b->tx_packets, s),
+            per_second(a->tx_errors, b->tx_errors, s), per_second(a->tx_dropped, b->tx_dropped, s),
+            s);
+}
+
+static void write_iface(const struct rate_table *rt, const struct ifshow_iface *iface,
+                        int history, FILE *stream) {
+    struct rate_sample samples[RATE_HISTORY];
+    const struct rate_ring *ring = find_ring(rt, iface->ifindex);
+    size_t n = ring ? ring_read(ring, samples, history ? RATE_HISTORY : 2) : 0;
+
+    if (n < 2) {
+        fprintf(stream, "%s: no rate yet\n", iface->name);
+        return;
+    }
+    fprintf(stream, "%s: ", iface->name);
+    write_interval(stream, &samples[1], &samples[0]);
+    for (size_t i = 1; i + 1 < n; i++) {
+        fprintf(stream, "  %.3f s ago: ", (double)(samples[0].t_ns - samples[i].t_ns) / 1e9);
+        write_interval(stream, &samples[i + 1], &samples[i]);
+    }
+}
+
+void rate_table_write(const struct rate_table *rt, const struct ifshow_snapshot *snap,
+                      const char *ifname, int history, FILE *stream) {
+    if (ifname == NULL) {
+        for (size_t i = 0; i < snap->iface_count; i++)
+            write_iface(rt, &snap->ifaces[i], history, stream);
+        return;
+    }
+    const struct ifshow_iface *iface = ifshow_snapshot_find(snap, ifname);
+    if (iface == NULL)
+        fprintf(stream, "Interface '%s' not found.\n", ifname);
+    else
+        write_iface(rt, iface, history, stream);
+}
+
+struct rate_table *rate_table_hold(struct rate_table *rt) {
+    if (rt != NULL)
+        atomic_fetch_add_explicit(&rt->refs, 1, memory_order_relaxed);
+    return rt;
+}
+
+void rate_table_release(struct rate_table *rt) {
+    if (rt != NULL && atomic_fetch_sub_explicit(&rt->refs, 1, memory_order_acq_rel) == 1) {
+        free(rt->rings);
+        free(rt);
+    }
+}
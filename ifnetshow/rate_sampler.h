@@ -0,0 +1,92 @@
+#ifndef RATE_SAMPLER_H
+#define RATE_SAMPLER_H
+
+#include "ifshow.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+
+/* Counter samples kept per interface (the history covers RATE_HISTORY - 1 intervals). */
+#define RATE_HISTORY 32
+
+/*
+ * struct rate_sample:
+ *   Counters of one interface and the CLOCK_MONOTONIC time (nanoseconds)
+ *   they were read at.
+ */
+struct rate_sample {
+    unsigned long long  t_ns;
+    struct ifshow_stats stats;
+};
+
+/*
+ * struct rate_ring:
+ *   Last RATE_HISTORY samples of one interface. There is one writer (the
+ *   thread refreshing the counters) and any number of readers, synchronized
+ *   by a sequence lock: seq is odd while a sample is being written, and a
+ *   reader whose copy straddled a write simply copies again. Neither side
+ *   ever waits for the other.
+ */
+struct rate_ring {
+    unsigned int       ifindex;
+    atomic_uint        seq;
+    unsigned long long count;               /* samples written so far */
+    struct rate_sample samples[RATE_HISTORY];
+};
+
+/*
+ * struct rate_table:
+ *   One ring per interface of the table, sorted by ifindex. The set of
+ *   interfaces is fixed: when it changes a new table is built, carrying over
+ *   the rings of the interfaces that remain, and the views still using the
+ *   old one keep it alive through its reference count.
+ */
+struct rate_table {
+    atomic_int        refs;
+    size_t            ring_count;
+    struct rate_ring *rings;
+};
+
+/*
+ * rate_table_build:
+ *   Make a table for the interfaces of snap, taking the history of each of
+ *   them over from prev (may be NULL). Returns a table holding one
+ *   reference, or NULL on allocation failure.
+ */
+struct rate_table *rate_table_build(const struct ifshow_snapshot *snap,
+                                    const struct rate_table *prev);
+
+/*
+ * rate_table_record:
+ *   Append the current counters of the interfaces of snap, read at t_ns, to
+ *   their rings. Interfaces without a ring are skipped. Writer only.
+ */
+void rate_table_record(struct rate_table *rt, const struct ifshow_snapshot *snap,
+                       unsigned long long t_ns);
+
+/*
+ * rate_table_latest:
+ *   Overwrite the counters of the interfaces of snap with the newest sample
+ *   of their rings. Interfaces without a sample keep their own counters.
+ */
+void rate_table_latest(const struct rate_table *rt, struct ifshow_snapshot *snap);
+
+/*
+ * rate_table_write:
+ *   Write the rates of one interface (ifname), or of every interface of snap
+ *   (ifname NULL), computed from their last two samples: bits, packets,
+ *   errors and drops per second in each direction. With history, the rates
+ *   of every interval still in the ring follow, newest first.
+ */
+void rate_table_write(const struct rate_table *rt, const struct ifshow_snapshot *snap,
+                      const char *ifname, int history, FILE *stream);
+
+/*
+ * rate_table_hold / rate_table_release:
+ *   Take / drop a reference (NULL is ignored). The table is freed with its
+ *   last reference.
+ */
+struct rate_table *rate_table_hold(struct rate_table *rt);
+void rate_table_release(struct rate_table *rt);
+
+#endif /* RATE_SAMPLER_H */
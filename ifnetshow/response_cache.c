@@ -0,0 +1,269 @@
+/*
+ * response_cache.c
+ *
+ * Pre-serialized ALL / IFNAME answers of ifnetshow_agent. They are rendered
+ * once per generation of the interface table straight into their buffers
+ * with the ifshow renderers (ifshow_render.h): the text renderer, so the
+ * bytes sent are exactly what ifshow prints, and the binary one. The
+ * SUBSCRIBE snapshot and delta messages are rendered here as well.
+ */
+
+#include "response_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+static void response_cache_free(struct response_cache *rc);
+
+/*
+ * render_answers:
+ *   Render the ALL answer of snap with r into a new *all buffer, and the
+ *   answer for every interface back to back into *ifname_buf, the i-th one
+ *   starting at (*ifname_off)[i]. Each answer is measured first, so every
+ *   buffer is allocated once at its final size.
+ */
+static int render_answers(const struct ifshow_renderer *r, const struct ifshow_snapshot *snap,
+                          char **all, size_t *all_len, char **ifname_buf, size_t **ifname_off) {
+    *all_len = ifshow_render_all(r, snap, 0, NULL, 0);
+    *all = malloc(*all_len ? *all_len : 1);
+    if (*all == NULL)
+        return -1;
+    ifshow_render_all(r, snap, 0, *all, *all_len);
+
+    size_t *off = malloc((snap->iface_count + 1) * sizeof(size_t));
+    *ifname_off = off;
+    if (off == NULL)
+        return -1;
+    off[0] = 0;
+    for (size_t i = 0; i < snap->iface_count; i++)
+        off[i + 1] = off[i] + ifshow_render_iface(r, snap, snap->ifaces[i].name, 0, NULL, 0);
+    *ifname_buf = malloc(off[snap->iface_count] ? off[snap->iface_count] : 1);
+    if (*ifname_buf == NULL)
+        return -1;
+    for (size_t i = 0; i < snap->iface_count; i++)
+        ifshow_render_iface(r, snap, snap->ifaces[i].name, 0, *ifname_buf + off[i],
+                            off[i + 1] - off[i]);
+    return 0;
+}
+
+/*
+ * write_sub_entry:
+ *   One "+"/"-" line of a subscription message: the interface itself when
+ *   addr is (size_t) -1, else its addr-th address in snap.
+ */
+static void write_sub_entry(FILE *stream, char sign, const char *name,
+                            const struct ifshow_snapshot *snap, size_t addr) {
+    if (addr == (size_t) -1) {
+        fprintf(stream, "%c %s\n", sign, name);
+        return;
+    }
+    char addr_str[INET6_ADDRSTRLEN];
+    inet_ntop(snap->addr_family[addr], snap->addr_bytes[addr], addr_str, sizeof(addr_str));
+    fprintf(stream, "%c %s %s/%d\n", sign, name, addr_str, snap->addr_prefix[addr]);
+}
+
+/* Every interface and address of iface, as sign lines. */
+static void write_sub_iface(FILE *stream, char sign, const struct ifshow_snapshot *snap,
+                            const struct ifshow_iface *iface) {
+    write_sub_entry(stream, sign, iface->name, snap, (size_t) -1);
+    for (size_t j = iface->first_addr; j < iface->first_addr + iface->addr_count; j++)
+        write_sub_entry(stream, sign, iface->name, snap, j);
+}
+
+/* Is the addr-th address of other one of the addresses of iface (same address and prefix)? */
+static int iface_has_addr(const struct ifshow_snapshot *snap, const struct ifshow_iface *iface,
+                          const struct ifshow_snapshot *other, size_t addr) {
+    for (size_t j = iface->first_addr; j < iface->first_addr + iface->addr_count; j++) {
+        if (snap->addr_family[j] == other->addr_family[addr] &&
+            snap->addr_prefix[j] == other->addr_prefix[addr] &&
+            memcmp(snap->addr_bytes[j], other->addr_bytes[addr], IFSHOW_ADDR_MAX) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * write_sub_delta:
+ *   Lines turning the old snapshot into the new one. Both are sorted by
+ *   ifindex, so they are merged in one pass; a renamed interface is removed
+ *   and added again under its new name.
+ */
+static void write_sub_delta(FILE *stream, const struct ifshow_snapshot *old,
+                            const struct ifshow_snapshot *new) {
+    size_t i = 0, j = 0;
+    while (i < old->iface_count || j < new->iface_count) {
+        const struct ifshow_iface *o = i < old->iface_count ? &old->ifaces[i] : NULL;
+        const struct ifshow_iface *n = j < new->iface_count ? &new->ifaces[j] : NULL;
+        if (n == NULL || (o != NULL && o->ifindex < n->ifindex)) {
+            write_sub_iface(stream, '-', old, o);
+            i++;
+        } else if (o == NULL || n->ifindex < o->ifindex) {
+            write_sub_iface(stream, '+', new, n);
+            j++;
+        } else if (strcmp(o->name, n->name) != 0) {
+            write_sub_iface(stream, '-', old, o);
+            write_sub_iface(stream, '+', new, n);
+            i++;
+            j++;
+        } else {
+            for (size_t k = o->first_addr; k < o->first_addr + o->addr_count; k++) {
+                if (!iface_has_addr(new, n, old, k))
+                    write_sub_entry(stream, '-', o->name, old, k);
+            }
+            for (size_t k = n->first_addr; k < n->first_addr + n->addr_count; k++) {
+                if (!iface_has_addr(old, o, new, k))
+                    write_sub_entry(stream, '+', n->name, new, k);
+            }
+            i++;
+            j++;
+        }
+    }
+}
+
+/*
+ * build_subscription:
+ *   The SUBSCRIBE snapshot message, and the delta history: the one inherited
+ *   from prev (trimmed to DELTA_HISTORY) plus the delta from prev to this view.
+ */
+static int build_subscription(struct response_cache *rc, const struct response_cache *prev) {
+    FILE *stream = open_memstream(&rc->sub_snapshot, &rc->sub_snapshot_len);
+    if (stream == NULL)
+        return -1;
+    fprintf(stream, "SNAPSHOT %llx %llu\n", rc->epoch, rc->generation);
+    for (size_t i = 0; i < rc->snap.iface_count; i++)
+        write_sub_iface(stream, '+', &rc->snap, &rc->snap.ifaces[i]);
+    fprintf(stream, "END\n");
+    if (fclose(stream) != 0)
+        return -1;
+
+    if (prev == NULL || prev->epoch != rc->epoch || prev->generation >= rc->generation)
+        return 0;
+
+    size_t keep = prev->delta_count;
+    if (keep == DELTA_HISTORY)
+        keep--;
+    for (size_t i = prev->delta_count - keep; i < prev->delta_count; i++) {
+        struct view_delta *d = &rc->deltas[rc->delta_count];
+        *d = prev->deltas[i];
+        d->text = malloc(d->len);
+        if (d->text == NULL)
+            return -1;
+        memcpy(d->text, prev->deltas[i].text, d->len);
+        rc->delta_count++;
+    }
+
+    struct view_delta *d = &rc->deltas[rc->delta_count];
+    d->from = prev->generation;
+    d->to = rc->generation;
+    stream = open_memstream(&d->text, &d->len);
+    if (stream == NULL)
+        return -1;
+    fprintf(stream, "DELTA %llx %llu %llu\n", rc->epoch, d->from, d->to);
+    write_sub_delta(stream, &prev->snap, &rc->snap);
+    fprintf(stream, "END\n");
+    if (fclose(stream) != 0) {
+        d->text = NULL;
+        return -1;
+    }
+    rc->delta_count++;
+    return 0;
+}
+
+struct response_cache *response_cache_build(const struct ifshow_snapshot *snap,
+                                            unsigned long long epoch,
+                                            unsigned long long generation,
+                                            const struct response_cache *prev,
+                                            struct rate_table *rates) {
+    struct response_cache *rc = calloc(1, sizeof(*rc));
+    if (rc == NULL)
+        return NULL;
+    atomic_init(&rc->refs, 1);
+    rc->epoch = epoch;
+    rc->generation = generation;
+    if (ifshow_snapshot_copy(&rc->snap, snap) < 0) {
+        free(rc);
+        return NULL;
+    }
+
+    rc->snap.generation = generation;
+
+    if (render_answers(&ifshow_text_renderer, &rc->snap, &rc->all, &rc->all_len,
+                       &rc->ifname_text, &rc->ifname_off) < 0)
+        goto fail;
+    if (render_answers(&ifshow_binary_renderer, &rc->snap, &rc->bin_all, &rc->bin_all_len,
+                       &rc->bin_ifname, &rc->bin_ifname_off) < 0)
+        goto fail;
+    /* Interface names are never empty, so this is the "not found" answer. */
+    ifshow_render_iface(&ifshow_binary_renderer, &rc->snap, "", 0,
+                        (char *) &rc->bin_empty, sizeof(rc->bin_empty));
+    if (build_subscription(rc, prev) < 0)
+        goto fail;
+    rc->rates = rate_table_hold(rates);
+    return rc;
+
+fail:
+    response_cache_free(rc);
+    return NULL;
+}
+
+int response_cache_ifname(const struct response_cache *rc, const char *ifname, int binary,
+                          const char **buf, size_t *len) {
+    const struct ifshow_iface *iface = ifshow_snapshot_find(&rc->snap, ifname);
+    if (iface == NULL)
+        return -1;
+    size_t i = (size_t)(iface - rc->snap.ifaces);
+    if (binary) {
+        *buf = rc->bin_ifname + rc->bin_ifname_off[i];
+        *len = rc->bin_ifname_off[i + 1] - rc->bin_ifname_off[i];
+        return 0;
+    }
+    *buf = rc->ifname_text + rc->ifname_off[i];
+    *len = rc->ifname_off[i + 1] - rc->ifname_off[i];
+    return 0;
+}
+
+int response_cache_deltas(const struct response_cache *rc, unsigned long long seq,
+                          size_t *first, size_t *count) {
+    if (seq == rc->generation) {
+        *first = rc->delta_count;
+        *count = 0;
+        return 0;
+    }
+    for (size_t i = 0; i < rc->delta_count; i++) {
+        if (rc->deltas[i].from == seq) {
+            *first = i;
+            *count = rc->delta_count - i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+struct response_cache *response_cache_hold(struct response_cache *rc) {
+    atomic_fetch_add_explicit(&rc->refs, 1, memory_order_relaxed);
+    return rc;
+}
+
+void response_cache_release(struct response_cache *rc) {
+    if (rc != NULL && atomic_fetch_sub_explicit(&rc->refs, 1, memory_order_acq_rel) == 1)
+        response_cache_free(rc);
+}
+
+static void response_cache_free(struct response_cache *rc) {
+    if (rc == NULL)
+        return;
+    free(rc->all);
+    free(rc->ifname_text);
+    free(rc->ifname_off);
+    free(rc->bin_all);
+    free(rc->bin_ifname);
+    free(rc->bin_ifname_off);
+    free(rc->sub_snapshot);
+    for (size_t i = 0; i < rc->delta_count; i++)
+        free(rc->deltas[i].text);
+    ifshow_snapshot_free(&rc->snap);
+    rate_table_release(rc->rates);
+    free(rc);
+}
@@ -0,0 +1,120 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include "ifshow.h"
+#include "ifnetshow.h"
+#include "rate_sampler.h"
+
+#include <stdatomic.h>
+
+/* Delta messages kept for subscribers that fall behind or reconnect. */
+#define DELTA_HISTORY 64
+
+/*
+ * struct view_delta:
+ *   Rendered "DELTA" message taking a subscriber from generation from to
+ *   generation to.
+ */
+struct view_delta {
+    unsigned long long from;
+    unsigned long long to;
+    char              *text;
+    size_t             len;
+};
+
+/*
+ * struct response_cache:
+ *   Immutable view of one generation of the interface table: a private copy
+ *   of the snapshot plus the fully rendered answers to "ALL" and to
+ *   "IFNAME <x>" for every interface, ready to be written to a socket as is.
+ *   The IFNAME answers are stored back to back in ifname_text; the answer for
+ *   the i-th interface of snap is ifname_text[ifname_off[i] .. ifname_off[i + 1]).
+ *   The same answers are also kept in the binary format (bin_*, see
+ *   ifshow_render.h); bin_empty is the binary answer for an unknown interface.
+ *
+ *   For SUBSCRIBE clients the view also carries the full snapshot message
+ *   and the delta messages of the last DELTA_HISTORY generations (oldest
+ *   first, each one going from the previous generation to the next), so a
+ *   subscriber that was at any of those generations can be brought up to
+ *   date with deltas only. epoch identifies the agent instance the
+ *   generations belong to.
+ *
+ *   rates is the rate table of the agent's counter sampler (NULL when
+ *   sampling is disabled). Unlike the rest of the view it keeps changing:
+ *   the sampler appends to its rings while workers read them. The counters
+ *   in snap are those of the table load and are not refreshed: STATS
+ *   answers take the newest sample from rates instead, so a counter refresh
+ *   never rebuilds the view.
+ *
+ *   view_seq is set by shared_view_publish(): views are numbered in the
+ *   order they are published, which is not the table generation (a view
+ *   may be published again for the same generation).
+ *
+ *   The cache is reference counted (atomically, it is shared by the worker
+ *   threads): connections that are still sending one of its buffers hold a
+ *   reference, so a newer generation can replace it without cutting those
+ *   answers short.
+ */
+struct response_cache {
+    atomic_int             refs;
+    unsigned long long     generation;
+    unsigned long long     view_seq;
+    struct ifshow_snapshot snap;
+    char                  *all;
+    size_t                 all_len;
+    char                  *ifname_text;
+    size_t                *ifname_off;
+    char                  *bin_all;
+    size_t                 bin_all_len;
+    char                  *bin_ifname;
+    size_t                *bin_ifname_off;
+    struct ifshow_bin_header bin_empty;
+    unsigned long long     epoch;
+    char                  *sub_snapshot;
+    size_t                 sub_snapshot_len;
+    struct view_delta      deltas[DELTA_HISTORY];
+    size_t                 delta_count;
+    struct rate_table     *rates;
+};
+
+/*
+ * response_cache_build:
+ *   Render every response for the given snapshot/generation. prev is the
+ *   view this one replaces (NULL for the first one): the delta from prev is
+ *   rendered and appended to the delta history inherited from it. The view
+ *   takes a reference to rates (may be NULL).
+ *   Returns a new cache holding one reference, or NULL on allocation failure.
+ */
+struct response_cache *response_cache_build(const struct ifshow_snapshot *snap,
+                                            unsigned long long epoch,
+                                            unsigned long long generation,
+                                            const struct response_cache *prev,
+                                            struct rate_table *rates);
+
+/*
+ * response_cache_deltas:
+ *   Find the delta messages that take a subscriber at generation seq up to
+ *   rc->generation: deltas[*first .. *first + *count). Returns 0 if they are
+ *   in the history (*count is 0 if seq is current), -1 if a full snapshot
+ *   must be sent instead.
+ */
+int response_cache_deltas(const struct response_cache *rc, unsigned long long seq,
+                          size_t *first, size_t *count);
+
+/*
+ * response_cache_ifname:
+ *   Find the rendered answer (text, or binary if binary is set) for one
+ *   interface. Returns 0 and sets *buf / *len, or -1 if the interface does
+ *   not exist.
+ */
+int response_cache_ifname(const struct response_cache *rc, const char *ifname, int binary,
+                          const char **buf, size_t *len);
+
+/*
+ * response_cache_hold / response_cache_release:
+ *   Take / drop a reference. The cache is freed with its last reference.
+ */
+struct response_cache *response_cache_hold(struct response_cache *rc);
+void response_cache_release(struct response_cache *rc);
+
+#endif /* RESPONSE_CACHE_H */
@@ -0,0 +1,112 @@
+/*
+ * shared_view.c
+ *
+ * Lock-free publication of the agent's rendered interface view to the worker
+ * threads (see shared_view.h for the reclamation rule).
+ */
+
+#include "shared_view.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+int shared_view_init(struct shared_view *sv, size_t reader_count, struct response_cache *first) {
+    sv->readers = calloc(reader_count, sizeof(struct view_reader));
+    if (sv->readers == NULL)
+        return -1;
+    sv->reader_count = reader_count;
+    sv->retired = NULL;
+    for (size_t i = 0; i < reader_count; i++) {
+        atomic_init(&sv->readers[i].seen_seq, 0);
+        sv->readers[i].wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (sv->readers[i].wake_fd < 0) {
+            perror("eventfd");
+            while (i-- > 0)
+                close(sv->readers[i].wake_fd);
+            free(sv->readers);
+            return -1;
+        }
+    }
+    /* Readers start at 0, so every view they can see is newer. */
+    first->view_seq = 1;
+    sv->next_seq = 2;
+    atomic_init(&sv->current, first);
+    return 0;
+}
+
+void shared_view_publish(struct shared_view *sv, struct response_cache *rc) {
+    rc->view_seq = sv->next_seq++;
+    struct response_cache *old = atomic_exchange_explicit(&sv->current, rc, memory_order_acq_rel);
+    if (old != NULL) {
+        struct retired_view *r = malloc(sizeof(*r));
+        if (r != NULL) {
+            r->rc = old;
+            r->successor = rc->view_seq;
+            r->next = sv->retired;
+            sv->retired = r;
+        }
+        /* If the bookkeeping cannot be allocated the old view is leaked
+         * rather than freed under a worker's feet. */
+    }
+
+    uint64_t one = 1;
+    for (size_t i = 0; i < sv->reader_count; i++) {
+        if (write(sv->readers[i].wake_fd, &one, sizeof(one)) < 0)
+            continue;   /* counter saturated: a wakeup is already pending */
+    }
+}
+
+size_t shared_view_reclaim(struct shared_view *sv) {
+    size_t waiting = 0;
+    struct retired_view **link = &sv->retired;
+    while (*link != NULL) {
+        struct retired_view *r = *link;
+        int reachable = 0;
+        for (size_t i = 0; i < sv->reader_count; i++) {
+            if (atomic_load_explicit(&sv->readers[i].seen_seq, memory_order_acquire) < r->successor) {
+                reachable = 1;
+                break;
+            }
+        }
+        if (reachable) {
+            waiting++;
+            link = &r->next;
+            continue;
+        }
+        *link = r->next;
+        response_cache_release(r->rc);
+        free(r);
+    }
+    return waiting;
+}
+
+struct response_cache *shared_view_acquire(struct shared_view *sv, struct view_reader *reader,
+                                           struct response_cache *held) {
+    struct response_cache *rc = atomic_load_explicit(&sv->current, memory_order_acquire);
+    if (rc == held)
+        return held;
+    /* rc cannot be freed here: the publisher keeps its reference until this
+     * reader reports a view at least as new as rc's successor. */
+    response_cache_hold(rc);
+    response_cache_release(held);
+    atomic_store_explicit(&reader->seen_seq, rc->view_seq, memory_order_release);
+    return rc;
+}
+
+void shared_view_destroy(struct shared_view *sv) {
+    while (sv->retired != NULL) {
+        struct retired_view *r = sv->retired;
+        sv->retired = r->next;
+        response_cache_release(r->rc);
+        free(r);
+    }
+    response_cache_release(atomic_load(&sv->current));
+    for (size_t i = 0; i < sv->reader_count; i++)
+        close(sv->readers[i].wake_fd);
+    free(sv->readers);
+    sv->readers = NULL;
+    sv->reader_count = 0;
+}
@@ -0,0 +1,77 @@
+#ifndef SHARED_VIEW_H
+#define SHARED_VIEW_H
+
+#include "response_cache.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/*
+ * struct view_reader:
+ *   Per-worker state of the shared view. seen_seq is the publish sequence
+ *   (view_seq) of the view the worker currently holds; wake_fd is an eventfd
+ *   the publisher writes to when a new view is available.
+ */
+struct view_reader {
+    _Atomic unsigned long long seen_seq;
+    int                        wake_fd;
+};
+
+struct retired_view {
+    struct response_cache *rc;
+    unsigned long long     successor;   /* view_seq of the view that replaced it */
+    struct retired_view   *next;
+};
+
+/*
+ * struct shared_view:
+ *   Read-mostly publication of the current response cache, RCU style.
+ *   A single publisher (the thread owning the interface table) swaps the
+ *   current pointer; workers pick it up with an atomic load and a reference
+ *   count increment, never a lock. A replaced view keeps the publisher's
+ *   reference until every worker has acknowledged a newer view, which
+ *   guarantees no worker can still be about to take a reference on it.
+ *   Views are told apart by the sequence number they are published under,
+ *   never by their table generation, which two views can share.
+ */
+struct shared_view {
+    _Atomic(struct response_cache *) current;
+    struct view_reader              *readers;
+    size_t                           reader_count;
+    struct retired_view             *retired;    /* publisher only */
+    unsigned long long               next_seq;   /* publisher only */
+};
+
+/*
+ * shared_view_init:
+ *   Prepare the view for reader_count workers and publish the first cache
+ *   (whose reference is taken over). Returns 0 on success, -1 on error.
+ */
+int shared_view_init(struct shared_view *sv, size_t reader_count, struct response_cache *first);
+
+/*
+ * shared_view_publish:
+ *   Replace the current cache (taking over the caller's reference to rc) and
+ *   wake up every worker. Publisher only.
+ */
+void shared_view_publish(struct shared_view *sv, struct response_cache *rc);
+
+/*
+ * shared_view_reclaim:
+ *   Drop the publisher's reference to replaced views that no worker can reach
+ *   any more. Publisher only. Returns the number of views still waiting.
+ */
+size_t shared_view_reclaim(struct shared_view *sv);
+
+/*
+ * shared_view_acquire:
+ *   Called by a worker with the view it currently holds (NULL at start).
+ *   Returns the current view, holding a reference to it; the reference to
+ *   held is dropped if it was replaced.
+ */
+struct response_cache *shared_view_acquire(struct shared_view *sv, struct view_reader *reader,
+                                           struct response_cache *held);
+
+void shared_view_destroy(struct shared_view *sv);
+
+#endif /* SHARED_VIEW_H */
@@ -1,7 +1,6 @@
 #include "ifshow.h"
 #include <stdlib.h>
 #include <string.h>
-#include <arpa/inet.h>
 
 /* 
  * get_prefix_length:
@@ -41,121 +40,93 @@ int get_prefix_length(struct sockaddr *netmask) {
     return prefix;
 }
 
+/*
+ * print_rendered:
+ *   Render the snapshot (all interfaces, or only ifname when it is not NULL)
+ *   with r and write the result to stream.
+ */
+static int print_rendered(const struct ifshow_renderer *r, const struct ifshow_snapshot *snap,
+                          const char *ifname, unsigned int detail, FILE *stream) {
+    char stack_buf[4096];
+    char *buf = stack_buf;
+    size_t len = ifname ? ifshow_render_iface(r, snap, ifname, detail, buf, sizeof(stack_buf))
+                        : ifshow_render_all(r, snap, detail, buf, sizeof(stack_buf));
+    if (len > sizeof(stack_buf)) {
+        buf = malloc(len);
+        if (buf == NULL) {
+            perror("malloc");
+            return -1;
+        }
+        if (ifname)
+            ifshow_render_iface(r, snap, ifname, detail, buf, len);
+        else
+            ifshow_render_all(r, snap, detail, buf, len);
+    }
+    int ret = fwrite(buf, 1, len, stream) == len ? 0 : -1;
+    if (buf != stack_buf)
+        free(buf);
+    return ret;
+}
+
+/*
+ * ifshow_snapshot_print_all:
+ *   Print each interface that has at least one IPv4/IPv6 address, followed by
+ *   its addresses in prefix notation.
+ */
+int ifshow_snapshot_print_all(const struct ifshow_snapshot *snap, FILE *stream) {
+    return print_rendered(&ifshow_text_renderer, snap, NULL, 0, stream);
+}
+
+/*
+ * ifshow_snapshot_print_iface:
+ *   Print the addresses of a single interface of the snapshot.
+ */
+int ifshow_snapshot_print_iface(const struct ifshow_snapshot *snap, const char *ifname, FILE *stream) {
+    return print_rendered(&ifshow_text_renderer, snap, ifname, 0, stream);
+}
+
+/*
+ * ifshow_snapshot_print:
+ *   Print the snapshot, or only ifname when it is not NULL, with renderer r.
+ */
+int ifshow_snapshot_print(const struct ifshow_snapshot *snap, const struct ifshow_renderer *r,
+                          const char *ifname, unsigned int detail, FILE *stream) {
+    return print_rendered(r, snap, ifname, detail, stream);
+}
+
 /*
  * show_all_interfaces:
- *   Retrieve the list of interfaces using getifaddrs() and print for each unique interface
- *   its name followed by its IPv4/IPv6 addresses (in prefix notation) to the provided stream.
+ *   Take a snapshot of the interfaces (netlink, or getifaddrs() as a fallback)
+ *   and print for each interface its name followed by its IPv4/IPv6 addresses
+ *   (in prefix notation) to the provided stream.
  */
 int show_all_interfaces(FILE *stream) {
-    struct ifaddrs *ifaddr, *ifa;
-    if (getifaddrs(&ifaddr) == -1) {
+    struct ifshow_snapshot snap;
+    ifshow_snapshot_init(&snap);
+    if (ifshow_snapshot_load(&snap) < 0) {
         fprintf(stream, "Error retrieving interface information.\n");
+        ifshow_snapshot_free(&snap);
         return -1;
     }
-    
-    #define MAX_INTERFACES 128
-    char *iface_names[MAX_INTERFACES];
-    int iface_count = 0;
-    
-    /* Collect unique interface names that have valid IP addresses */
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == NULL)
-            continue;
-        if (ifa->ifa_addr->sa_family != AF_INET && ifa->ifa_addr->sa_family != AF_INET6)
-            continue;
-        int exists = 0;
-        for (int i = 0; i < iface_count; i++) {
-            if (strcmp(iface_names[i], ifa->ifa_name) == 0) {
-                exists = 1;
-                break;
-            }
-        }
-        if (!exists) {
-            iface_names[iface_count] = strdup(ifa->ifa_name);
-            if (iface_names[iface_count] == NULL) {
-                fprintf(stream, "Memory allocation error.\n");
-                freeifaddrs(ifaddr);
-                return -1;
-            }
-            iface_count++;
-            if (iface_count >= MAX_INTERFACES)
-                break;
-        }
-    }
-    
-    /* Print each interface and its addresses */
-    for (int i = 0; i < iface_count; i++) {
-        fprintf(stream, "%s:\n", iface_names[i]);
-        for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-            if (ifa->ifa_addr == NULL)
-                continue;
-            if (strcmp(iface_names[i], ifa->ifa_name) != 0)
-                continue;
-            if (ifa->ifa_addr->sa_family == AF_INET || ifa->ifa_addr->sa_family == AF_INET6) {
-                char addr_str[INET6_ADDRSTRLEN];
-                if (ifa->ifa_addr->sa_family == AF_INET) {
-                    struct sockaddr_in *addr_in = (struct sockaddr_in *)ifa->ifa_addr;
-                    if (inet_ntop(AF_INET, &addr_in->sin_addr, addr_str, sizeof(addr_str)) == NULL)
-                        continue;
-                } else {
-                    struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)ifa->ifa_addr;
-                    if (inet_ntop(AF_INET6, &addr_in6->sin6_addr, addr_str, sizeof(addr_str)) == NULL)
-                        continue;
-                }
-                int prefix = 0;
-                if (ifa->ifa_netmask != NULL)
-                    prefix = get_prefix_length(ifa->ifa_netmask);
-                fprintf(stream, "  %s/%d\n", addr_str, prefix);
-            }
-        }
-        free(iface_names[i]);
-    }
-    
-    freeifaddrs(ifaddr);
-    return 0;
+    int ret = ifshow_snapshot_print_all(&snap, stream);
+    ifshow_snapshot_free(&snap);
+    return ret;
 }
 
 /*
  * show_interface_by_name:
- *   Retrieve the list of interfaces and print only those addresses associated with the
- *   interface whose name is given by ifname.
+ *   Take a snapshot of the interfaces and print only those addresses associated
+ *   with the interface whose name is given by ifname.
  */
 int show_interface_by_name(const char *ifname, FILE *stream) {
-    struct ifaddrs *ifaddr, *ifa;
-    if (getifaddrs(&ifaddr) == -1) {
+    struct ifshow_snapshot snap;
+    ifshow_snapshot_init(&snap);
+    if (ifshow_snapshot_load(&snap) < 0) {
         fprintf(stream, "Error retrieving interface information.\n");
+        ifshow_snapshot_free(&snap);
         return -1;
     }
-    
-    int found = 0;
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        if (ifa->ifa_addr == NULL)
-            continue;
-        if (strcmp(ifa->ifa_name, ifname) != 0)
-            continue;
-        if (ifa->ifa_addr->sa_family == AF_INET || ifa->ifa_addr->sa_family == AF_INET6) {
-            found = 1;
-            char addr_str[INET6_ADDRSTRLEN];
-            if (ifa->ifa_addr->sa_family == AF_INET) {
-                struct sockaddr_in *addr_in = (struct sockaddr_in *)ifa->ifa_addr;
-                if (inet_ntop(AF_INET, &addr_in->sin_addr, addr_str, sizeof(addr_str)) == NULL)
-                    continue;
-            } else {
-                struct sockaddr_in6 *addr_in6 = (struct sockaddr_in6 *)ifa->ifa_addr;
-                if (inet_ntop(AF_INET6, &addr_in6->sin6_addr, addr_str, sizeof(addr_str)) == NULL)
-                    continue;
-            }
-            int prefix = 0;
-            if (ifa->ifa_netmask != NULL)
-                prefix = get_prefix_length(ifa->ifa_netmask);
-            fprintf(stream, "%s/%d\n", addr_str, prefix);
-        }
-    }
-    
-    if (!found) {
-        fprintf(stream, "Interface '%s' not found or has no IP addresses.\n", ifname);
-    }
-    
-    freeifaddrs(ifaddr);
-    return 0;
+    int ret = ifshow_snapshot_print_iface(&snap, ifname, stream);
+    ifshow_snapshot_free(&snap);
+    return ret;
 }
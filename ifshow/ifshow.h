@@ -2,17 +2,266 @@
 #define IFSHOW_H
 
 #include <stdio.h>
+#include <stddef.h>
 #include <sys/types.h>
 #include <ifaddrs.h>
+#include <net/if.h>
 #include <netinet/in.h>
 
-/* 
+#include "ifshow_render.h"
+
+/* Largest raw address stored in a snapshot (an IPv6 address). */
+#define IFSHOW_ADDR_MAX 16
+
+/*
+ * struct ifshow_addr:
+ *   One IPv4/IPv6 address of an interface, kept in raw (network order) form.
+ */
+struct ifshow_addr {
+    unsigned int  ifindex;
+    unsigned char family;                 /* AF_INET or AF_INET6 */
+    unsigned char prefix;                 /* prefix length in bits */
+    unsigned char addr[IFSHOW_ADDR_MAX];  /* 4 or 16 significant bytes */
+};
+
+/* Largest hardware address kept for an interface (MAX_ADDR_LEN). */
+#define IFSHOW_HWADDR_MAX 32
+
+/*
+ * struct ifshow_link:
+ *   Link-level state of an interface, as reported with the link itself
+ *   (RTM_NEWLINK, or the AF_PACKET entry of getifaddrs()). Fields that the
+ *   source does not report are 0. The struct has no padding, so two of them
+ *   can be compared with memcmp().
+ */
+struct ifshow_link {
+    unsigned int   flags;                     /* IFF_* */
+    unsigned int   mtu;
+    unsigned short type;                      /* ARPHRD_* */
+    unsigned char  operstate;                 /* IF_OPER_* (RFC 2863) */
+    unsigned char  hwaddr_len;
+    unsigned char  hwaddr[IFSHOW_HWADDR_MAX];
+};
+
+/*
+ * struct ifshow_stats:
+ *   Kernel counters of an interface (IFLA_STATS64). Unlike the rest of the
+ *   snapshot they change all the time, so they are not part of what makes
+ *   two snapshots differ.
+ */
+struct ifshow_stats {
+    unsigned long long rx_bytes;
+    unsigned long long rx_packets;
+    unsigned long long rx_errors;
+    unsigned long long rx_dropped;
+    unsigned long long tx_bytes;
+    unsigned long long tx_packets;
+    unsigned long long tx_errors;
+    unsigned long long tx_dropped;
+};
+
+/*
+ * struct ifshow_iface:
+ *   One network interface. Its addresses are the addr_count consecutive
+ *   entries of the snapshot's address arrays starting at first_addr. Names
+ *   are stored inline (at most IF_NAMESIZE bytes), never as separate strings.
+ */
+struct ifshow_iface {
+    unsigned int        ifindex;
+    char                name[IF_NAMESIZE];
+    size_t              first_addr;
+    size_t              addr_count;
+    struct ifshow_link  link;
+    struct ifshow_stats stats;
+};
+
+/*
+ * struct ifshow_arena:
+ *   One contiguous block carved by bumping an offset. Resetting it is O(1),
+ *   and the block is kept (only grown) so that a recycled snapshot does not
+ *   allocate again.
+ */
+struct ifshow_arena {
+    unsigned char *base;
+    size_t         used;
+    size_t         cap;
+};
+
+/*
+ * struct ifshow_builder:
+ *   What the loaders and incremental edits write: interfaces and addresses
+ *   in any order (interfaces are sorted by ifindex once finalized).
+ *   Capacities are kept across ifshow_snapshot_reset(). name_slots is a
+ *   hash index by name used to deduplicate interfaces while loading from
+ *   getifaddrs().
+ */
+struct ifshow_builder {
+    struct ifshow_iface *ifaces;
+    size_t               iface_count;
+    size_t               iface_cap;
+    struct ifshow_addr  *addrs;
+    size_t               addr_count;
+    size_t               addr_cap;
+    size_t              *name_slots;
+    size_t               slot_cap;
+    int                  hashed;
+};
+
+/*
+ * struct ifshow_snapshot:
+ *   A compact picture of every interface and address of the host, built in
+ *   one pass.
+ *
+ *   ifshow_snapshot_finalize() compiles the builder into the read-only view
+ *   below, laid out in a single arena: interfaces sorted by ifindex,
+ *   addresses grouped per interface (in the order the kernel reported them)
+ *   and stored as a struct of arrays, and a hash index of the interfaces by
+ *   name and by ifindex (open addressing, slots hold position + 1 in
+ *   ifaces[], 0 when empty). Readers only use the view; it stays unchanged
+ *   by edits until the next finalize.
+ */
+struct ifshow_snapshot {
+    struct ifshow_iface  *ifaces;
+    size_t                iface_count;
+    size_t                addr_count;
+    unsigned int         *addr_ifindex;
+    unsigned char        *addr_family;     /* AF_INET or AF_INET6 */
+    unsigned char        *addr_prefix;     /* prefix length in bits */
+    unsigned char       (*addr_bytes)[IFSHOW_ADDR_MAX];
+    size_t               *name_slots;
+    size_t               *index_slots;
+    size_t                slot_cap;        /* power of two */
+    unsigned long long    generation;      /* set by the owner, reported by renderers */
+    struct ifshow_arena   arena;
+    struct ifshow_builder build;
+};
+
+/*
+ * ifshow_snapshot_addr:
+ *   Gather the i-th address of the view into an ifshow_addr.
+ */
+static inline void ifshow_snapshot_addr(const struct ifshow_snapshot *snap, size_t i,
+                                        struct ifshow_addr *out) {
+    out->ifindex = snap->addr_ifindex[i];
+    out->family = snap->addr_family[i];
+    out->prefix = snap->addr_prefix[i];
+    for (int k = 0; k < IFSHOW_ADDR_MAX; k++)
+        out->addr[k] = snap->addr_bytes[i][k];
+}
+
+/*
  * get_prefix_length:
- *   Given a pointer to a sockaddr representing a netmask, 
+ *   Given a pointer to a sockaddr representing a netmask,
  *   compute the prefix length (number of leading 1 bits).
  */
 int get_prefix_length(struct sockaddr *netmask);
 
+/*
+ * ifshow_snapshot_init / ifshow_snapshot_reset / ifshow_snapshot_free:
+ *   Prepare an empty snapshot; empty it in O(1) while keeping its memory
+ *   for the next load; release everything it holds.
+ */
+void ifshow_snapshot_init(struct ifshow_snapshot *snap);
+void ifshow_snapshot_reset(struct ifshow_snapshot *snap);
+void ifshow_snapshot_free(struct ifshow_snapshot *snap);
+
+/*
+ * ifshow_snapshot_copy:
+ *   Make dst an independent, read-only copy of the view of the finalized
+ *   snapshot src: the arena is copied as one block. dst must have been
+ *   initialized, and may hold an earlier copy or load: its arena is reused
+ *   if it is large enough, and its builder is released (dst gets none, so
+ *   it cannot be edited). Returns 0 on success, -1 on allocation failure.
+ */
+int ifshow_snapshot_copy(struct ifshow_snapshot *dst, const struct ifshow_snapshot *src);
+
+/*
+ * ifshow_snapshot_load:
+ *   Fill the snapshot with the current interfaces and addresses of the host.
+ *   An rtnetlink dump (RTM_GETLINK + RTM_GETADDR) is used; getifaddrs() is
+ *   only used as a fallback when netlink is unavailable.
+ *
+ *   Returns 0 on success, -1 on error.
+ */
+int ifshow_snapshot_load(struct ifshow_snapshot *snap);
+int ifshow_snapshot_load_netlink(struct ifshow_snapshot *snap);
+int ifshow_snapshot_load_ifaddrs(struct ifshow_snapshot *snap);
+
+/*
+ * ifshow_snapshot_load_stats:
+ *   Refresh only the counters of a finalized snapshot (in its view and its
+ *   builder) from an RTM_GETLINK dump. Interfaces the snapshot does not know
+ *   are ignored. Returns 0 on success, -1 on error.
+ */
+int ifshow_snapshot_load_stats(struct ifshow_snapshot *snap);
+
+/*
+ * ifshow_snapshot_add_iface / ifshow_snapshot_add_addr / ifshow_snapshot_finalize:
+ *   Low-level builder used by the loaders. Interfaces and addresses may be
+ *   added in any order; ifshow_snapshot_finalize() must then be called to
+ *   compile them into the view before the snapshot is read.
+ *   add_iface copies the ifindex, name, link state and counters of iface.
+ *
+ *   Return 0 on success, -1 on allocation failure.
+ */
+int ifshow_snapshot_add_iface(struct ifshow_snapshot *snap, const struct ifshow_iface *iface);
+int ifshow_snapshot_add_addr(struct ifshow_snapshot *snap, const struct ifshow_addr *addr);
+int ifshow_snapshot_finalize(struct ifshow_snapshot *snap);
+
+/*
+ * ifshow_snapshot_update_iface / ifshow_snapshot_remove_iface /
+ * ifshow_snapshot_update_addr / ifshow_snapshot_remove_addr:
+ *   Incremental edits of the builder of a finalized snapshot (for example from
+ *   netlink notifications). Interfaces stay sorted; ifshow_snapshot_finalize()
+ *   must be called after a batch of edits to publish them in the view.
+ *   An update adds the entry if it is missing (or renames the interface,
+ *   changes its link state / the prefix); an empty name keeps the current
+ *   one. Counters are taken as well but do not count as a change. Removing
+ *   an interface also removes its addresses.
+ *
+ *   Return 1 if the snapshot changed, 0 if not, -1 on allocation failure.
+ */
+int ifshow_snapshot_update_iface(struct ifshow_snapshot *snap, const struct ifshow_iface *iface);
+int ifshow_snapshot_remove_iface(struct ifshow_snapshot *snap, unsigned int ifindex);
+int ifshow_snapshot_update_addr(struct ifshow_snapshot *snap, const struct ifshow_addr *addr);
+int ifshow_snapshot_remove_addr(struct ifshow_snapshot *snap, const struct ifshow_addr *addr);
+
+/*
+ * ifshow_snapshot_set_stats:
+ *   Replace the counters of interface ifindex in the view and the builder of
+ *   a finalized snapshot, in place. Returns 0, or -1 if ifindex is unknown.
+ */
+int ifshow_snapshot_set_stats(struct ifshow_snapshot *snap, unsigned int ifindex,
+                              const struct ifshow_stats *stats);
+
+/*
+ * ifshow_snapshot_find / ifshow_snapshot_find_index:
+ *   Look an interface up in the view by name or by ifindex, in O(1).
+ *   Returns NULL if not found.
+ */
+const struct ifshow_iface *ifshow_snapshot_find(const struct ifshow_snapshot *snap, const char *ifname);
+const struct ifshow_iface *ifshow_snapshot_find_index(const struct ifshow_snapshot *snap, unsigned int ifindex);
+
+/*
+ * ifshow_snapshot_print_all / ifshow_snapshot_print_iface:
+ *   Same output as show_all_interfaces() and show_interface_by_name(), but
+ *   taken from an already loaded snapshot.
+ */
+int ifshow_snapshot_print_all(const struct ifshow_snapshot *snap, FILE *stream);
+int ifshow_snapshot_print_iface(const struct ifshow_snapshot *snap, const char *ifname, FILE *stream);
+
+/*
+ * ifshow_snapshot_print:
+ *   Write the rendering of the snapshot by r (see ifshow_render.h) to
+ *   stream: every interface, or only ifname when it is not NULL, with the
+ *   IFSHOW_DETAIL_* parts selected by detail.
+ *   Code that does not want stdio renders into its own buffer instead.
+ *
+ *   Returns 0 on success, -1 on error.
+ */
+int ifshow_snapshot_print(const struct ifshow_snapshot *snap, const struct ifshow_renderer *r,
+                          const char *ifname, unsigned int detail, FILE *stream);
+
 /*
  * show_all_interfaces:
  *   Retrieve the list of local network interfaces and, for each interface,
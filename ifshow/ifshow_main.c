@@ -5,8 +5,29 @@
 
 void usage(const char *progname) {
     fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "  %s -a\n", progname);
-    fprintf(stderr, "  %s -i <interface>\n", progname);
+    fprintf(stderr, "  %s -a [-l] [-s] [-j]\n", progname);
+    fprintf(stderr, "  %s -i <interface> [-l] [-s] [-j]\n", progname);
+    fprintf(stderr, "  -l : show link details (state, flags, MTU, hardware address)\n");
+    fprintf(stderr, "  -s : show rx/tx counters\n");
+    fprintf(stderr, "  -j : print JSON instead of text\n");
+}
+
+/*
+ * show_detailed:
+ *   Take a snapshot and print it (or only ifname, if not NULL) with the given
+ *   renderer and details.
+ */
+static int show_detailed(const char *ifname, const struct ifshow_renderer *r, unsigned int detail) {
+    struct ifshow_snapshot snap;
+    ifshow_snapshot_init(&snap);
+    if (ifshow_snapshot_load(&snap) < 0) {
+         fprintf(stderr, "Error retrieving interface information.\n");
+         ifshow_snapshot_free(&snap);
+         return EXIT_FAILURE;
+    }
+    int ret = ifshow_snapshot_print(&snap, r, ifname, detail, stdout);
+    ifshow_snapshot_free(&snap);
+    return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
 
 int main(int argc, char *argv[]) {
@@ -15,17 +36,40 @@ int main(int argc, char *argv[]) {
          return EXIT_FAILURE;
     }
 
+    const char *ifname = NULL;
+    int first_option = 2;
     if (strcmp(argv[1], "-a") == 0) {
          /* List all interfaces */
-         return show_all_interfaces(stdout);
     } else if (strcmp(argv[1], "-i") == 0) {
          if (argc < 3) {
               usage(argv[0]);
               return EXIT_FAILURE;
          }
-         return show_interface_by_name(argv[2], stdout);
+         ifname = argv[2];
+         first_option = 3;
     } else {
          usage(argv[0]);
          return EXIT_FAILURE;
     }
+
+    unsigned int detail = 0;
+    int json = 0;
+    for (int i = first_option; i < argc; i++) {
+         if (strcmp(argv[i], "-l") == 0) {
+              detail |= IFSHOW_DETAIL_LINK;
+         } else if (strcmp(argv[i], "-s") == 0) {
+              detail |= IFSHOW_DETAIL_STATS;
+         } else if (strcmp(argv[i], "-j") == 0) {
+              json = 1;
+         } else {
+              usage(argv[0]);
+              return EXIT_FAILURE;
+         }
+    }
+
+    if (detail != 0 || json)
+         return show_detailed(ifname, json ? &ifshow_json_renderer : &ifshow_text_renderer, detail);
+    if (ifname != NULL)
+         return show_interface_by_name(ifname, stdout);
+    return show_all_interfaces(stdout);
 }
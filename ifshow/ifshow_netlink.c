@@ -0,0 +1,242 @@
+#include "ifshow_netlink.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+int ifshow_nl_open(void) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_nl local;
+    memset(&local, 0, sizeof(local));
+    local.nl_family = AF_NETLINK;
+    if (bind(fd, (struct sockaddr *)&local, sizeof(local)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int ifshow_nl_request_dump(int fd, int type, unsigned int seq) {
+    struct {
+        struct nlmsghdr nh;
+        union {
+            struct ifinfomsg link;
+            struct ifaddrmsg addr;
+        } body;
+    } req;
+
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_type = (unsigned short) type;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = seq;
+    if (type == RTM_GETLINK) {
+        req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+        req.body.link.ifi_family = AF_UNSPEC;
+    } else {
+        req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+        req.body.addr.ifa_family = AF_UNSPEC;
+    }
+
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    ssize_t n;
+    do {
+        n = sendto(fd, &req, req.nh.nlmsg_len, 0, (struct sockaddr *)&kernel, sizeof(kernel));
+    } while (n < 0 && errno == EINTR);
+    return n < 0 ? -1 : 0;
+}
+
+/* Copy an attribute into dst (size bytes), zero-filling or truncating as needed. */
+static void copy_attr(void *dst, size_t size, const struct rtattr *rta) {
+    size_t n = RTA_PAYLOAD(rta);
+    memset(dst, 0, size);
+    memcpy(dst, RTA_DATA(rta), n < size ? n : size);
+}
+
+int ifshow_nl_parse_link(const struct nlmsghdr *nh, struct ifshow_iface *iface) {
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+        return -1;
+    const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+    int len = (int) IFLA_PAYLOAD(nh);
+
+    memset(iface, 0, sizeof(*iface));
+    iface->ifindex = (unsigned int) ifi->ifi_index;
+    iface->link.flags = ifi->ifi_flags;
+    iface->link.type = ifi->ifi_type;
+
+    const struct rtattr *stats64 = NULL, *stats32 = NULL;
+    for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        switch (rta->rta_type) {
+        case IFLA_IFNAME: {
+            size_t n = RTA_PAYLOAD(rta);
+            if (n >= IF_NAMESIZE)
+                n = IF_NAMESIZE - 1;
+            memcpy(iface->name, RTA_DATA(rta), n);
+            iface->name[n] = '\0';
+            break;
+        }
+        case IFLA_MTU:
+            copy_attr(&iface->link.mtu, sizeof(iface->link.mtu), rta);
+            break;
+        case IFLA_OPERSTATE:
+            copy_attr(&iface->link.operstate, sizeof(iface->link.operstate), rta);
+            break;
+        case IFLA_ADDRESS: {
+            size_t n = RTA_PAYLOAD(rta);
+            iface->link.hwaddr_len = (unsigned char)(n < IFSHOW_HWADDR_MAX ? n : IFSHOW_HWADDR_MAX);
+            memcpy(iface->link.hwaddr, RTA_DATA(rta), iface->link.hwaddr_len);
+            break;
+        }
+        case IFLA_STATS64:
+            stats64 = rta;
+            break;
+        case IFLA_STATS:
+            stats32 = rta;
+            break;
+        }
+    }
+
+    /* Prefer the 64-bit counters; older kernels only have 32-bit ones. */
+    struct ifshow_stats *st = &iface->stats;
+    if (stats64 != NULL) {
+        struct rtnl_link_stats64 k;
+        copy_attr(&k, sizeof(k), stats64);
+        st->rx_bytes = k.rx_bytes;
+        st->rx_packets = k.rx_packets;
+        st->rx_errors = k.rx_errors;
+        st->rx_dropped = k.rx_dropped;
+        st->tx_bytes = k.tx_bytes;
+        st->tx_packets = k.tx_packets;
+        st->tx_errors = k.tx_errors;
+        st->tx_dropped = k.tx_dropped;
+    } else if (stats32 != NULL) {
+        struct rtnl_link_stats k;
+        copy_attr(&k, sizeof(k), stats32);
+        st->rx_bytes = k.rx_bytes;
+        st->rx_packets = k.rx_packets;
+        st->rx_errors = k.rx_errors;
+        st->rx_dropped = k.rx_dropped;
+        st->tx_bytes = k.tx_bytes;
+        st->tx_packets = k.tx_packets;
+        st->tx_errors = k.tx_errors;
+        st->tx_dropped = k.tx_dropped;
+    }
+    return 0;
+}
+
+int ifshow_nl_parse_addr(const struct nlmsghdr *nh, struct ifshow_addr *addr) {
+    if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifaddrmsg)))
+        return -1;
+    const struct ifaddrmsg *ifa = NLMSG_DATA(nh);
+    if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+        return -1;
+    int len = (int) IFA_PAYLOAD(nh);
+    size_t alen = ifa->ifa_family == AF_INET ? 4 : 16;
+
+    /* On point-to-point links IFA_ADDRESS is the peer: prefer IFA_LOCAL,
+     * exactly like getifaddrs() does. */
+    const struct rtattr *address = NULL, *local = NULL;
+    for (const struct rtattr *rta = IFA_RTA(ifa); RTA_OK(rta, len); rta = RTA_NEXT(rta, len)) {
+        if (rta->rta_type == IFA_ADDRESS)
+            address = rta;
+        else if (rta->rta_type == IFA_LOCAL)
+            local = rta;
+    }
+    const struct rtattr *chosen = local ? local : address;
+    if (chosen == NULL || RTA_PAYLOAD(chosen) < alen)
+        return -1;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->ifindex = ifa->ifa_index;
+    addr->family = ifa->ifa_family;
+    addr->prefix = ifa->ifa_prefixlen;
+    memcpy(addr->addr, RTA_DATA(chosen), alen);
+    return 0;
+}
+
+/*
+ * receive_dump:
+ *   Read the answer to a dump request until NLMSG_DONE, adding every link or
+ *   address to the snapshot. With stats_only, the snapshot is finalized and
+ *   only the counters of the links it already knows are updated.
+ */
+static int receive_dump(int fd, unsigned int seq, struct ifshow_snapshot *snap, int stats_only) {
+    char buffer[IFSHOW_NL_BUFFER_SIZE] __attribute__((aligned(NLMSG_ALIGNTO)));
+
+    for (;;) {
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return -1;
+
+        int remaining = (int) n;
+        for (struct nlmsghdr *nh = (struct nlmsghdr *) buffer; NLMSG_OK(nh, remaining);
+             nh = NLMSG_NEXT(nh, remaining)) {
+            if (nh->nlmsg_seq != seq)
+                continue;
+            if (nh->nlmsg_type == NLMSG_DONE)
+                return 0;
+            if (nh->nlmsg_type == NLMSG_ERROR)
+                return -1;
+
+            if (nh->nlmsg_type == RTM_NEWLINK) {
+                struct ifshow_iface iface;
+                if (ifshow_nl_parse_link(nh, &iface) < 0)
+                    continue;
+                if (stats_only)
+                    ifshow_snapshot_set_stats(snap, iface.ifindex, &iface.stats);
+                else if (ifshow_snapshot_add_iface(snap, &iface) < 0)
+                    return -1;
+            } else if (nh->nlmsg_type == RTM_NEWADDR && !stats_only) {
+                struct ifshow_addr addr;
+                if (ifshow_nl_parse_addr(nh, &addr) == 0 &&
+                    ifshow_snapshot_add_addr(snap, &addr) < 0)
+                    return -1;
+            }
+        }
+    }
+}
+
+/*
+ * ifshow_snapshot_load_netlink:
+ *   Dump every link, then every address, over a single rtnetlink socket.
+ */
+int ifshow_snapshot_load_netlink(struct ifshow_snapshot *snap) {
+    int fd = ifshow_nl_open();
+    if (fd < 0)
+        return -1;
+
+    int ret = -1;
+    if (ifshow_nl_request_dump(fd, RTM_GETLINK, 1) == 0 && receive_dump(fd, 1, snap, 0) == 0 &&
+        ifshow_nl_request_dump(fd, RTM_GETADDR, 2) == 0 && receive_dump(fd, 2, snap, 0) == 0)
+        ret = ifshow_snapshot_finalize(snap);
+
+    close(fd);
+    return ret;
+}
+
+/*
+ * ifshow_snapshot_load_stats:
+ *   One RTM_GETLINK dump, keeping only the counters.
+ */
+int ifshow_snapshot_load_stats(struct ifshow_snapshot *snap) {
+    int fd = ifshow_nl_open();
+    if (fd < 0)
+        return -1;
+
+    int ret = -1;
+    if (ifshow_nl_request_dump(fd, RTM_GETLINK, 1) == 0 && receive_dump(fd, 1, snap, 1) == 0)
+        ret = 0;
+
+    close(fd);
+    return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef IFSHOW_NETLINK_H
+#define IFSHOW_NETLINK_H
+
+#include "ifshow.h"
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+/* Receive buffer used for netlink dumps and notifications. */
+#define IFSHOW_NL_BUFFER_SIZE 32768
+
+/*
+ * ifshow_nl_open:
+ *   Open and bind a NETLINK_ROUTE socket. Returns the descriptor, or -1.
+ */
+int ifshow_nl_open(void);
+
+/*
+ * ifshow_nl_request_dump:
+ *   Send an NLM_F_DUMP request of the given type (RTM_GETLINK or RTM_GETADDR)
+ *   tagged with seq. Returns 0 on success, -1 on error.
+ */
+int ifshow_nl_request_dump(int fd, int type, unsigned int seq);
+
+/*
+ * ifshow_nl_parse_link:
+ *   Extract the ifindex, name, link state (flags, type, MTU, operational
+ *   state, hardware address) and counters from an RTM_NEWLINK/RTM_DELLINK
+ *   message. Returns 0 on success, -1 if malformed.
+ */
+int ifshow_nl_parse_link(const struct nlmsghdr *nh, struct ifshow_iface *iface);
+
+/*
+ * ifshow_nl_parse_addr:
+ *   Convert an RTM_NEWADDR/RTM_DELADDR message into an ifshow_addr.
+ *   Returns 0 on success, -1 if malformed or not an IPv4/IPv6 address.
+ */
+int ifshow_nl_parse_addr(const struct nlmsghdr *nh, struct ifshow_addr *addr);
+
+#endif /* IFSHOW_NETLINK_H */
@@ -0,0 +1,448 @@
+/*
+ * ifshow_render.c
+ *
+ * Renderers of an ifshow snapshot into caller-provided buffers (see
+ * ifshow_render.h). Nothing here allocates or goes through stdio, so the
+ * same code serves ifshow's own output, the agent's pre-rendered answers
+ * and any tool embedding the library.
+ */
+
+#include "ifshow.h"
+#include "ifshow_render.h"
+
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <net/if_arp.h>
+
+static void out_write(struct ifshow_out *out, const void *data, size_t n) {
+    if (out->len < out->size) {
+        size_t room = out->size - out->len;
+        memcpy(out->buf + out->len, data, n < room ? n : room);
+    }
+    out->len += n;
+}
+
+static void out_str(struct ifshow_out *out, const char *s) {
+    out_write(out, s, strlen(s));
+}
+
+static void out_char(struct ifshow_out *out, char c) {
+    out_write(out, &c, 1);
+}
+
+static void out_uint(struct ifshow_out *out, unsigned long long v) {
+    char digits[24];
+    size_t n = sizeof(digits);
+    do {
+        digits[--n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    out_write(out, digits + n, sizeof(digits) - n);
+}
+
+/* Append the i-th address of snap as text. Returns -1 if it cannot be converted. */
+static int out_addr(struct ifshow_out *out, const struct ifshow_snapshot *snap, size_t i) {
+    char addr_str[INET6_ADDRSTRLEN];
+    if (inet_ntop(snap->addr_family[i], snap->addr_bytes[i], addr_str, sizeof(addr_str)) == NULL)
+        return -1;
+    out_str(out, addr_str);
+    return 0;
+}
+
+/* Append s as a JSON string literal. */
+static void out_json_str(struct ifshow_out *out, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    out_char(out, '"');
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char) *s;
+        if (c == '"' || c == '\\') {
+            out_char(out, '\\');
+            out_char(out, (char) c);
+        } else if (c < 0x20) {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            out_write(out, esc, sizeof(esc));
+        } else {
+            out_char(out, (char) c);
+        }
+    }
+    out_char(out, '"');
+}
+
+/* IFF_* flag names, in bit order (LOWER_UP and up are not in <net/if.h>). */
+static const char *const flag_names[] = {
+    "UP", "BROADCAST", "DEBUG", "LOOPBACK", "POINTOPOINT", "NOTRAILERS", "RUNNING",
+    "NOARP", "PROMISC", "ALLMULTI", "MASTER", "SLAVE", "MULTICAST", "PORTSEL",
+    "AUTOMEDIA", "DYNAMIC", "LOWER_UP", "DORMANT", "ECHO"
+};
+
+/* IF_OPER_* names (RFC 2863). */
+static const char *const operstate_names[] = {
+    "UNKNOWN", "NOTPRESENT", "DOWN", "LOWERLAYERDOWN", "TESTING", "DORMANT", "UP"
+};
+
+static const char *operstate_name(unsigned char operstate) {
+    if (operstate < sizeof(operstate_names) / sizeof(operstate_names[0]))
+        return operstate_names[operstate];
+    return "UNKNOWN";
+}
+
+/* Append the name of an ARPHRD_* link type, or its number. */
+static void out_link_type(struct ifshow_out *out, unsigned short type) {
+    static const struct {
+        unsigned short type;
+        const char    *name;
+    } types[] = {
+        { ARPHRD_ETHER, "ether" }, { ARPHRD_LOOPBACK, "loopback" }, { ARPHRD_NONE, "none" },
+        { ARPHRD_TUNNEL, "ipip" }, { ARPHRD_TUNNEL6, "tunnel6" }, { ARPHRD_SIT, "sit" },
+        { ARPHRD_IPGRE, "gre" }, { ARPHRD_INFINIBAND, "infiniband" }
+    };
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        if (types[i].type == type) {
+            out_str(out, types[i].name);
+            return;
+        }
+    }
+    out_uint(out, type);
+}
+
+/* Append the hardware address as colon-separated hex bytes. */
+static void out_hwaddr(struct ifshow_out *out, const struct ifshow_link *link) {
+    static const char hex[] = "0123456789abcdef";
+    for (size_t i = 0; i < link->hwaddr_len && i < IFSHOW_HWADDR_MAX; i++) {
+        char byte[3] = { ':', hex[link->hwaddr[i] >> 4], hex[link->hwaddr[i] & 15] };
+        out_write(out, i == 0 ? byte + 1 : byte, i == 0 ? 2 : 3);
+    }
+}
+
+/* Text */
+
+/* One address line; returns -1 (having written nothing) if it cannot be converted. */
+static int text_addr(const struct ifshow_snapshot *snap, size_t j, const char *indent,
+                     struct ifshow_out *out) {
+    size_t mark = out->len;
+    out_str(out, indent);
+    if (out_addr(out, snap, j) < 0) {
+        out->len = mark;
+        return -1;
+    }
+    out_char(out, '/');
+    out_uint(out, snap->addr_prefix[j]);
+    out_char(out, '\n');
+    return 0;
+}
+
+static void text_counters(struct ifshow_out *out, const char *dir, unsigned long long bytes,
+                          unsigned long long packets, unsigned long long errors,
+                          unsigned long long dropped) {
+    out_str(out, dir);
+    out_str(out, " bytes ");
+    out_uint(out, bytes);
+    out_str(out, " packets ");
+    out_uint(out, packets);
+    out_str(out, " errors ");
+    out_uint(out, errors);
+    out_str(out, " dropped ");
+    out_uint(out, dropped);
+    out_char(out, '\n');
+}
+
+/*
+ * text_block:
+ *   One interface with the requested details, as listed by "all".
+ */
+static void text_block(const struct ifshow_snapshot *snap, const struct ifshow_iface *iface,
+                       unsigned int detail, struct ifshow_out *out) {
+    const struct ifshow_link *link = &iface->link;
+    out_str(out, iface->name);
+    out_char(out, ':');
+    if (detail & IFSHOW_DETAIL_LINK) {
+        out_str(out, " <");
+        int first = 1;
+        for (size_t b = 0; b < sizeof(flag_names) / sizeof(flag_names[0]); b++) {
+            if (link->flags & (1u << b)) {
+                if (!first)
+                    out_char(out, ',');
+                out_str(out, flag_names[b]);
+                first = 0;
+            }
+        }
+        out_char(out, '>');
+        if (link->mtu != 0) {
+            out_str(out, " mtu ");
+            out_uint(out, link->mtu);
+        }
+        out_str(out, " state ");
+        out_str(out, operstate_name(link->operstate));
+    }
+    out_char(out, '\n');
+
+    if (detail & IFSHOW_DETAIL_LINK) {
+        out_str(out, "  link/");
+        out_link_type(out, link->type);
+        if (link->hwaddr_len > 0) {
+            out_char(out, ' ');
+            out_hwaddr(out, link);
+        }
+        out_char(out, '\n');
+    }
+    for (size_t j = iface->first_addr; j < iface->first_addr + iface->addr_count; j++)
+        text_addr(snap, j, "  ", out);
+    if (detail & IFSHOW_DETAIL_STATS) {
+        const struct ifshow_stats *st = &iface->stats;
+        text_counters(out, "  RX:", st->rx_bytes, st->rx_packets, st->rx_errors, st->rx_dropped);
+        text_counters(out, "  TX:", st->tx_bytes, st->tx_packets, st->tx_errors, st->tx_dropped);
+    }
+}
+
+static void text_all(const struct ifshow_snapshot *snap, unsigned int detail, struct ifshow_out *out) {
+    for (size_t i = 0; i < snap->iface_count; i++) {
+        if (detail == 0 && snap->ifaces[i].addr_count == 0)
+            continue;
+        text_block(snap, &snap->ifaces[i], detail, out);
+    }
+}
+
+static void text_iface(const struct ifshow_snapshot *snap, const char *ifname, unsigned int detail,
+                       struct ifshow_out *out) {
+    const struct ifshow_iface *iface = ifshow_snapshot_find(snap, ifname);
+    if (detail != 0) {
+        if (iface != NULL) {
+            text_block(snap, iface, detail, out);
+        } else {
+            out_str(out, "Interface '");
+            out_str(out, ifname);
+            out_str(out, "' not found.\n");
+        }
+        return;
+    }
+    if (iface == NULL || iface->addr_count == 0) {
+        out_str(out, "Interface '");
+        out_str(out, ifname);
+        out_str(out, "' not found or has no IP addresses.\n");
+        return;
+    }
+    for (size_t j = iface->first_addr; j < iface->first_addr + iface->addr_count; j++)
+        text_addr(snap, j, "", out);
+}
+
+const struct ifshow_renderer ifshow_text_renderer = { "text", text_all, text_iface };
+
+/* JSON */
+
+static void json_field(struct ifshow_out *out, const char *name, unsigned long long value) {
+    out_str(out, ",\"");
+    out_str(out, name);
+    out_str(out, "\":");
+    out_uint(out, value);
+}
+
+static void json_link(const struct ifshow_link *link, struct ifshow_out *out) {
+    out_str(out, ",\"link\":{\"flags\":[");
+    int first = 1;
+    for (size_t b = 0; b < sizeof(flag_names) / sizeof(flag_names[0]); b++) {
+        if (link->flags & (1u << b)) {
+            if (!first)
+                out_char(out, ',');
+            out_char(out, '"');
+            out_str(out, flag_names[b]);
+            out_char(out, '"');
+            first = 0;
+        }
+    }
+    out_str(out, "],\"state\":\"");
+    out_str(out, operstate_name(link->operstate));
+    out_char(out, '"');
+    json_field(out, "mtu", link->mtu);
+    out_str(out, ",\"type\":\"");
+    out_link_type(out, link->type);
+    out_str(out, "\",\"address\":\"");
+    out_hwaddr(out, link);
+    out_str(out, "\"}");
+}
+
+static void json_stats(const struct ifshow_stats *st, struct ifshow_out *out) {
+    out_str(out, ",\"stats\":{\"rx_bytes\":");
+    out_uint(out, st->rx_bytes);
+    json_field(out, "rx_packets", st->rx_packets);
+    json_field(out, "rx_errors", st->rx_errors);
+    json_field(out, "rx_dropped", st->rx_dropped);
+    json_field(out, "tx_bytes", st->tx_bytes);
+    json_field(out, "tx_packets", st->tx_packets);
+    json_field(out, "tx_errors", st->tx_errors);
+    json_field(out, "tx_dropped", st->tx_dropped);
+    out_char(out, '}');
+}
+
+static void json_iface_object(const struct ifshow_snapshot *snap, const struct ifshow_iface *iface,
+                              unsigned int detail, struct ifshow_out *out) {
+    out_str(out, "{\"name\":");
+    out_json_str(out, iface->name);
+    out_str(out, ",\"ifindex\":");
+    out_uint(out, iface->ifindex);
+    if (detail & IFSHOW_DETAIL_LINK)
+        json_link(&iface->link, out);
+    if (detail & IFSHOW_DETAIL_STATS)
+        json_stats(&iface->stats, out);
+    out_str(out, ",\"addresses\":[");
+    int first = 1;
+    for (size_t j = iface->first_addr; j < iface->first_addr + iface->addr_count; j++) {
+        size_t mark = out->len;
+        out_str(out, first ? "{\"family\":\"" : ",{\"family\":\"");
+        out_str(out, snap->addr_family[j] == AF_INET ? "inet" : "inet6");
+        out_str(out, "\",\"address\":\"");
+        if (out_addr(out, snap, j) < 0) {
+            out->len = mark;
+            continue;
+        }
+        out_str(out, "\",\"prefix\":");
+        out_uint(out, snap->addr_prefix[j]);
+        out_char(out, '}');
+        first = 0;
+    }
+    out_str(out, "]}");
+}
+
+static void json_begin(const struct ifshow_snapshot *snap, struct ifshow_out *out) {
+    out_str(out, "{\"generation\":");
+    out_uint(out, snap->generation);
+    out_str(out, ",\"interfaces\":[");
+}
+
+static void json_all(const struct ifshow_snapshot *snap, unsigned int detail, struct ifshow_out *out) {
+    json_begin(snap, out);
+    int first = 1;
+    for (size_t i = 0; i < snap->iface_count; i++) {
+        if (detail == 0 && snap->ifaces[i].addr_count == 0)
+            continue;
+        if (!first)
+            out_char(out, ',');
+        json_iface_object(snap, &snap->ifaces[i], detail, out);
+        first = 0;
+    }
+    out_str(out, "]}\n");
+}
+
+static void json_iface(const struct ifshow_snapshot *snap, const char *ifname, unsigned int detail,
+                       struct ifshow_out *out) {
+    json_begin(snap, out);
+    const struct ifshow_iface *iface = ifshow_snapshot_find(snap, ifname);
+    if (iface != NULL)
+        json_iface_object(snap, iface, detail, out);
+    out_str(out, "]}\n");
+}
+
+const struct ifshow_renderer ifshow_json_renderer = { "json", json_all, json_iface };
+
+/* Binary */
+
+static void bin_header(const struct ifshow_snapshot *snap, size_t ifaces, size_t addrs,
+                       unsigned int detail, struct ifshow_out *out) {
+    struct ifshow_bin_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = htonl(IFSHOW_BIN_MAGIC);
+    hdr.version = htons(IFSHOW_BIN_VERSION);
+    hdr.detail = htons((uint16_t) detail);
+    hdr.iface_count = htonl((uint32_t) ifaces);
+    hdr.addr_count = htonl((uint32_t) addrs);
+    hdr.generation = htobe64((uint64_t) snap->generation);
+    out_write(out, &hdr, sizeof(hdr));
+}
+
+/* The records of iface: interface, link and stats (as requested), addresses. */
+static void bin_iface_records(const struct ifshow_snapshot *snap, const struct ifshow_iface *iface,
+                              unsigned int detail, struct ifshow_out *out) {
+    struct ifshow_bin_iface rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.ifindex = htonl(iface->ifindex);
+    rec.addr_count = htonl((uint32_t) iface->addr_count);
+    strncpy(rec.name, iface->name, sizeof(rec.name));
+    out_write(out, &rec, sizeof(rec));
+
+    if (detail & IFSHOW_DETAIL_LINK) {
+        struct ifshow_bin_link l;
+        memset(&l, 0, sizeof(l));
+        l.flags = htonl(iface->link.flags);
+        l.mtu = htonl(iface->link.mtu);
+        l.type = htons(iface->link.type);
+        l.operstate = iface->link.operstate;
+        l.hwaddr_len = iface->link.hwaddr_len;
+        memcpy(l.hwaddr, iface->link.hwaddr, sizeof(l.hwaddr));
+        out_write(out, &l, sizeof(l));
+    }
+    if (detail & IFSHOW_DETAIL_STATS) {
+        const struct ifshow_stats *st = &iface->stats;
+        struct ifshow_bin_stats b;
+        b.rx_bytes = htobe64(st->rx_bytes);
+        b.rx_packets = htobe64(st->rx_packets);
+        b.rx_errors = htobe64(st->rx_errors);
+        b.rx_dropped = htobe64(st->rx_dropped);
+        b.tx_bytes = htobe64(st->tx_bytes);
+        b.tx_packets = htobe64(st->tx_packets);
+        b.tx_errors = htobe64(st->tx_errors);
+        b.tx_dropped = htobe64(st->tx_dropped);
+        out_write(out, &b, sizeof(b));
+    }
+
+    for (size_t j = iface->first_addr; j < iface->first_addr + iface->addr_count; j++) {
+        struct ifshow_bin_addr a;
+        memset(&a, 0, sizeof(a));
+        a.ifindex = htonl(snap->addr_ifindex[j]);
+        a.family = snap->addr_family[j] == AF_INET ? IFSHOW_BIN_FAMILY_INET : IFSHOW_BIN_FAMILY_INET6;
+        a.prefix = snap->addr_prefix[j];
+        memcpy(a.addr, snap->addr_bytes[j], sizeof(a.addr));
+        out_write(out, &a, sizeof(a));
+    }
+}
+
+static void bin_all(const struct ifshow_snapshot *snap, unsigned int detail, struct ifshow_out *out) {
+    size_t listed = 0;
+    for (size_t i = 0; i < snap->iface_count; i++) {
+        if (detail != 0 || snap->ifaces[i].addr_count > 0)
+            listed++;
+    }
+    bin_header(snap, listed, snap->addr_count, detail, out);
+    for (size_t i = 0; i < snap->iface_count; i++) {
+        if (detail != 0 || snap->ifaces[i].addr_count > 0)
+            bin_iface_records(snap, &snap->ifaces[i], detail, out);
+    }
+}
+
+static void bin_iface(const struct ifshow_snapshot *snap, const char *ifname, unsigned int detail,
+                      struct ifshow_out *out) {
+    const struct ifshow_iface *iface = ifshow_snapshot_find(snap, ifname);
+    if (iface == NULL) {
+        bin_header(snap, 0, 0, detail, out);
+        return;
+    }
+    bin_header(snap, 1, iface->addr_count, detail, out);
+    bin_iface_records(snap, iface, detail, out);
+}
+
+const struct ifshow_renderer ifshow_binary_renderer = { "binary", bin_all, bin_iface };
+
+const struct ifshow_renderer *ifshow_renderer_find(const char *name) {
+    static const struct ifshow_renderer *const renderers[] = {
+        &ifshow_text_renderer, &ifshow_json_renderer, &ifshow_binary_renderer
+    };
+    for (size_t i = 0; i < sizeof(renderers) / sizeof(renderers[0]); i++) {
+        if (strcmp(renderers[i]->name, name) == 0)
+            return renderers[i];
+    }
+    return NULL;
+}
+
+size_t ifshow_render_all(const struct ifshow_renderer *r, const struct ifshow_snapshot *snap,
+                         unsigned int detail, char *buf, size_t size) {
+    struct ifshow_out out = { buf, size, 0 };
+    r->all(snap, detail & (IFSHOW_DETAIL_LINK | IFSHOW_DETAIL_STATS), &out);
+    return out.len;
+}
+
+size_t ifshow_render_iface(const struct ifshow_renderer *r, const struct ifshow_snapshot *snap,
+                           const char *ifname, unsigned int detail, char *buf, size_t size) {
+    struct ifshow_out out = { buf, size, 0 };
+    r->iface(snap, ifname, detail & (IFSHOW_DETAIL_LINK | IFSHOW_DETAIL_STATS), &out);
+    return out.len;
+}
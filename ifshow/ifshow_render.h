@@ -0,0 +1,147 @@
+#ifndef IFSHOW_RENDER_H
+#define IFSHOW_RENDER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct ifshow_snapshot;
+
+/*
+ * struct ifshow_out:
+ *   Caller-provided output buffer. Renderers write at most size bytes into
+ *   buf (no terminating NUL) but keep counting in len, so after a call len
+ *   is the size of the complete rendering, like snprintf().
+ */
+struct ifshow_out {
+    char  *buf;
+    size_t size;
+    size_t len;
+};
+
+/*
+ * Optional parts of a rendering (the detail argument of the renderers):
+ *   IFSHOW_DETAIL_LINK  : link state, flags, MTU and hardware address
+ *   IFSHOW_DETAIL_STATS : rx/tx byte, packet, error and drop counters
+ * With any of them, "all" lists every interface, not only those with an
+ * address.
+ */
+#define IFSHOW_DETAIL_LINK  0x0001
+#define IFSHOW_DETAIL_STATS 0x0002
+
+/*
+ * struct ifshow_renderer:
+ *   A rendering of a snapshot:
+ *     all   : every interface that has at least one address (the "ALL" answer)
+ *     iface : a single interface, or the renderer's "not found" answer
+ *   Renderers only read the snapshot and append to out; new ones can be
+ *   written against the same interface.
+ */
+struct ifshow_renderer {
+    const char *name;
+    void (*all)(const struct ifshow_snapshot *snap, unsigned int detail, struct ifshow_out *out);
+    void (*iface)(const struct ifshow_snapshot *snap, const char *ifname, unsigned int detail,
+                  struct ifshow_out *out);
+};
+
+/*
+ * Built-in renderers:
+ *   text   : the classic ifshow output ("eth0:\n  192.0.2.1/24\n"). With
+ *            details every interface is a block: a header line (flags, MTU
+ *            and state with IFSHOW_DETAIL_LINK), a link/<type> line, the
+ *            addresses, then RX:/TX: counter lines with IFSHOW_DETAIL_STATS.
+ *   json   : {"generation":N,"interfaces":[{"name":..,"ifindex":..,
+ *            "addresses":[{"family":"inet"|"inet6","address":..,"prefix":..}]}]}
+ *            plus "link" and "stats" objects per interface when requested.
+ *            An unknown interface gives an empty "interfaces" array.
+ *   binary : the fixed-size records described below.
+ */
+extern const struct ifshow_renderer ifshow_text_renderer;
+extern const struct ifshow_renderer ifshow_json_renderer;
+extern const struct ifshow_renderer ifshow_binary_renderer;
+
+/*
+ * ifshow_renderer_find:
+ *   Look a built-in renderer up by name ("text", "json", "binary").
+ *   Returns NULL if there is none.
+ */
+const struct ifshow_renderer *ifshow_renderer_find(const char *name);
+
+/*
+ * ifshow_render_all / ifshow_render_iface:
+ *   Render into buf (size bytes, may be 0 to only measure). Returns the
+ *   length of the complete rendering; if it is larger than size the output
+ *   was truncated and the call can be repeated with a large enough buffer.
+ */
+size_t ifshow_render_all(const struct ifshow_renderer *r, const struct ifshow_snapshot *snap,
+                         unsigned int detail, char *buf, size_t size);
+size_t ifshow_render_iface(const struct ifshow_renderer *r, const struct ifshow_snapshot *snap,
+                           const char *ifname, unsigned int detail, char *buf, size_t size);
+
+/*
+ * Binary rendering: one ifshow_bin_header, then for every interface one
+ * ifshow_bin_iface record, its ifshow_bin_link and ifshow_bin_stats records
+ * when the header's detail field has IFSHOW_DETAIL_LINK / _STATS, and its
+ * addr_count ifshow_bin_addr records. Every record is a multiple of 8 bytes
+ * long, so all of them are 8-byte aligned relative to the start of the
+ * buffer; all integers are in network byte order. Addresses are raw (4
+ * significant bytes for IPv4, 16 for IPv6), so readers need neither
+ * inet_ntop() nor text parsing. An unknown interface yields a header with
+ * no interface record.
+ */
+#define IFSHOW_BIN_MAGIC   0x49464e42u   /* "IFNB" */
+#define IFSHOW_BIN_VERSION 1
+
+#define IFSHOW_BIN_FAMILY_INET  4
+#define IFSHOW_BIN_FAMILY_INET6 6
+
+struct ifshow_bin_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t detail;        /* IFSHOW_DETAIL_* records present */
+    uint32_t iface_count;
+    uint32_t addr_count;
+    uint64_t generation;
+};
+
+struct ifshow_bin_iface {
+    uint32_t ifindex;
+    uint32_t addr_count;
+    char     name[16];      /* NUL-padded */
+};
+
+struct ifshow_bin_addr {
+    uint32_t ifindex;
+    uint8_t  family;        /* IFSHOW_BIN_FAMILY_INET or IFSHOW_BIN_FAMILY_INET6 */
+    uint8_t  prefix;
+    uint16_t reserved;
+    uint8_t  addr[16];
+};
+
+struct ifshow_bin_link {
+    uint32_t flags;
+    uint32_t mtu;
+    uint16_t type;
+    uint8_t  operstate;
+    uint8_t  hwaddr_len;
+    uint32_t reserved;
+    uint8_t  hwaddr[32];
+};
+
+struct ifshow_bin_stats {
+    uint64_t rx_bytes;
+    uint64_t rx_packets;
+    uint64_t rx_errors;
+    uint64_t rx_dropped;
+    uint64_t tx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_errors;
+    uint64_t tx_dropped;
+};
+
+_Static_assert(sizeof(struct ifshow_bin_header) == 24, "binary header layout");
+_Static_assert(sizeof(struct ifshow_bin_iface) == 24, "binary interface layout");
+_Static_assert(sizeof(struct ifshow_bin_addr) == 24, "binary address layout");
+_Static_assert(sizeof(struct ifshow_bin_link) == 48, "binary link layout");
+_Static_assert(sizeof(struct ifshow_bin_stats) == 64, "binary stats layout");
+
+#endif /* IFSHOW_RENDER_H */
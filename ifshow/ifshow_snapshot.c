@@ -0,0 +1,549 @@
+#include "ifshow.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netpacket/packet.h>
+#include <linux/if_link.h>
+
+/*
+ * grow_array:
+ *   Make sure *array (of elements of size elem) can hold at least need
+ *   elements, doubling its capacity as required.
+ */
+static int grow_array(void **array, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap)
+        return 0;
+    size_t new_cap = *cap ? *cap : 16;
+    while (new_cap < need)
+        new_cap *= 2;
+    void *p = realloc(*array, new_cap * elem);
+    if (p == NULL)
+        return -1;
+    *array = p;
+    *cap = new_cap;
+    return 0;
+}
+
+/*
+ * copy_name:
+ *   Copy an interface name into a name field, truncated to IF_NAMESIZE - 1
+ *   characters and always terminated.
+ */
+static void copy_name(char dst[IF_NAMESIZE], const char *src) {
+    size_t len = strnlen(src, IF_NAMESIZE - 1);
+    memcpy(dst, src, len);
+    dst[len] = '\0';
+}
+
+/* FNV-1a */
+static size_t hash_name(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name != '\0'; name++) {
+        h ^= (unsigned char) *name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t hash_ifindex(unsigned int ifindex) {
+    return (size_t)(ifindex * 2654435761u);
+}
+
+/* Slots for count interfaces, with at most half of them in use. */
+static size_t slot_capacity(size_t count) {
+    size_t cap = 16;
+    while (cap < 2 * (count + 1))
+        cap *= 2;
+    return cap;
+}
+
+static void insert_name(size_t *slots, size_t cap, const struct ifshow_iface *ifaces, size_t pos) {
+    size_t mask = cap - 1;
+    size_t h = hash_name(ifaces[pos].name) & mask;
+    while (slots[h] != 0)
+        h = (h + 1) & mask;
+    slots[h] = pos + 1;
+}
+
+static void insert_ifindex(size_t *slots, size_t cap, const struct ifshow_iface *ifaces, size_t pos) {
+    size_t mask = cap - 1;
+    size_t h = hash_ifindex(ifaces[pos].ifindex) & mask;
+    while (slots[h] != 0)
+        h = (h + 1) & mask;
+    slots[h] = pos + 1;
+}
+
+/*
+ * arena_reserve:
+ *   Empty the arena and make sure it can hold size bytes. The block is only
+ *   replaced when it is too small, so a recycled snapshot does not allocate.
+ */
+static int arena_reserve(struct ifshow_arena *arena, size_t size) {
+    arena->used = 0;
+    if (size <= arena->cap)
+        return 0;
+    unsigned char *p = malloc(size);
+    if (p == NULL)
+        return -1;
+    free(arena->base);
+    arena->base = p;
+    arena->cap = size;
+    return 0;
+}
+
+static void *arena_take(struct ifshow_arena *arena, size_t size, size_t align) {
+    size_t off = (arena->used + align - 1) & ~(align - 1);
+    arena->used = off + size;
+    return arena->base + off;
+}
+
+/*
+ * builder_rehash:
+ *   Index the builder's interfaces by name (used while loading from
+ *   getifaddrs(), which reports one entry per address).
+ */
+static int builder_rehash(struct ifshow_builder *b) {
+    size_t cap = slot_capacity(b->iface_count);
+    if (cap > b->slot_cap) {
+        size_t *slots = realloc(b->name_slots, cap * sizeof(size_t));
+        if (slots == NULL)
+            return -1;
+        b->name_slots = slots;
+        b->slot_cap = cap;
+    }
+    memset(b->name_slots, 0, b->slot_cap * sizeof(size_t));
+    for (size_t i = 0; i < b->iface_count; i++)
+        insert_name(b->name_slots, b->slot_cap, b->ifaces, i);
+    b->hashed = 1;
+    return 0;
+}
+
+static const struct ifshow_iface *builder_find_name(const struct ifshow_builder *b, const char *name) {
+    size_t mask = b->slot_cap - 1;
+    for (size_t h = hash_name(name) & mask; b->name_slots[h] != 0; h = (h + 1) & mask) {
+        const struct ifshow_iface *iface = &b->ifaces[b->name_slots[h] - 1];
+        if (strcmp(iface->name, name) == 0)
+            return iface;
+    }
+    return NULL;
+}
+
+/*
+ * builder_position:
+ *   Binary search on the builder's interfaces, which are sorted by ifindex
+ *   once finalized. Returns the position of ifindex, or where to insert it.
+ */
+static size_t builder_position(const struct ifshow_builder *b, unsigned int ifindex) {
+    size_t lo = 0, hi = b->iface_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b->ifaces[mid].ifindex < ifindex)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+void ifshow_snapshot_init(struct ifshow_snapshot *snap) {
+    memset(snap, 0, sizeof(*snap));
+}
+
+void ifshow_snapshot_reset(struct ifshow_snapshot *snap) {
+    snap->iface_count = 0;
+    snap->addr_count = 0;
+    snap->slot_cap = 0;
+    snap->arena.used = 0;
+    snap->build.iface_count = 0;
+    snap->build.addr_count = 0;
+    snap->build.hashed = 0;
+}
+
+void ifshow_snapshot_free(struct ifshow_snapshot *snap) {
+    free(snap->arena.base);
+    free(snap->build.ifaces);
+    free(snap->build.addrs);
+    free(snap->build.name_slots);
+    memset(snap, 0, sizeof(*snap));
+}
+
+/* Pointer p of src's arena, moved to the same offset in dst's arena. */
+#define REBASE(dst, src, p) \
+    ((void *)((dst)->arena.base + ((const unsigned char *)(src)->p - (src)->arena.base)))
+
+int ifshow_snapshot_copy(struct ifshow_snapshot *dst, const struct ifshow_snapshot *src) {
+    /* Keep dst's arena for the copy; everything else is replaced. */
+    struct ifshow_arena arena = dst->arena;
+    free(dst->build.ifaces);
+    free(dst->build.addrs);
+    free(dst->build.name_slots);
+    ifshow_snapshot_init(dst);
+    dst->arena = arena;
+    dst->arena.used = 0;
+    if (src->arena.base == NULL || src->slot_cap == 0)
+        return 0;
+    if (arena_reserve(&dst->arena, src->arena.used) < 0)
+        return -1;
+    memcpy(dst->arena.base, src->arena.base, src->arena.used);
+    dst->arena.used = src->arena.used;
+
+    dst->iface_count = src->iface_count;
+    dst->addr_count = src->addr_count;
+    dst->slot_cap = src->slot_cap;
+    dst->generation = src->generation;
+    dst->ifaces = REBASE(dst, src, ifaces);
+    dst->name_slots = REBASE(dst, src, name_slots);
+    dst->index_slots = REBASE(dst, src, index_slots);
+    dst->addr_ifindex = REBASE(dst, src, addr_ifindex);
+    dst->addr_bytes = REBASE(dst, src, addr_bytes);
+    dst->addr_family = REBASE(dst, src, addr_family);
+    dst->addr_prefix = REBASE(dst, src, addr_prefix);
+    return 0;
+}
+
+int ifshow_snapshot_add_iface(struct ifshow_snapshot *snap, const struct ifshow_iface *iface) {
+    struct ifshow_builder *b = &snap->build;
+    if (grow_array((void **)&b->ifaces, &b->iface_cap, b->iface_count + 1,
+                   sizeof(struct ifshow_iface)) < 0)
+        return -1;
+    struct ifshow_iface *added = &b->ifaces[b->iface_count++];
+    memset(added, 0, sizeof(*added));
+    added->ifindex = iface->ifindex;
+    copy_name(added->name, iface->name);
+    added->link = iface->link;
+    added->stats = iface->stats;
+
+    /* Keep the name index up to date while loading. */
+    if (b->hashed) {
+        if (2 * b->iface_count > b->slot_cap)
+            return builder_rehash(b);
+        insert_name(b->name_slots, b->slot_cap, b->ifaces, b->iface_count - 1);
+    }
+    return 0;
+}
+
+int ifshow_snapshot_add_addr(struct ifshow_snapshot *snap, const struct ifshow_addr *addr) {
+    struct ifshow_builder *b = &snap->build;
+    if (grow_array((void **)&b->addrs, &b->addr_cap, b->addr_count + 1,
+                   sizeof(struct ifshow_addr)) < 0)
+        return -1;
+    b->addrs[b->addr_count++] = *addr;
+    return 0;
+}
+
+static int compare_ifindex(const void *a, const void *b) {
+    const struct ifshow_iface *ia = a, *ib = b;
+    if (ia->ifindex < ib->ifindex)
+        return -1;
+    return ia->ifindex > ib->ifindex;
+}
+
+/*
+ * ifshow_snapshot_finalize:
+ *   Sort the builder's interfaces by ifindex, then lay the view out in the
+ *   arena: the interfaces, their hash index, and the addresses regrouped per
+ *   interface with a stable counting pass, so each interface keeps the
+ *   kernel order of its addresses. Addresses that belong to no known
+ *   interface are dropped (from the builder too).
+ */
+int ifshow_snapshot_finalize(struct ifshow_snapshot *snap) {
+    struct ifshow_builder *b = &snap->build;
+    size_t n = b->iface_count;
+    if (n > 1)
+        qsort(b->ifaces, n, sizeof(struct ifshow_iface), compare_ifindex);
+    b->hashed = 0;
+
+    /* Everything fits in one block; b->addr_count bounds the kept addresses. */
+    size_t cap = slot_capacity(n);
+    size_t size = n * sizeof(struct ifshow_iface) + 2 * cap * sizeof(size_t) +
+                  b->addr_count * (sizeof(unsigned int) + IFSHOW_ADDR_MAX + 2) + 64;
+    if (arena_reserve(&snap->arena, size) < 0) {
+        ifshow_snapshot_reset(snap);
+        return -1;
+    }
+
+    snap->ifaces = arena_take(&snap->arena, n * sizeof(struct ifshow_iface),
+                              _Alignof(struct ifshow_iface));
+    snap->name_slots = arena_take(&snap->arena, cap * sizeof(size_t), _Alignof(size_t));
+    snap->index_slots = arena_take(&snap->arena, cap * sizeof(size_t), _Alignof(size_t));
+    snap->iface_count = n;
+    snap->slot_cap = cap;
+    if (n > 0)
+        memcpy(snap->ifaces, b->ifaces, n * sizeof(struct ifshow_iface));
+    memset(snap->name_slots, 0, cap * sizeof(size_t));
+    memset(snap->index_slots, 0, cap * sizeof(size_t));
+    for (size_t i = 0; i < n; i++) {
+        snap->ifaces[i].first_addr = 0;
+        snap->ifaces[i].addr_count = 0;
+        insert_name(snap->name_slots, cap, snap->ifaces, i);
+        insert_ifindex(snap->index_slots, cap, snap->ifaces, i);
+    }
+
+    /* First pass: count addresses per interface, dropping orphans. */
+    size_t kept = 0;
+    for (size_t i = 0; i < b->addr_count; i++) {
+        struct ifshow_iface *iface =
+            (struct ifshow_iface *) ifshow_snapshot_find_index(snap, b->addrs[i].ifindex);
+        if (iface == NULL)
+            continue;
+        iface->addr_count++;
+        b->addrs[kept++] = b->addrs[i];
+    }
+    b->addr_count = kept;
+
+    size_t offset = 0;
+    for (size_t i = 0; i < n; i++) {
+        snap->ifaces[i].first_addr = offset;
+        offset += snap->ifaces[i].addr_count;
+        snap->ifaces[i].addr_count = 0;
+    }
+
+    /* Second pass: scatter each address into its interface's slice. */
+    snap->addr_count = kept;
+    snap->addr_ifindex = arena_take(&snap->arena, kept * sizeof(unsigned int), _Alignof(unsigned int));
+    snap->addr_bytes = arena_take(&snap->arena, kept * IFSHOW_ADDR_MAX, 8);
+    snap->addr_family = arena_take(&snap->arena, kept, 1);
+    snap->addr_prefix = arena_take(&snap->arena, kept, 1);
+    for (size_t i = 0; i < kept; i++) {
+        const struct ifshow_addr *addr = &b->addrs[i];
+        struct ifshow_iface *iface =
+            (struct ifshow_iface *) ifshow_snapshot_find_index(snap, addr->ifindex);
+        size_t k = iface->first_addr + iface->addr_count++;
+        snap->addr_ifindex[k] = addr->ifindex;
+        memcpy(snap->addr_bytes[k], addr->addr, IFSHOW_ADDR_MAX);
+        snap->addr_family[k] = addr->family;
+        snap->addr_prefix[k] = addr->prefix;
+    }
+    return 0;
+}
+
+const struct ifshow_iface *ifshow_snapshot_find(const struct ifshow_snapshot *snap, const char *ifname) {
+    if (snap->slot_cap == 0)
+        return NULL;
+    size_t mask = snap->slot_cap - 1;
+    for (size_t h = hash_name(ifname) & mask; snap->name_slots[h] != 0; h = (h + 1) & mask) {
+        const struct ifshow_iface *iface = &snap->ifaces[snap->name_slots[h] - 1];
+        if (strcmp(iface->name, ifname) == 0)
+            return iface;
+    }
+    return NULL;
+}
+
+const struct ifshow_iface *ifshow_snapshot_find_index(const struct ifshow_snapshot *snap, unsigned int ifindex) {
+    if (snap->slot_cap == 0)
+        return NULL;
+    size_t mask = snap->slot_cap - 1;
+    for (size_t h = hash_ifindex(ifindex) & mask; snap->index_slots[h] != 0; h = (h + 1) & mask) {
+        const struct ifshow_iface *iface = &snap->ifaces[snap->index_slots[h] - 1];
+        if (iface->ifindex == ifindex)
+            return iface;
+    }
+    return NULL;
+}
+
+int ifshow_snapshot_update_iface(struct ifshow_snapshot *snap, const struct ifshow_iface *iface) {
+    struct ifshow_builder *b = &snap->build;
+    size_t pos = builder_position(b, iface->ifindex);
+
+    if (pos < b->iface_count && b->ifaces[pos].ifindex == iface->ifindex) {
+        struct ifshow_iface *cur = &b->ifaces[pos];
+        int changed = 0;
+        if (iface->name[0] != '\0' && strncmp(cur->name, iface->name, sizeof(cur->name) - 1) != 0) {
+            memset(cur->name, 0, sizeof(cur->name));
+            copy_name(cur->name, iface->name);
+            changed = 1;
+        }
+        if (memcmp(&cur->link, &iface->link, sizeof(cur->link)) != 0) {
+            cur->link = iface->link;
+            changed = 1;
+        }
+        cur->stats = iface->stats;
+        return changed;
+    }
+
+    /* Insert at its sorted position. */
+    b->hashed = 0;
+    if (ifshow_snapshot_add_iface(snap, iface) < 0)
+        return -1;
+    struct ifshow_iface added = b->ifaces[b->iface_count - 1];
+    memmove(&b->ifaces[pos + 1], &b->ifaces[pos],
+            (b->iface_count - 1 - pos) * sizeof(struct ifshow_iface));
+    b->ifaces[pos] = added;
+    return 1;
+}
+
+int ifshow_snapshot_remove_iface(struct ifshow_snapshot *snap, unsigned int ifindex) {
+    struct ifshow_builder *b = &snap->build;
+    size_t pos = builder_position(b, ifindex);
+    if (pos == b->iface_count || b->ifaces[pos].ifindex != ifindex)
+        return 0;
+    memmove(&b->ifaces[pos], &b->ifaces[pos + 1],
+            (b->iface_count - pos - 1) * sizeof(struct ifshow_iface));
+    b->iface_count--;
+
+    size_t kept = 0;
+    for (size_t i = 0; i < b->addr_count; i++) {
+        if (b->addrs[i].ifindex != ifindex)
+            b->addrs[kept++] = b->addrs[i];
+    }
+    b->addr_count = kept;
+    return 1;
+}
+
+int ifshow_snapshot_set_stats(struct ifshow_snapshot *snap, unsigned int ifindex,
+                              const struct ifshow_stats *stats) {
+    struct ifshow_iface *iface = (struct ifshow_iface *) ifshow_snapshot_find_index(snap, ifindex);
+    if (iface == NULL)
+        return -1;
+    iface->stats = *stats;
+
+    struct ifshow_builder *b = &snap->build;
+    size_t pos = builder_position(b, ifindex);
+    if (pos < b->iface_count && b->ifaces[pos].ifindex == ifindex)
+        b->ifaces[pos].stats = *stats;
+    return 0;
+}
+
+static int same_addr(const struct ifshow_addr *a, const struct ifshow_addr *b) {
+    if (a->ifindex != b->ifindex || a->family != b->family)
+        return 0;
+    return memcmp(a->addr, b->addr, a->family == AF_INET ? 4 : 16) == 0;
+}
+
+int ifshow_snapshot_update_addr(struct ifshow_snapshot *snap, const struct ifshow_addr *addr) {
+    struct ifshow_builder *b = &snap->build;
+    for (size_t i = 0; i < b->addr_count; i++) {
+        if (same_addr(&b->addrs[i], addr)) {
+            if (b->addrs[i].prefix == addr->prefix)
+                return 0;
+            b->addrs[i].prefix = addr->prefix;
+            return 1;
+        }
+    }
+    return ifshow_snapshot_add_addr(snap, addr) < 0 ? -1 : 1;
+}
+
+int ifshow_snapshot_remove_addr(struct ifshow_snapshot *snap, const struct ifshow_addr *addr) {
+    struct ifshow_builder *b = &snap->build;
+    for (size_t i = 0; i < b->addr_count; i++) {
+        if (same_addr(&b->addrs[i], addr)) {
+            memmove(&b->addrs[i], &b->addrs[i + 1],
+                    (b->addr_count - i - 1) * sizeof(struct ifshow_addr));
+            b->addr_count--;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * add_packet_entry:
+ *   Record the link of an AF_PACKET entry of getifaddrs(): flags, link type,
+ *   hardware address and (32-bit) counters. getifaddrs() reports neither the
+ *   MTU nor the operational state, which are left at 0.
+ */
+static int add_packet_entry(struct ifshow_snapshot *snap, const struct ifaddrs *ifa) {
+    const struct sockaddr_ll *ll = (const struct sockaddr_ll *) ifa->ifa_addr;
+    struct ifshow_iface entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.ifindex = (unsigned int) ll->sll_ifindex;
+    copy_name(entry.name, ifa->ifa_name);
+    entry.link.flags = ifa->ifa_flags;
+    entry.link.type = ll->sll_hatype;
+    entry.link.hwaddr_len = ll->sll_halen < sizeof(ll->sll_addr) ? ll->sll_halen : sizeof(ll->sll_addr);
+    memcpy(entry.link.hwaddr, ll->sll_addr, entry.link.hwaddr_len);
+    if (ifa->ifa_data != NULL) {
+        const struct rtnl_link_stats *st = ifa->ifa_data;
+        entry.stats.rx_bytes = st->rx_bytes;
+        entry.stats.rx_packets = st->rx_packets;
+        entry.stats.rx_errors = st->rx_errors;
+        entry.stats.rx_dropped = st->rx_dropped;
+        entry.stats.tx_bytes = st->tx_bytes;
+        entry.stats.tx_packets = st->tx_packets;
+        entry.stats.tx_errors = st->tx_errors;
+        entry.stats.tx_dropped = st->tx_dropped;
+    }
+
+    struct ifshow_iface *known = (struct ifshow_iface *) builder_find_name(&snap->build, ifa->ifa_name);
+    if (known != NULL) {
+        known->link = entry.link;
+        known->stats = entry.stats;
+        return 0;
+    }
+    return ifshow_snapshot_add_iface(snap, &entry);
+}
+
+/*
+ * ifshow_snapshot_load_ifaddrs:
+ *   Fallback loader based on getifaddrs(), for systems where rtnetlink
+ *   cannot be used. getifaddrs() lists one entry per address (and one
+ *   AF_PACKET entry with the link of each interface), so interfaces are
+ *   deduplicated through the name index in a single pass.
+ */
+int ifshow_snapshot_load_ifaddrs(struct ifshow_snapshot *snap) {
+    struct ifaddrs *ifaddr, *ifa;
+    if (getifaddrs(&ifaddr) == -1)
+        return -1;
+    if (builder_rehash(&snap->build) < 0)
+        goto fail;
+
+    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL)
+            continue;
+        if (ifa->ifa_addr->sa_family == AF_PACKET) {
+            if (add_packet_entry(snap, ifa) < 0)
+                goto fail;
+            continue;
+        }
+        if (ifa->ifa_addr->sa_family != AF_INET && ifa->ifa_addr->sa_family != AF_INET6)
+            continue;
+
+        /* Find (or register) the interface this address belongs to. The
+         * snapshot is not sorted yet, so look it up by name. */
+        const struct ifshow_iface *known = builder_find_name(&snap->build, ifa->ifa_name);
+        unsigned int ifindex = known != NULL ? known->ifindex : 0;
+        if (ifindex == 0) {
+            ifindex = if_nametoindex(ifa->ifa_name);
+            if (ifindex == 0)
+                ifindex = 0x80000000u + (unsigned int) snap->build.iface_count;
+            struct ifshow_iface entry;
+            memset(&entry, 0, sizeof(entry));
+            entry.ifindex = ifindex;
+            copy_name(entry.name, ifa->ifa_name);
+            if (ifshow_snapshot_add_iface(snap, &entry) < 0)
+                goto fail;
+        }
+
+        struct ifshow_addr addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.ifindex = ifindex;
+        addr.family = (unsigned char) ifa->ifa_addr->sa_family;
+        if (addr.family == AF_INET)
+            memcpy(addr.addr, &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr, 4);
+        else
+            memcpy(addr.addr, &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr, 16);
+        if (ifa->ifa_netmask != NULL)
+            addr.prefix = (unsigned char) get_prefix_length(ifa->ifa_netmask);
+        if (ifshow_snapshot_add_addr(snap, &addr) < 0)
+            goto fail;
+    }
+
+    freeifaddrs(ifaddr);
+    return ifshow_snapshot_finalize(snap);
+
+fail:
+    freeifaddrs(ifaddr);
+    return -1;
+}
+
+/*
+ * ifshow_snapshot_load:
+ *   Prefer the netlink dump; fall back to getifaddrs() if it fails.
+ */
+int ifshow_snapshot_load(struct ifshow_snapshot *snap) {
+    if (ifshow_snapshot_load_netlink(snap) == 0)
+        return 0;
+    ifshow_snapshot_reset(snap);
+    return ifshow_snapshot_load_ifaddrs(snap);
+}
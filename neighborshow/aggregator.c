@@ -0,0 +1,245 @@
+/*
+ * aggregator.c
+ *
+ * Merging of downstream responses by relaying agents, so that one packed
+ * answer per request travels back towards the client (see aggregator.h).
+ */
+
+#include "aggregator.h"
+#include "neighborshow.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void aggregator_init(struct aggregator *agg) {
+    memset(agg, 0, sizeof(*agg));
+}
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    return h;
+}
+
+/*
+ * grow:
+ *   Make room for one more host, doubling the array and rebuilding the
+ *   index when needed. Returns 0, or -1 on allocation failure.
+ */
+static int grow(struct aggregation *a) {
+    if (a->count < a->cap)
+        return 0;
+    size_t cap = a->cap ? 2 * a->cap : 16;
+    struct agg_host *hosts = realloc(a->hosts, cap * sizeof(*hosts));
+    uint32_t *slots = calloc(2 * cap, sizeof(*slots));
+    if (hosts == NULL || slots == NULL) {
+        if (hosts != NULL)
+            a->hosts = hosts;
+        free(slots);
+        return -1;
+    }
+    a->hosts = hosts;
+    a->cap = cap;
+    free(a->slots);
+    a->slots = slots;
+    a->slot_cap = 2 * cap;
+    for (size_t i = 0; i < a->count; i++) {
+        size_t s = name_hash(a->hosts[i].name) & (a->slot_cap - 1);
+        while (a->slots[s] != 0)
+            s = (s + 1) & (a->slot_cap - 1);
+        a->slots[s] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+/*
+ * add_host:
+ *   Record a host, or shorten the distance of a known one.
+ *   Returns 1 if it is new, 0 if it was known, -1 if it was not recorded.
+ */
+static int add_host(struct aggregation *a, const char *name, const char *addr, unsigned int hops) {
+    if (a->slot_cap > 0) {
+        size_t s = name_hash(name) & (a->slot_cap - 1);
+        for (; a->slots[s] != 0; s = (s + 1) & (a->slot_cap - 1)) {
+            struct agg_host *h = &a->hosts[a->slots[s] - 1];
+            if (strcmp(h->name, name) == 0) {
+                if (hops < h->hops) {
+                    h->hops = hops;
+                    snprintf(h->addr, sizeof(h->addr), "%s", addr);
+                }
+                return 0;
+            }
+        }
+    }
+    if (a->count == AGG_MAX_HOSTS || grow(a) < 0)
+        return -1;
+
+    struct agg_host *h = &a->hosts[a->count];
+    snprintf(h->name, sizeof(h->name), "%s", name);
+    snprintf(h->addr, sizeof(h->addr), "%s", addr);
+    h->hops = hops;
+    size_t s = name_hash(h->name) & (a->slot_cap - 1);
+    while (a->slots[s] != 0)
+        s = (s + 1) & (a->slot_cap - 1);
+    a->slots[s] = (uint32_t)(++a->count);
+    return 1;
+}
+
+int aggregator_start(struct aggregator *agg, uint32_t origin, const char *tag, int id,
+                     const union neighbor_addr *upstream, long long due, const char *own) {
+    if (agg->count == AGG_MAX_PENDING) {
+        agg->overflows++;
+        return -1;
+    }
+    struct aggregation *a = &agg->items[agg->count];
+    memset(a, 0, sizeof(*a));
+    a->origin = origin;
+    a->id = id;
+    if (tag != NULL)
+        snprintf(a->tag, sizeof(a->tag), "%s", tag);
+    a->upstream = *upstream;
+    a->due = due;
+    if (add_host(a, own, "", 0) < 0) {
+        free(a->hosts);
+        free(a->slots);
+        return -1;
+    }
+    agg->count++;
+    agg->started++;
+    return 0;
+}
+
+/*
+ * find:
+ *   The aggregation a response to id belongs to: the one for (origin, id)
+ *   if the response names its origin, else the only one waiting for id.
+ *   NULL if there is none, or several an untagged response could match.
+ */
+static struct aggregation *find(struct aggregator *agg, int tagged, uint32_t origin, int id) {
+    struct aggregation *found = NULL;
+    for (size_t i = 0; i < agg->count; i++) {
+        struct aggregation *a = &agg->items[i];
+        if (a->id != id || (tagged && a->origin != origin))
+            continue;
+        if (tagged)
+            return a;
+        if (found != NULL)
+            return NULL;
+        found = a;
+    }
+    return found;
+}
+
+int aggregator_merge(struct aggregator *agg, int id, const union neighbor_addr *from,
+                     char *entries) {
+    /* "@<origin>" ahead of the entries (see neighborshow.h). */
+    int tagged = 0;
+    uint32_t origin = 0;
+    entries += strspn(entries, " ");
+    if (*entries == '@') {
+        char text[NEIGHBOR_ADDRSTRLEN];
+        union neighbor_addr addr;
+        int consumed = 0;
+        if (sscanf(entries + 1, "%45s%n", text, &consumed) != 1 ||
+            neighbor_addr_pton(text, &addr) != 0) {
+            agg->late++;
+            return -1;
+        }
+        tagged = 1;
+        origin = neighbor_addr_key(&addr);
+        entries += 1 + consumed;
+    }
+    struct aggregation *a = find(agg, tagged, origin, id);
+    if (a == NULL) {
+        agg->late++;
+        return -1;
+    }
+
+    /* Distances in the entries are from the sender, which is one hop from us. */
+    char sender[NEIGHBOR_ADDRSTRLEN];
+    neighbor_addr_ntop(from, sender, sizeof(sender));
+    char *save;
+    for (char *tok = strtok_r(entries, " \r\n", &save); tok != NULL;
+         tok = strtok_r(NULL, " \r\n", &save)) {
+        char name[AGG_NAME_MAX];
+        char ip[NEIGHBOR_ADDRSTRLEN];
+        unsigned int hops = 0;
+        union neighbor_addr addr;
+        if (sscanf(tok, "%63[^,],%45[^,],%u", name, ip, &hops) == 3) {
+            if (neighbor_addr_pton(ip, &addr) != 0)
+                continue;
+        } else if (strchr(tok, ',') == NULL) {
+            snprintf(name, sizeof(name), "%s", tok);
+            snprintf(ip, sizeof(ip), "%s", sender);
+        } else {
+            continue;
+        }
+        int added = add_host(a, name, ip, hops + 1);
+        if (added > 0)
+            agg->merged++;
+        else if (added == 0)
+            agg->duplicates++;
+    }
+    return 0;
+}
+
+int aggregator_timeout(const struct aggregator *agg, long long now_ms) {
+    long long first = -1;
+    for (size_t i = 0; i < agg->count; i++) {
+        if (first < 0 || agg->items[i].due < first)
+            first = agg->items[i].due;
+    }
+    if (first < 0)
+        return -1;
+    return first > now_ms ? (int)(first - now_ms) : 0;
+}
+
+int aggregator_flush(struct aggregator *agg, long long now_ms,
+                     void (*emit)(void *ctx, const union neighbor_addr *to, const char *text),
+                     void *ctx) {
+    size_t i = 0;
+    while (i < agg->count && agg->items[i].due > now_ms)
+        i++;
+    if (i == agg->count)
+        return 0;
+    struct aggregation *a = &agg->items[i];
+
+    /* "NEIGHBOR_RESPONSE <id> [@<origin>] <entry> <entry> ...", split across datagrams. */
+    char text[MAX_BUFFER];
+    int header = a->tag[0] != '\0'
+               ? snprintf(text, sizeof(text), "%s %d @%s", RESPONSE_PREFIX, a->id, a->tag)
+               : snprintf(text, sizeof(text), "%s %d", RESPONSE_PREFIX, a->id);
+    size_t len = (size_t) header;
+    for (size_t k = 0; k < a->count; k++) {
+        const struct agg_host *h = &a->hosts[k];
+        if (h->hops == 0)
+            continue;       /* the relay itself, answered at once */
+        char entry[AGG_NAME_MAX + NEIGHBOR_ADDRSTRLEN + 16];
+        snprintf(entry, sizeof(entry), " %s,%s,%u", h->name, h->addr, h->hops);
+        size_t entry_len = strlen(entry);
+        if (len > (size_t) header && len + entry_len > MAX_BUFFER - 1) {
+            emit(ctx, &a->upstream, text);
+            len = (size_t) header;
+        }
+        memcpy(text + len, entry, entry_len + 1);
+        len += entry_len;
+    }
+    if (len > (size_t) header)
+        emit(ctx, &a->upstream, text);
+
+    free(a->hosts);
+    free(a->slots);
+    agg->items[i] = agg->items[--agg->count];
+    agg->flushed++;
+    return 1;
+}
+
+void aggregator_free(struct aggregator *agg) {
+    for (size_t i = 0; i < agg->count; i++) {
+        free(agg->items[i].hosts);
+        free(agg->items[i].slots);
+    }
+    agg->count = 0;
+}
@@ -0,0 +1,111 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "neighbor_net.h"
+
+/* Requests being relayed at the same time, and hosts collected for one of them. */
+#define AGG_MAX_PENDING 256
+#define AGG_MAX_HOSTS   16384
+
+/* Longest hostname carried in a response entry. */
+#define AGG_NAME_MAX 64
+
+/*
+ * struct agg_host:
+ *   A host heard through a relay: its address (IPv4 or IPv6, as text) and
+ *   its distance in hops from the relay.
+ */
+struct agg_host {
+    char         name[AGG_NAME_MAX];
+    char         addr[NEIGHBOR_ADDRSTRLEN];
+    unsigned int hops;
+};
+
+/*
+ * struct aggregation:
+ *   Downstream answers of a relay for one request (origin, id): the
+ *   responses of the hosts the request was forwarded to, merged and held
+ *   until due. The relay's own entry is recorded too, to recognize it among
+ *   the downstream ones, but it was answered at once and is not sent again.
+ *   tag is the origin the request carried, repeated in the answers sent
+ *   upstream ("" if the request came from its origin). Hosts are
+ *   deduplicated by name through an open-addressing index (slots hold
+ *   position + 1 in hosts[], 0 when empty).
+ */
+struct aggregation {
+    uint32_t            origin;         /* key, see neighbor_addr_key() */
+    int                 id;
+    char                tag[NEIGHBOR_ADDRSTRLEN];
+    union neighbor_addr upstream;
+    long long           due;
+    struct agg_host    *hosts;
+    size_t              count;
+    size_t              cap;
+    uint32_t           *slots;
+    size_t              slot_cap;       /* power of two */
+};
+
+/*
+ * struct aggregator:
+ *   The aggregations in progress, and what they did.
+ */
+struct aggregator {
+    struct aggregation items[AGG_MAX_PENDING];
+    size_t             count;
+    unsigned long long started;
+    unsigned long long merged;          /* downstream hosts added */
+    unsigned long long duplicates;      /* downstream hosts already known */
+    unsigned long long late;            /* responses for no (or no single) aggregation */
+    unsigned long long overflows;       /* not started, AGG_MAX_PENDING reached */
+    unsigned long long flushed;
+};
+
+void aggregator_init(struct aggregator *agg);
+
+/*
+ * aggregator_start:
+ *   Collect the downstream answers to (origin, id) for upstream until due;
+ *   tag is the origin the request carried as text, NULL if it had none, and
+ *   own is the local hostname (0 hops away), whose entry the caller sends
+ *   at once.
+ *   Returns 0, or -1 if too many aggregations are pending (counted in
+ *   overflows) or memory is short.
+ */
+int aggregator_start(struct aggregator *agg, uint32_t origin, const char *tag, int id,
+                     const union neighbor_addr *upstream, long long due, const char *own);
+
+/*
+ * aggregator_merge:
+ *   Add the entries of a response to request id received from addr
+ *   (entries is the text after "NEIGHBOR_RESPONSE <id>", see
+ *   neighborshow.h). A response tagged with its origin goes to the
+ *   aggregation for (origin, id); an untagged one, from an older agent,
+ *   only if a single aggregation is waiting for id.
+ *   Returns 0, or -1 if no aggregation is waiting for it.
+ */
+int aggregator_merge(struct aggregator *agg, int id, const union neighbor_addr *from,
+                     char *entries);
+
+/*
+ * aggregator_timeout:
+ *   Milliseconds until the next aggregation is due, -1 if there is none.
+ */
+int aggregator_timeout(const struct aggregator *agg, long long now_ms);
+
+/*
+ * aggregator_flush:
+ *   Render the next aggregation that is due as response datagrams holding
+ *   every downstream host collected, each datagram at most MAX_BUFFER - 1
+ *   bytes long. emit is called once per datagram, never if no downstream
+ *   host answered. Returns 1 if an aggregation was flushed (and removed),
+ *   0 otherwise.
+ */
+int aggregator_flush(struct aggregator *agg, long long now_ms,
+                     void (*emit)(void *ctx, const union neighbor_addr *to, const char *text),
+                     void *ctx);
+
+void aggregator_free(struct aggregator *agg);
+
+#endif /* AGGREGATOR_H */
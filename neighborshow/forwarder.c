@@ -0,0 +1,188 @@
+/*
+ * forwarder.c
+ *
+ * Delayed, suppressed and rate-limited forwarding of multi-hop discovery
+ * requests (see forwarder.h).
+ */
+
+#include "forwarder.h"
+#include "neighborshow.h"
+#include "log_ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+/* How often the interface list is scanned again. */
+#define FORWARD_SCAN_MS 30000
+
+static struct log_site log_scan = LOG_SITE_INIT("forwarder", 1, 1);
+
+int forwarder_init(struct forwarder *fw, size_t capacity, long long max_delay_ms,
+                   unsigned int threshold, double rate, double burst, long long now_ms) {
+    memset(fw, 0, sizeof(*fw));
+    fw->heap = calloc(capacity, sizeof(struct pending_forward));
+    if (fw->heap == NULL)
+        return -1;
+    fw->capacity = capacity;
+    fw->max_delay_ms = max_delay_ms;
+    fw->threshold = threshold;
+    fw->rate = rate;
+    fw->burst = burst;
+    fw->tokens = burst;
+    fw->refilled_ms = now_ms;
+    forwarder_scan(fw, now_ms, 1);
+    return 0;
+}
+
+int forwarder_scan(struct forwarder *fw, long long now_ms, int force) {
+    if (!force && now_ms - fw->scanned_ms < FORWARD_SCAN_MS)
+        return 0;
+    fw->scanned_ms = now_ms;
+
+    struct ifaddrs *ifaddr;
+    if (neighbor_mcast_ifaces(NEIGHBOR_MCAST4, &fw->mcast4) < 0 ||
+        neighbor_mcast_ifaces(NEIGHBOR_MCAST6, &fw->mcast6) < 0 || getifaddrs(&ifaddr) < 0) {
+        LOG(LOG_LEVEL_ERROR, log_scan, "getifaddrs: %m");
+        return 0;
+    }
+    fw->target_count = 0;
+    fw->local_count = 0;
+    for (struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL)
+            continue;
+        if (ifa->ifa_addr->sa_family == AF_INET6 && fw->local_count < FORWARD_MAX_LOCAL)
+            memcpy(&fw->local[fw->local_count++].sin6, ifa->ifa_addr, sizeof(struct sockaddr_in6));
+        if (ifa->ifa_addr->sa_family != AF_INET)
+            continue;
+        if (fw->local_count < FORWARD_MAX_LOCAL)
+            memcpy(&fw->local[fw->local_count++].sin, ifa->ifa_addr, sizeof(struct sockaddr_in));
+        if (!(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_BROADCAST) ||
+            (ifa->ifa_flags & IFF_LOOPBACK) || ifa->ifa_broadaddr == NULL ||
+            fw->target_count == FORWARD_MAX_TARGETS)
+            continue;
+        struct sockaddr_in *target = &fw->targets[fw->target_count++].sin;
+        memset(target, 0, sizeof(*target));
+        target->sin_family = AF_INET;
+        target->sin_port = htons(NEIGHBOR_PORT);
+        target->sin_addr = ((struct sockaddr_in *) ifa->ifa_broadaddr)->sin_addr;
+    }
+    freeifaddrs(ifaddr);
+
+    if (fw->target_count == 0) {
+        struct sockaddr_in *target = &fw->targets[fw->target_count++].sin;
+        memset(target, 0, sizeof(*target));
+        target->sin_family = AF_INET;
+        target->sin_port = htons(NEIGHBOR_PORT);
+        target->sin_addr.s_addr = htonl(INADDR_BROADCAST);
+    }
+    return 1;
+}
+
+int forwarder_is_local(const struct forwarder *fw, const union neighbor_addr *addr) {
+    for (size_t i = 0; i < fw->local_count; i++) {
+        if (neighbor_addr_same_ip(&fw->local[i], addr))
+            return 1;
+    }
+    return 0;
+}
+
+/* Binary min-heap on due. */
+static void heap_swap(struct forwarder *fw, size_t a, size_t b) {
+    struct pending_forward tmp = fw->heap[a];
+    fw->heap[a] = fw->heap[b];
+    fw->heap[b] = tmp;
+}
+
+static void heap_pop(struct forwarder *fw) {
+    fw->heap[0] = fw->heap[--fw->count];
+    size_t i = 0;
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, min = i;
+        if (l < fw->count && fw->heap[l].due < fw->heap[min].due)
+            min = l;
+        if (r < fw->count && fw->heap[r].due < fw->heap[min].due)
+            min = r;
+        if (min == i)
+            break;
+        heap_swap(fw, i, min);
+        i = min;
+    }
+}
+
+int forwarder_schedule(struct forwarder *fw, uint32_t origin, const char *origin_text, int id,
+                       int hop, enum neighbor_transport transport, long long now_ms) {
+    if (fw->count == fw->capacity) {
+        fw->overflows++;
+        return -1;
+    }
+    size_t i = fw->count++;
+    fw->heap[i].due = now_ms + (fw->max_delay_ms > 0 ? rand() % (fw->max_delay_ms + 1) : 0);
+    fw->heap[i].origin = origin;
+    fw->heap[i].id = id;
+    fw->heap[i].hop = hop;
+    fw->heap[i].transport = transport;
+    snprintf(fw->heap[i].origin_text, sizeof(fw->heap[i].origin_text), "%s", origin_text);
+    while (i > 0 && fw->heap[(i - 1) / 2].due > fw->heap[i].due) {
+        heap_swap(fw, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    fw->scheduled++;
+    return 0;
+}
+
+/* Tokens a forward costs: one per datagram, but never more than a full bucket. */
+static double forward_cost(const struct forwarder *fw, enum neighbor_transport transport) {
+    double cost = (double)(transport == NEIGHBOR_MCAST4 ? fw->mcast4.count :
+                           transport == NEIGHBOR_MCAST6 ? fw->mcast6.count : fw->target_count);
+    return cost < fw->burst ? cost : fw->burst;
+}
+
+static void refill(struct forwarder *fw, long long now_ms) {
+    fw->tokens += (double)(now_ms - fw->refilled_ms) * fw->rate / 1000.0;
+    if (fw->tokens > fw->burst)
+        fw->tokens = fw->burst;
+    fw->refilled_ms = now_ms;
+}
+
+int forwarder_next(struct forwarder *fw, const struct seen_cache *seen, long long now_ms,
+                   struct pending_forward *out) {
+    refill(fw, now_ms);
+    while (fw->count > 0 && fw->heap[0].due <= now_ms) {
+        const struct pending_forward *p = &fw->heap[0];
+        if (fw->threshold > 0 && seen_cache_heard(seen, p->origin, p->id) >= fw->threshold) {
+            fw->suppressed++;
+            heap_pop(fw);
+            continue;
+        }
+        if (fw->tokens < forward_cost(fw, p->transport)) {
+            fw->throttled++;
+            return 0;
+        }
+        fw->tokens -= forward_cost(fw, p->transport);
+        *out = *p;
+        heap_pop(fw);
+        fw->forwarded++;
+        return 1;
+    }
+    return 0;
+}
+
+int forwarder_timeout(const struct forwarder *fw, long long now_ms) {
+    if (fw->count == 0)
+        return -1;
+    if (fw->heap[0].due > now_ms)
+        return (int)(fw->heap[0].due - now_ms);
+    double missing = forward_cost(fw, fw->heap[0].transport) - fw->tokens;
+    if (missing <= 0)
+        return 0;
+    return (int)(missing * 1000.0 / fw->rate) + 1;
+}
+
+void forwarder_free(struct forwarder *fw) {
+    free(fw->heap);
+    fw->heap = NULL;
+}
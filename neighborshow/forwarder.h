@@ -0,0 +1,122 @@
+#ifndef FORWARDER_H
+#define FORWARDER_H
+
+#include "seen_cache.h"
+#include "neighbor_net.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Interfaces whose broadcast address is used for forwards, and local addresses remembered. */
+#define FORWARD_MAX_TARGETS 32
+#define FORWARD_MAX_LOCAL   64
+
+/*
+ * struct pending_forward:
+ *   A request waiting for its randomized forwarding time (due, CLOCK_MONOTONIC
+ *   milliseconds). hop is the hop count to forward it with; origin is the
+ *   seen cache key of the origin (see neighbor_addr_key()) and origin_text
+ *   its address as carried in the request. A request is forwarded the way
+ *   it came: broadcast, or to the same multicast group.
+ */
+struct pending_forward {
+    long long               due;
+    uint32_t                origin;
+    int                     id;
+    int                     hop;
+    enum neighbor_transport transport;
+    char                    origin_text[NEIGHBOR_ADDRSTRLEN];
+};
+
+/*
+ * struct forwarder:
+ *   Broadcast storm control for multi-hop requests. Instead of rebroadcasting
+ *   at once, every agent waits a random delay of up to max_delay_ms; if by
+ *   then it has heard the request forwarded by at least threshold neighbors
+ *   (the seen cache counts them), its own forward would add nothing and is
+ *   suppressed. Forwards that do go out are paced by a token bucket (rate
+ *   datagrams per second, bursts of burst) and sent to the directed broadcast
+ *   address of every broadcast-capable interface, falling back to
+ *   255.255.255.255 when there is none, or to the multicast group on every
+ *   interface in mcast4 or mcast6 (which the agent also joins them on).
+ *
+ *   Pending forwards are a binary min-heap on due. The local addresses (IPv4
+ *   and IPv6) are kept to recognize the agent's own forwards when they loop
+ *   back.
+ */
+struct forwarder {
+    struct pending_forward *heap;
+    size_t                  count;
+    size_t                  capacity;
+    long long               max_delay_ms;
+    unsigned int            threshold;
+    double                  rate;
+    double                  burst;
+    double                  tokens;
+    long long               refilled_ms;
+    union neighbor_addr     targets[FORWARD_MAX_TARGETS];
+    size_t                  target_count;
+    struct neighbor_ifaces  mcast4;
+    struct neighbor_ifaces  mcast6;
+    union neighbor_addr     local[FORWARD_MAX_LOCAL];
+    size_t                  local_count;
+    long long               scanned_ms;
+    unsigned long long      scheduled;
+    unsigned long long      suppressed;
+    unsigned long long      forwarded;
+    unsigned long long      overflows;     /* requests not forwarded, queue full */
+    unsigned long long      throttled;     /* times a due forward waited for tokens */
+};
+
+/*
+ * forwarder_init:
+ *   Prepare a forwarder holding up to capacity pending forwards, and scan the
+ *   interfaces. Returns 0 on success, -1 on allocation failure.
+ */
+int forwarder_init(struct forwarder *fw, size_t capacity, long long max_delay_ms,
+                   unsigned int threshold, double rate, double burst, long long now_ms);
+
+/*
+ * forwarder_schedule:
+ *   Queue a forward of (origin, id) with hop count hop, over transport, at a
+ *   random time within the next max_delay_ms. Returns 0, or -1 if the queue
+ *   is full.
+ */
+int forwarder_schedule(struct forwarder *fw, uint32_t origin, const char *origin_text, int id,
+                       int hop, enum neighbor_transport transport, long long now_ms);
+
+/*
+ * forwarder_next:
+ *   Take the next forward that should be sent now: due forwards that enough
+ *   neighbors already forwarded are dropped on the way, and a forward is only
+ *   returned if the bucket has a token for each datagram it takes (which it
+ *   then consumes). Returns 1 and fills *out, or 0 if nothing can be sent yet.
+ */
+int forwarder_next(struct forwarder *fw, const struct seen_cache *seen, long long now_ms,
+                   struct pending_forward *out);
+
+/*
+ * forwarder_timeout:
+ *   Milliseconds until forwarder_next() may return something, -1 if no
+ *   forward is pending.
+ */
+int forwarder_timeout(const struct forwarder *fw, long long now_ms);
+
+/*
+ * forwarder_scan:
+ *   Refresh the forward targets, multicast interfaces and local addresses
+ *   from getifaddrs() if they are older than FORWARD_SCAN_MS (or force is
+ *   set). Returns 1 if they were refreshed, 0 otherwise.
+ */
+int forwarder_scan(struct forwarder *fw, long long now_ms, int force);
+
+/*
+ * forwarder_is_local:
+ *   Whether the IP address of addr is one of the local addresses.
+ */
+int forwarder_is_local(const struct forwarder *fw, const union neighbor_addr *addr);
+
+void forwarder_free(struct forwarder *fw);
+
+#endif /* FORWARDER_H */
@@ -0,0 +1,176 @@
+/*
+ * neighbor_net.c
+ *
+ * IPv4/IPv6 addresses and multicast groups of the neighbor discovery (see
+ * neighbor_net.h).
+ */
+
+#include "neighbor_net.h"
+#include "neighborshow.h"
+
+#include <errno.h>
+#include <string.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+
+socklen_t neighbor_addr_len(const union neighbor_addr *addr) {
+    return addr->sa.sa_family == AF_INET6 ? sizeof(addr->sin6) : sizeof(addr->sin);
+}
+
+/* The IPv4 address of an IPv4 or v4-mapped address; 0 if there is none. */
+static int addr_v4(const union neighbor_addr *addr, struct in_addr *v4) {
+    if (addr->sa.sa_family == AF_INET) {
+        *v4 = addr->sin.sin_addr;
+        return 1;
+    }
+    if (addr->sa.sa_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&addr->sin6.sin6_addr)) {
+        memcpy(v4, &addr->sin6.sin6_addr.s6_addr[12], sizeof(*v4));
+        return 1;
+    }
+    return 0;
+}
+
+const char *neighbor_addr_ntop(const union neighbor_addr *addr, char *buf, size_t len) {
+    struct in_addr v4;
+    if (addr_v4(addr, &v4)) {
+        if (inet_ntop(AF_INET, &v4, buf, (socklen_t) len) == NULL)
+            buf[0] = '\0';
+    } else if (addr->sa.sa_family == AF_INET6) {
+        if (inet_ntop(AF_INET6, &addr->sin6.sin6_addr, buf, (socklen_t) len) == NULL)
+            buf[0] = '\0';
+    } else {
+        buf[0] = '\0';
+    }
+    return buf;
+}
+
+int neighbor_addr_pton(const char *text, union neighbor_addr *addr) {
+    memset(addr, 0, sizeof(*addr));
+    if (inet_pton(AF_INET, text, &addr->sin.sin_addr) == 1) {
+        addr->sin.sin_family = AF_INET;
+        return 0;
+    }
+    if (inet_pton(AF_INET6, text, &addr->sin6.sin6_addr) == 1) {
+        addr->sin6.sin6_family = AF_INET6;
+        return 0;
+    }
+    return -1;
+}
+
+uint32_t neighbor_addr_key(const union neighbor_addr *addr) {
+    struct in_addr v4;
+    if (addr_v4(addr, &v4))
+        return v4.s_addr;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(addr->sin6.sin6_addr); i++)
+        h = (h ^ addr->sin6.sin6_addr.s6_addr[i]) * 16777619u;
+    return h;
+}
+
+int neighbor_addr_same_ip(const union neighbor_addr *a, const union neighbor_addr *b) {
+    struct in_addr a4, b4;
+    int a_is_v4 = addr_v4(a, &a4), b_is_v4 = addr_v4(b, &b4);
+    if (a_is_v4 || b_is_v4)
+        return a_is_v4 && b_is_v4 && a4.s_addr == b4.s_addr;
+    return a->sa.sa_family == AF_INET6 && b->sa.sa_family == AF_INET6 &&
+           IN6_ARE_ADDR_EQUAL(&a->sin6.sin6_addr, &b->sin6.sin6_addr);
+}
+
+int neighbor_addr_is_loopback(const union neighbor_addr *addr) {
+    struct in_addr v4;
+    if (addr_v4(addr, &v4))
+        return (ntohl(v4.s_addr) >> 24) == 127;
+    return addr->sa.sa_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&addr->sin6.sin6_addr);
+}
+
+enum neighbor_transport neighbor_addr_transport(const union neighbor_addr *dst) {
+    struct in_addr v4;
+    if (addr_v4(dst, &v4))
+        return IN_MULTICAST(ntohl(v4.s_addr)) ? NEIGHBOR_MCAST4 : NEIGHBOR_BROADCAST;
+    if (dst->sa.sa_family == AF_INET6 && IN6_IS_ADDR_MULTICAST(&dst->sin6.sin6_addr))
+        return NEIGHBOR_MCAST6;
+    return NEIGHBOR_BROADCAST;
+}
+
+in_port_t neighbor_addr_port(const union neighbor_addr *addr) {
+    return addr->sa.sa_family == AF_INET6 ? addr->sin6.sin6_port : addr->sin.sin_port;
+}
+
+void neighbor_addr_for(int family, const union neighbor_addr *addr, union neighbor_addr *out) {
+    if (family != AF_INET6 || addr->sa.sa_family != AF_INET) {
+        *out = *addr;
+        return;
+    }
+    memset(out, 0, sizeof(*out));
+    out->sin6.sin6_family = AF_INET6;
+    out->sin6.sin6_port = addr->sin.sin_port;
+    out->sin6.sin6_addr.s6_addr[10] = 0xff;
+    out->sin6.sin6_addr.s6_addr[11] = 0xff;
+    memcpy(&out->sin6.sin6_addr.s6_addr[12], &addr->sin.sin_addr, sizeof(addr->sin.sin_addr));
+}
+
+int neighbor_mcast_ifaces(enum neighbor_transport transport, struct neighbor_ifaces *out) {
+    int family = transport == NEIGHBOR_MCAST6 ? AF_INET6 : AF_INET;
+    struct ifaddrs *ifaddr;
+    out->count = 0;
+    if (getifaddrs(&ifaddr) < 0)
+        return -1;
+    for (struct ifaddrs *ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != family ||
+            !(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_MULTICAST) ||
+            (ifa->ifa_flags & IFF_LOOPBACK))
+            continue;
+        unsigned int index = if_nametoindex(ifa->ifa_name);
+        if (index == 0 || out->count == NEIGHBOR_MAX_IFACES)
+            continue;
+        /* An interface has several addresses: list it once. */
+        size_t i = 0;
+        while (i < out->count && out->index[i] != index)
+            i++;
+        if (i == out->count)
+            out->index[out->count++] = index;
+    }
+    freeifaddrs(ifaddr);
+    return 0;
+}
+
+void neighbor_mcast_group(enum neighbor_transport transport, unsigned int ifindex,
+                          union neighbor_addr *out) {
+    memset(out, 0, sizeof(*out));
+    if (transport == NEIGHBOR_MCAST6) {
+        out->sin6.sin6_family = AF_INET6;
+        out->sin6.sin6_port = htons(NEIGHBOR_PORT);
+        inet_pton(AF_INET6, NEIGHBOR_GROUP6, &out->sin6.sin6_addr);
+        out->sin6.sin6_scope_id = ifindex;
+    } else {
+        out->sin.sin_family = AF_INET;
+        out->sin.sin_port = htons(NEIGHBOR_PORT);
+        inet_pton(AF_INET, NEIGHBOR_GROUP4, &out->sin.sin_addr);
+    }
+}
+
+int neighbor_mcast_join(int sockfd, int family, enum neighbor_transport transport,
+                        unsigned int ifindex) {
+    int ret;
+    if (transport == NEIGHBOR_MCAST6) {
+        if (family != AF_INET6) {
+            errno = EAFNOSUPPORT;
+            return -1;
+        }
+        struct ipv6_mreq mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        inet_pton(AF_INET6, NEIGHBOR_GROUP6, &mreq.ipv6mr_multiaddr);
+        mreq.ipv6mr_interface = ifindex;
+        ret = setsockopt(sockfd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq));
+    } else {
+        struct ip_mreqn mreq;
+        memset(&mreq, 0, sizeof(mreq));
+        inet_pton(AF_INET, NEIGHBOR_GROUP4, &mreq.imr_multiaddr);
+        mreq.imr_ifindex = (int) ifindex;
+        ret = setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+    }
+    if (ret < 0 && errno == EADDRINUSE)
+        return 0;
+    return ret;
+}
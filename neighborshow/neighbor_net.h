@@ -0,0 +1,110 @@
+#ifndef NEIGHBOR_NET_H
+#define NEIGHBOR_NET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+ * union neighbor_addr:
+ *   An IPv4 or IPv6 socket address. The agent uses one dual-stack socket
+ *   when it can, on which IPv4 peers have v4-mapped IPv6 addresses
+ *   (::ffff:a.b.c.d); the functions below treat those as the IPv4 address.
+ */
+union neighbor_addr {
+    struct sockaddr     sa;
+    struct sockaddr_in  sin;
+    struct sockaddr_in6 sin6;
+};
+
+/* Longest text of an address (without scope). */
+#define NEIGHBOR_ADDRSTRLEN INET6_ADDRSTRLEN
+
+/* How a discovery request reaches the neighbors. */
+enum neighbor_transport {
+    NEIGHBOR_BROADCAST,     /* IPv4 broadcast (or unicast) */
+    NEIGHBOR_MCAST4,        /* IPv4 group NEIGHBOR_GROUP4 */
+    NEIGHBOR_MCAST6         /* IPv6 link-local group NEIGHBOR_GROUP6 */
+};
+
+socklen_t neighbor_addr_len(const union neighbor_addr *addr);
+
+/*
+ * neighbor_addr_ntop:
+ *   Text of the IP address (IPv4 for v4-mapped addresses, no scope).
+ *   Returns buf.
+ */
+const char *neighbor_addr_ntop(const union neighbor_addr *addr, char *buf, size_t len);
+
+/*
+ * neighbor_addr_pton:
+ *   Parse an IPv4 or IPv6 address (port 0). Returns 0, or -1 if invalid.
+ */
+int neighbor_addr_pton(const char *text, union neighbor_addr *addr);
+
+/*
+ * neighbor_addr_key:
+ *   32-bit key of an IP address: the address itself for IPv4, a hash of
+ *   it for IPv6 (the seen cache identifies requests by origin key and id).
+ */
+uint32_t neighbor_addr_key(const union neighbor_addr *addr);
+
+/* Whether two socket addresses have the same IP address (ports aside). */
+int neighbor_addr_same_ip(const union neighbor_addr *a, const union neighbor_addr *b);
+
+int neighbor_addr_is_loopback(const union neighbor_addr *addr);
+
+/*
+ * neighbor_addr_transport:
+ *   How a datagram received with destination dst (IP_PKTINFO or
+ *   IPV6_PKTINFO) was sent: to an IPv6 or an IPv4 multicast group, or else
+ *   by broadcast (or unicast).
+ */
+enum neighbor_transport neighbor_addr_transport(const union neighbor_addr *dst);
+
+/* Port of addr, in network order. */
+in_port_t neighbor_addr_port(const union neighbor_addr *addr);
+
+/*
+ * neighbor_addr_for:
+ *   addr as a destination for a socket of the given family: IPv4
+ *   addresses are v4-mapped for an AF_INET6 socket.
+ */
+void neighbor_addr_for(int family, const union neighbor_addr *addr, union neighbor_addr *out);
+
+/* Interfaces multicast discovery runs on. */
+#define NEIGHBOR_MAX_IFACES 32
+
+struct neighbor_ifaces {
+    unsigned int index[NEIGHBOR_MAX_IFACES];
+    size_t       count;
+};
+
+/*
+ * neighbor_mcast_ifaces:
+ *   The interfaces that are up, multicast-capable, not loopback and have
+ *   an address of the family of transport (NEIGHBOR_MCAST4 or
+ *   NEIGHBOR_MCAST6). Returns 0, or -1 if they cannot be listed.
+ */
+int neighbor_mcast_ifaces(enum neighbor_transport transport, struct neighbor_ifaces *out);
+
+/*
+ * neighbor_mcast_group:
+ *   The destination of a request sent to the discovery group of transport
+ *   on interface ifindex, on NEIGHBOR_PORT. An IPv4 group has no interface:
+ *   the sender picks it (IP_MULTICAST_IF or IP_PKTINFO).
+ */
+void neighbor_mcast_group(enum neighbor_transport transport, unsigned int ifindex,
+                          union neighbor_addr *out);
+
+/*
+ * neighbor_mcast_join:
+ *   Join the discovery group of transport on interface ifindex, on a socket
+ *   of family (an AF_INET6 socket can join IPv4 groups too). Joining a
+ *   group twice is not an error. Returns 0, or -1 with errno set.
+ */
+int neighbor_mcast_join(int sockfd, int family, enum neighbor_transport transport,
+                        unsigned int ifindex);
+
+#endif /* NEIGHBOR_NET_H */
@@ -0,0 +1,130 @@
+/*
+ * neighbor_set.c
+ *
+ * Result set of the neighborshow command: hosts deduplicated by name, with
+ * the route and latency they were heard with (see neighbor_set.h).
+ */
+
+#include "neighbor_set.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void neighbor_set_init(struct neighbor_set *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+static uint32_t name_hash(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; name++)
+        h = (h ^ (unsigned char) *name) * 16777619u;
+    return h;
+}
+
+static void index_insert(struct neighbor_set *set, size_t pos) {
+    size_t s = name_hash(set->items[pos].name) & (set->slot_cap - 1);
+    while (set->slots[s] != 0)
+        s = (s + 1) & (set->slot_cap - 1);
+    set->slots[s] = (uint32_t)(pos + 1);
+}
+
+static void index_rebuild(struct neighbor_set *set) {
+    memset(set->slots, 0, set->slot_cap * sizeof(*set->slots));
+    for (size_t i = 0; i < set->count; i++)
+        index_insert(set, i);
+}
+
+/*
+ * grow:
+ *   Make room for one more neighbor, doubling the array and the index when
+ *   needed. Returns 0, or -1 on allocation failure.
+ */
+static int grow(struct neighbor_set *set) {
+    if (set->count < set->cap)
+        return 0;
+    size_t cap = set->cap ? 2 * set->cap : 64;
+    struct neighbor *items = realloc(set->items, cap * sizeof(*items));
+    if (items == NULL)
+        return -1;
+    set->items = items;
+    uint32_t *slots = calloc(2 * cap, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+    set->cap = cap;
+    free(set->slots);
+    set->slots = slots;
+    set->slot_cap = 2 * cap;
+    index_rebuild(set);
+    return 0;
+}
+
+const struct neighbor *neighbor_set_add(struct neighbor_set *set, const char *name,
+                                        const char *addr, unsigned int hops,
+                                        double latency_ms) {
+    if (set->slot_cap > 0) {
+        size_t s = name_hash(name) & (set->slot_cap - 1);
+        for (; set->slots[s] != 0; s = (s + 1) & (set->slot_cap - 1)) {
+            struct neighbor *n = &set->items[set->slots[s] - 1];
+            if (strcmp(n->name, name) == 0) {
+                if (hops < n->hops) {
+                    n->hops = hops;
+                    snprintf(n->addr, sizeof(n->addr), "%s", addr);
+                }
+                return NULL;
+            }
+        }
+    }
+    if (grow(set) < 0)
+        return NULL;
+
+    struct neighbor *n = &set->items[set->count];
+    n->name = strdup(name);
+    if (n->name == NULL)
+        return NULL;
+    snprintf(n->addr, sizeof(n->addr), "%s", addr);
+    n->hops = hops;
+    n->latency_ms = latency_ms;
+    index_insert(set, set->count++);
+    return n;
+}
+
+static int by_name(const void *a, const void *b) {
+    return strcmp(((const struct neighbor *) a)->name, ((const struct neighbor *) b)->name);
+}
+
+static int by_hops(const void *a, const void *b) {
+    const struct neighbor *x = a, *y = b;
+    if (x->hops != y->hops)
+        return x->hops < y->hops ? -1 : 1;
+    return by_name(a, b);
+}
+
+static int by_latency(const void *a, const void *b) {
+    const struct neighbor *x = a, *y = b;
+    if (x->latency_ms != y->latency_ms)
+        return x->latency_ms < y->latency_ms ? -1 : 1;
+    return by_name(a, b);
+}
+
+void neighbor_set_sort(struct neighbor_set *set, enum neighbor_order order) {
+    int (*cmp)(const void *, const void *) = NULL;
+    switch (order) {
+    case NEIGHBOR_BY_NAME:    cmp = by_name;    break;
+    case NEIGHBOR_BY_HOPS:    cmp = by_hops;    break;
+    case NEIGHBOR_BY_LATENCY: cmp = by_latency; break;
+    case NEIGHBOR_BY_ARRIVAL: return;
+    }
+    if (set->count == 0)
+        return;
+    qsort(set->items, set->count, sizeof(*set->items), cmp);
+    index_rebuild(set);
+}
+
+void neighbor_set_free(struct neighbor_set *set) {
+    for (size_t i = 0; i < set->count; i++)
+        free(set->items[i].name);
+    free(set->items);
+    free(set->slots);
+    memset(set, 0, sizeof(*set));
+}
@@ -0,0 +1,64 @@
+#ifndef NEIGHBOR_SET_H
+#define NEIGHBOR_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "neighbor_net.h"
+
+/*
+ * struct neighbor:
+ *   A host that answered a discovery: the address it answered from (or the
+ *   one its relay reported, IPv4 or IPv6, as text), its distance in hops and how long after the
+ *   request it was first heard of.
+ */
+struct neighbor {
+    char         *name;
+    char          addr[NEIGHBOR_ADDRSTRLEN];
+    unsigned int  hops;
+    double        latency_ms;
+};
+
+/*
+ * struct neighbor_set:
+ *   The neighbors heard so far, in arrival order. They are deduplicated by
+ *   name through an open-addressing index (slots hold position + 1 in
+ *   items[], 0 when empty) kept at most half full; both grow as needed.
+ */
+struct neighbor_set {
+    struct neighbor *items;
+    size_t           count;
+    size_t           cap;
+    uint32_t        *slots;
+    size_t           slot_cap;      /* power of two */
+};
+
+/* Orders for neighbor_set_sort(). */
+enum neighbor_order {
+    NEIGHBOR_BY_ARRIVAL,
+    NEIGHBOR_BY_NAME,
+    NEIGHBOR_BY_HOPS,
+    NEIGHBOR_BY_LATENCY
+};
+
+void neighbor_set_init(struct neighbor_set *set);
+
+/*
+ * neighbor_set_add:
+ *   Record a neighbor, or the shorter route to a known one (its latency is
+ *   the one it was first heard with). Returns the neighbor if it is new,
+ *   NULL if it was known or memory is short.
+ */
+const struct neighbor *neighbor_set_add(struct neighbor_set *set, const char *name,
+                                        const char *addr, unsigned int hops,
+                                        double latency_ms);
+
+/*
+ * neighbor_set_sort:
+ *   Sort the neighbors (ties are broken by name). The index is rebuilt, so
+ *   the set can still be added to afterwards.
+ */
+void neighbor_set_sort(struct neighbor_set *set, enum neighbor_order order);
+
+void neighbor_set_free(struct neighbor_set *set);
+
+#endif /* NEIGHBOR_SET_H */
@@ -5,12 +5,30 @@
  * neighboring machines. It waits for responses from agents running on other machines
  * and then prints the unique hostnames.
  *
+ * With -m the request goes to the agents' IPv4 multicast group instead, and
+ * with -6 to their IPv6 link-local group (see neighborshow.h), once on every
+ * multicast-capable interface: only hosts running an agent receive it, and
+ * -6 works on IPv6-only links.
+ *
+ * By default responses are collected for RESPONSE_TIMEOUT seconds. With -q
+ * the collection ends as soon as no new host answered for the given quiet
+ * period, and with -n as soon as the expected number of hosts answered;
+ * -t bounds the whole collection in any case. Relays send the answers of
+ * the hosts beyond them up to (hop - 1) * RELAY_WINDOW ms late, so the
+ * quiet period cannot end before then.
+ *
+ * Every host is listed once, with the address it answered from (or the one
+ * its relay reported), its distance in hops and how long it took to hear of
+ * it; -s sorts the list, -S prints each host as soon as it is heard of.
+ *
  * Usage:
  *    neighborshow         (defaults to 1 hop)
  *    neighborshow -hop n  (n > 1 for multi‐hop discovery)
+ *    neighborshow [-hop n] [-m | -6] [-t <deadline ms>] [-q <quiet ms>] [-n <expected hosts>]
+ *                 [-s name|hops|latency] [-S]
  *
  * Compile with:
- *     gcc -o neighborshow neighborshow.c
+ *     gcc -o neighborshow neighborshow.c neighbor_set.c neighbor_net.c
  */
 
 #include <stdio.h>
@@ -25,52 +43,167 @@
 #include <time.h>
 #include <sys/select.h>
 #include "neighborshow.h"
+#include "neighbor_set.h"
+#include "neighbor_net.h"
 
 #define RESPONSE_TIMEOUT 3   /* seconds to wait for responses */
-#define MAX_HOSTNAMES 100
+#define RELAY_WINDOW     200 /* ms per hop relays hold downstream answers (agent's -a) */
+
+/* usage:
+ * Prints the correct command-line usage and exits.
+ */
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [-hop n] [-m | -6] [-t <deadline ms>] [-q <quiet ms>] [-n <expected hosts>]\n"
+                    "       [-s name|hops|latency] [-S]\n",
+            progname);
+    fprintf(stderr, "  -m  send the request to the IPv4 multicast group %s (default: broadcast)\n"
+                    "  -6  send the request to the IPv6 link-local multicast group %s\n",
+            NEIGHBOR_GROUP4, NEIGHBOR_GROUP6);
+    fprintf(stderr, "  -t  stop collecting after this long (default %d000 ms)\n"
+                    "  -q  stop once no new host answered for this long (default: off); relays\n"
+                    "      send the hosts beyond them up to (hop - 1) * %d ms late, so this\n"
+                    "      never stops before (hop - 1) * %d ms + the quiet period\n"
+                    "  -n  stop once this many hosts answered (default: off)\n"
+                    "  -s  sort the hosts (default: in the order they were heard of)\n"
+                    "  -S  print each host as soon as it is heard of\n",
+            RESPONSE_TIMEOUT, RELAY_WINDOW, RELAY_WINDOW);
+    exit(EXIT_FAILURE);
+}
 
-typedef struct {
-    char hostname[256];
-} hostname_entry;
+static long long monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static long long monotonic_ms(void) {
+    return monotonic_ns() / 1000000;
+}
+
+static void print_neighbor(const struct neighbor *n) {
+    printf("  %-32s %-15s %2u hop%s %9.3f ms\n", n->name, n->addr, n->hops,
+           n->hops == 1 ? " " : "s", n->latency_ms);
+}
+
+/*
+ * send_request:
+ *   Send the request by broadcast, or to the multicast group of transport
+ *   on every multicast-capable interface. Exits if no datagram could be sent.
+ */
+static void send_request(int sockfd, enum neighbor_transport transport, const char *request) {
+    if (transport == NEIGHBOR_BROADCAST) {
+        struct sockaddr_in broadcast_addr;
+        memset(&broadcast_addr, 0, sizeof(broadcast_addr));
+        broadcast_addr.sin_family = AF_INET;
+        broadcast_addr.sin_port = htons(NEIGHBOR_PORT);
+        broadcast_addr.sin_addr.s_addr = inet_addr("255.255.255.255");
+        if (sendto(sockfd, request, strlen(request), 0,
+                   (struct sockaddr *)&broadcast_addr, sizeof(broadcast_addr)) < 0) {
+            perror("sendto");
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    struct neighbor_ifaces ifaces;
+    if (neighbor_mcast_ifaces(transport, &ifaces) < 0) {
+        perror("getifaddrs");
+        exit(EXIT_FAILURE);
+    }
+    int sent = 0;
+    for (size_t i = 0; i < ifaces.count; i++) {
+        union neighbor_addr group;
+        neighbor_mcast_group(transport, ifaces.index[i], &group);
+        if (transport == NEIGHBOR_MCAST4) {
+            /* An IPv4 group address does not name an interface: pick it. */
+            struct ip_mreqn mreq;
+            memset(&mreq, 0, sizeof(mreq));
+            mreq.imr_ifindex = (int) ifaces.index[i];
+            if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) < 0) {
+                perror("setsockopt (IP_MULTICAST_IF)");
+                continue;
+            }
+        }
+        if (sendto(sockfd, request, strlen(request), 0, &group.sa, neighbor_addr_len(&group)) < 0)
+            perror("sendto");
+        else
+            sent++;
+    }
+    if (sent == 0) {
+        fprintf(stderr, "No multicast-capable %s interface to send the request on\n",
+                transport == NEIGHBOR_MCAST6 ? "IPv6" : "IPv4");
+        exit(EXIT_FAILURE);
+    }
+}
 
 int main(int argc, char *argv[]) {
     int hop = 1;  /* default hop count is 1 */
-    
-    /* Parse optional command-line argument: -hop n */
-    if (argc == 3) {
-        if (strcmp(argv[1], "-hop") == 0) {
-            hop = atoi(argv[2]);
+    long deadline_ms = RESPONSE_TIMEOUT * 1000L;
+    long quiet_ms = 0;       /* 0: wait until the deadline */
+    long expected = 0;       /* 0: no expected count */
+    enum neighbor_order order = NEIGHBOR_BY_ARRIVAL;
+    int streaming = 0;
+    enum neighbor_transport transport = NEIGHBOR_BROADCAST;
+
+    /* Parse optional command-line arguments */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-hop") == 0 && i + 1 < argc) {
+            hop = atoi(argv[++i]);
             if (hop < 1)
                 hop = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            deadline_ms = atol(argv[++i]);
+            if (deadline_ms < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-q") == 0 && i + 1 < argc) {
+            quiet_ms = atol(argv[++i]);
+            if (quiet_ms < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            expected = atol(argv[++i]);
+            if (expected < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "name") == 0)
+                order = NEIGHBOR_BY_NAME;
+            else if (strcmp(argv[i], "hops") == 0)
+                order = NEIGHBOR_BY_HOPS;
+            else if (strcmp(argv[i], "latency") == 0)
+                order = NEIGHBOR_BY_LATENCY;
+            else
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-S") == 0) {
+            streaming = 1;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            transport = NEIGHBOR_MCAST4;
+        } else if (strcmp(argv[i], "-6") == 0) {
+            transport = NEIGHBOR_MCAST6;
         } else {
-            fprintf(stderr, "Usage: %s [-hop n]\n", argv[0]);
-            exit(EXIT_FAILURE);
+            usage(argv[0]);
         }
-    } else if (argc != 1) {
-        fprintf(stderr, "Usage: %s [-hop n]\n", argv[0]);
-        exit(EXIT_FAILURE);
     }
 
+    int family = transport == NEIGHBOR_MCAST6 ? AF_INET6 : AF_INET;
     int sockfd;
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+    if ((sockfd = socket(family, SOCK_DGRAM, 0)) < 0) {
         perror("socket");
         exit(EXIT_FAILURE);
     }
 
     /* Enable broadcast */
     int broadcastEnable = 1;
-    if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable)) < 0) {
+    if (transport == NEIGHBOR_BROADCAST &&
+        setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable)) < 0) {
         perror("setsockopt (SO_BROADCAST)");
         exit(EXIT_FAILURE);
     }
 
     /* Bind the socket to an ephemeral port so we can receive responses */
-    struct sockaddr_in local_addr;
+    union neighbor_addr local_addr;
     memset(&local_addr, 0, sizeof(local_addr));
-    local_addr.sin_family = AF_INET;
-    local_addr.sin_addr.s_addr = INADDR_ANY;
-    local_addr.sin_port = 0;  /* system assigns port */
-    if (bind(sockfd, (struct sockaddr *)&local_addr, sizeof(local_addr)) < 0) {
+    local_addr.sa.sa_family = (sa_family_t) family;  /* any address, system assigns port */
+    if (bind(sockfd, &local_addr.sa, neighbor_addr_len(&local_addr)) < 0) {
         perror("bind");
         exit(EXIT_FAILURE);
     }
@@ -85,43 +218,55 @@ int main(int argc, char *argv[]) {
     char request[MAX_BUFFER];
     snprintf(request, sizeof(request), "%s %d %d", REQUEST_PREFIX, req_id, hop);
 
-    /* Set up the broadcast address */
-    struct sockaddr_in broadcast_addr;
-    memset(&broadcast_addr, 0, sizeof(broadcast_addr));
-    broadcast_addr.sin_family = AF_INET;
-    broadcast_addr.sin_port = htons(NEIGHBOR_PORT);
-    broadcast_addr.sin_addr.s_addr = inet_addr("255.255.255.255");
-
-    /* Send the broadcast discovery request */
-    if (sendto(sockfd, request, strlen(request), 0,
-               (struct sockaddr *)&broadcast_addr, sizeof(broadcast_addr)) < 0) {
-        perror("sendto");
-        exit(EXIT_FAILURE);
-    }
+    /* Send the discovery request */
+    long long started_ns = monotonic_ns();
+    long long started = started_ns / 1000000;
+    send_request(sockfd, transport, request);
 
-    /* Wait for responses for a fixed timeout */
+    /* Wait for responses until the deadline, the quiet period since the
+     * last new host (counted from the moment the relays send what they
+     * collected, at the earliest) or the expected count, whichever comes
+     * first. The timeout is recomputed for every select(): it must not
+     * depend on select() updating it.
+     */
     fd_set read_fds;
     struct timeval timeout;
-    timeout.tv_sec = RESPONSE_TIMEOUT;
-    timeout.tv_usec = 0;
+    long long deadline = started + deadline_ms;
+    long long last_new = started + (long long)(hop - 1) * RELAY_WINDOW;
+
+    struct neighbor_set neighbors;
+    neighbor_set_init(&neighbors);
 
-    hostname_entry hostnames[MAX_HOSTNAMES];
-    int hostname_count = 0;
+    if (streaming) {
+        printf("Neighboring machines (hop = %d):\n", hop);
+        fflush(stdout);
+    }
+
+    while (expected == 0 || neighbors.count < (size_t) expected) {
+        long long now = monotonic_ms();
+        long long wait_until = deadline;
+        if (quiet_ms > 0 && last_new + quiet_ms < wait_until)
+            wait_until = last_new + quiet_ms;
+        if (wait_until <= now)
+            break;
+        timeout.tv_sec = (time_t)((wait_until - now) / 1000);
+        timeout.tv_usec = (suseconds_t)((wait_until - now) % 1000) * 1000;
 
-    while (1) {
         FD_ZERO(&read_fds);
         FD_SET(sockfd, &read_fds);
         int ret = select(sockfd + 1, &read_fds, NULL, NULL, &timeout);
         if (ret < 0) {
+            if (errno == EINTR)
+                continue;
             perror("select");
             break;
         } else if (ret == 0) {
-            /* Timeout expired */
-            break;
+            /* Timeout expired: checked again at the top of the loop */
+            continue;
         }
 
         char buffer[MAX_BUFFER];
-        struct sockaddr_in sender_addr;
+        union neighbor_addr sender_addr;
         socklen_t sender_len = sizeof(sender_addr);
         int n = recvfrom(sockfd, buffer, MAX_BUFFER - 1, 0,
                          (struct sockaddr *)&sender_addr, &sender_len);
@@ -131,37 +276,65 @@ int main(int argc, char *argv[]) {
         }
         buffer[n] = '\0';
 
-        /* Expected response format:
-         *   "NEIGHBOR_RESPONSE <req_id> <hostname>"
+        /* Expected response format (see neighborshow.h):
+         *   "NEIGHBOR_RESPONSE <req_id> <entry> [<entry> ...]"
          */
         char prefix[32];
         int resp_id;
-        char resp_hostname[256];
-        if (sscanf(buffer, "%31s %d %255s", prefix, &resp_id, resp_hostname) != 3)
+        int consumed = 0;
+        if (sscanf(buffer, "%31s %d %n", prefix, &resp_id, &consumed) != 2 || consumed == 0)
             continue;
         if (strcmp(prefix, RESPONSE_PREFIX) != 0 || resp_id != req_id)
             continue;
 
-        /* Check if this hostname is already in our list */
-        int exists = 0;
-        for (int i = 0; i < hostname_count; i++) {
-            if (strcmp(hostnames[i].hostname, resp_hostname) == 0) {
-                exists = 1;
-                break;
+        double latency_ms = (double)(monotonic_ns() - started_ns) / 1e6;
+        char sender_ip[NEIGHBOR_ADDRSTRLEN];
+        neighbor_addr_ntop(&sender_addr, sender_ip, sizeof(sender_ip));
+        char *save;
+        for (char *entry = strtok_r(buffer + consumed, " \r\n", &save);
+             entry != NULL && (expected == 0 || neighbors.count < (size_t) expected);
+             entry = strtok_r(NULL, " \r\n", &save)) {
+            /* A bare hostname is the responder itself, one hop away; relayed
+             * entries are "<hostname>,<ip>,<hops from the relay>". An
+             * "@<origin>" tag is meant for relays. */
+            if (entry[0] == '@')
+                continue;
+            char resp_hostname[256];
+            char ip[NEIGHBOR_ADDRSTRLEN];
+            unsigned int hops = 0;
+            union neighbor_addr addr;
+            if (strchr(entry, ',') != NULL) {
+                if (sscanf(entry, "%255[^,],%45[^,],%u", resp_hostname, ip, &hops) != 3 ||
+                    neighbor_addr_pton(ip, &addr) != 0)
+                    continue;
+            } else {
+                snprintf(resp_hostname, sizeof(resp_hostname), "%s", entry);
+                snprintf(ip, sizeof(ip), "%s", sender_ip);
+            }
+
+            const struct neighbor *added = neighbor_set_add(&neighbors, resp_hostname, ip,
+                                                            hops + 1, latency_ms);
+            if (added != NULL) {
+                long long now_ms = monotonic_ms();
+                if (now_ms > last_new)
+                    last_new = now_ms;
+                if (streaming) {
+                    print_neighbor(added);
+                    fflush(stdout);
+                }
             }
-        }
-        if (!exists && hostname_count < MAX_HOSTNAMES) {
-            strcpy(hostnames[hostname_count].hostname, resp_hostname);
-            hostname_count++;
         }
     }
 
-    /* Print the list of unique neighboring hostnames */
-    printf("Neighboring machines (hop = %d):\n", hop);
-    for (int i = 0; i < hostname_count; i++) {
-        printf("  %s\n", hostnames[i].hostname);
+    /* Print the list of unique neighboring hosts */
+    if (!streaming) {
+        neighbor_set_sort(&neighbors, order);
+        printf("Neighboring machines (hop = %d):\n", hop);
+        for (size_t i = 0; i < neighbors.count; i++)
+            print_neighbor(&neighbors.items[i]);
     }
 
+    neighbor_set_free(&neighbors);
     close(sockfd);
     return 0;
 }
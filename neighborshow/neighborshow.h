@@ -8,6 +8,33 @@
 #define REQUEST_PREFIX "NEIGHBOR_REQUEST"
 #define RESPONSE_PREFIX "NEIGHBOR_RESPONSE"
 
+/* Asks an agent for its metrics; only answered to local senders. */
+#define STATS_REQUEST "NEIGHBOR_STATS"
+
+/*
+ * Multicast groups the agents join on every interface, for requests that
+ * should only reach hosts running an agent (the client's -m and -6): an
+ * administratively scoped IPv4 group and a transient link-local IPv6 group.
+ * Both are sent with a hop limit of 1, so they stay on the link as
+ * broadcasts do.
+ */
+#define NEIGHBOR_GROUP4 "239.255.110.115"
+#define NEIGHBOR_GROUP6 "ff12::6e73:6877"
+
+/*
+ * Messages:
+ *   "NEIGHBOR_REQUEST <id> <hop> [<origin>]"
+ *   "NEIGHBOR_RESPONSE <id> [@<origin>] <entry> [<entry> ...]"
+ * A response entry is either "<hostname>", the host that sent the
+ * datagram, or "<hostname>,<ip>,<hops>", a host a relay heard from, hops
+ * away from that relay. The origin and ip are IPv4 or IPv6 addresses (IPv6
+ * ones without their scope). Relays merge the responses of the hosts they
+ * forwarded a request to, so one response can carry many hosts; it is
+ * split over several datagrams when it does not fit in one. Responses to a
+ * forwarded request repeat its origin, for the relay to tell apart
+ * discoveries from different hosts that drew the same id.
+ */
+
 /* General buffer size for messages */
 #define MAX_BUFFER 1024
 
@@ -4,150 +4,915 @@
  * This is the persistent agent for neighbor discovery.
  * It listens on UDP port NEIGHBOR_PORT for discovery requests and replies
  * with its system hostname. If the hop count is greater than 1, the agent
- * forwards (rebroadcasts) the request with hop-1.
+ * forwards (rebroadcasts) the request with hop-1: after a short random
+ * delay, unless enough neighbors were already heard forwarding it, at a
+ * limited rate, and to the broadcast address of each interface (see
+ * forwarder.c). A relaying agent answers at once too, then collects the
+ * answers of the hosts it forwarded the request to for a while and sends
+ * them back merged, so the whole neighborhood travels back to the client
+ * in a few datagrams (see aggregator.c).
+ *
+ * The agent listens on one dual-stack socket (IPv4 peers show up as
+ * v4-mapped IPv6 addresses), or on an IPv4 socket where IPv6 is not
+ * available. Besides broadcasts, it receives the requests sent to the IPv4
+ * and IPv6 discovery groups (see neighborshow.h), which it joins on every
+ * multicast-capable interface, again whenever the interfaces are rescanned.
+ * A request is forwarded the way it came: broadcast, or to its group on
+ * every interface.
+ *
+ * Requests arrive in bursts during a multi-hop discovery, so they are read
+ * in batches with recvmmsg() and all the responses and forwards of a batch
+ * are sent with a single sendmmsg(). The socket receive buffer is enlarged
+ * to absorb bursts, and the agent periodically reports how many datagrams
+ * it handled and how many the kernel dropped for lack of buffer space.
+ * The same counters, and how long immediate responses took from the batch
+ * being read to being sent, are returned to a local "NEIGHBOR_STATS"
+ * datagram and, with -m <port>, served in the Prometheus text format on
+ * 127.0.0.1:<port>/metrics. The periodic report and the errors met while
+ * serving are logged through an in-memory ring that a background thread
+ * writes to stdout (see log_ring.h), never from the receive loop itself.
+ *
+ * Usage:
+ *     neighborshow_agent [-r <receive buffer bytes>] [-c <seen entries>] [-t <seen ttl s>]
+ *                        [-d <forward delay ms>] [-k <suppress threshold>] [-R <forwards/s>]
+ *                        [-a <aggregation window ms per hop>] [-m <metrics port>]
+ *                        [-l error|warn|info|debug]
  *
  * Compile with:
- *     gcc -o neighborshow_agent neighborshow_agent.c
+ *     gcc -o neighborshow_agent neighborshow_agent.c seen_cache.c forwarder.c aggregator.c neighbor_net.c metrics.c log_ring.c -pthread
  *
  * Run this agent on each machine you wish to be discoverable.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <linux/sock_diag.h>
 #include "neighborshow.h"
+#include "seen_cache.h"
+#include "forwarder.h"
+#include "aggregator.h"
+#include "neighbor_net.h"
+#include "metrics.h"
+#include "log_ring.h"
+
+/* Datagrams read (and at most twice as many sent) per system call. */
+#define BATCH_SIZE 64
+
+/* Default receive buffer: room for a few thousand queued requests. */
+#define RCVBUF_SIZE (4 * 1024 * 1024)
+
+/* Seconds between two reports of the counters (only if they changed). */
+#define REPORT_INTERVAL 10
+
+/* Requests remembered for loop suppression, and for how long. */
+#define SEEN_CAPACITY 16384
+#define SEEN_TTL      60
+
+/*
+ * Forwarding defaults (see forwarder.h): random delay of up to
+ * FORWARD_DELAY ms, suppressed once FORWARD_SUPPRESS neighbors were heard
+ * forwarding, at most FORWARD_RATE datagrams per second in bursts of
+ * FORWARD_BURST, FORWARD_QUEUE pending forwards.
+ */
+#define FORWARD_DELAY    50
+#define FORWARD_SUPPRESS 2
+#define FORWARD_RATE     100
+#define FORWARD_BURST    50
+#define FORWARD_QUEUE    4096
+
+/*
+ * A relay that forwards a request with n hops left holds the downstream
+ * answers for n * AGGREGATE_WINDOW ms: each hop further down needs one more
+ * window, and a window must cover the forwarding delay (-a below -d is
+ * refused, and the default is raised to -d).
+ */
+#define AGGREGATE_WINDOW 200
+
+/* Kinds of log messages, with their rate limits (see log_ring.h). */
+static struct log_site log_counters = LOG_SITE_INIT("counters", 0, 1);
+static struct log_site log_socket = LOG_SITE_INIT("socket", 1, 1);
+static struct log_site log_system = LOG_SITE_INIT("system", 1, 1);
+static struct log_site log_invalid = LOG_SITE_INIT("invalid", 5, 64);
 
-/* A simple fixed‐size cache for recently seen request IDs (to avoid re‐broadcast loops) */
-#define MAX_REQUESTS 100
+/*
+ * struct agent_counters:
+ *   What the agent did since it started. kernel_drops is the socket's
+ *   SO_RXQ_OVFL count (requests lost because the receive buffer was full);
+ *   duplicates are the requests found in the seen cache (whose own
+ *   counters tell how it copes); backlog_peak is the largest amount of
+ *   data found still queued on the socket after a batch was read, and
+ *   full_batches counts the batches that filled up, i.e. that left
+ *   datagrams waiting. stats_requests are the NEIGHBOR_STATS datagrams
+ *   answered, multicast_requests the requests received through a
+ *   discovery group.
+ */
+struct agent_counters {
+    unsigned long long received;
+    unsigned long long batches;
+    unsigned long long full_batches;
+    unsigned long long invalid;
+    unsigned long long duplicates;
+    unsigned long long responses;
+    unsigned long long forwards;
+    unsigned long long send_errors;
+    unsigned long long kernel_drops;
+    unsigned long long stats_requests;
+    unsigned long long multicast_requests;
+    unsigned int       backlog_peak;
+};
+
+/*
+ * struct rx_batch / struct tx_batch:
+ *   Buffers for one recvmmsg() and one sendmmsg() call. Every request can
+ *   produce a response and a forward, hence twice as many outgoing slots.
+ *   received_ns is when the request of an immediate response was read (0
+ *   for forwards and aggregated responses, which are delayed on purpose).
+ *   The control buffers hold the SO_RXQ_OVFL count and the destination of
+ *   received datagrams, and the interface of IPv4 multicast forwards.
+ */
+struct rx_batch {
+    struct mmsghdr      msgs[BATCH_SIZE];
+    struct iovec        iov[BATCH_SIZE];
+    union neighbor_addr from[BATCH_SIZE];
+    char                buf[BATCH_SIZE][MAX_BUFFER];
+    char                ctrl[BATCH_SIZE][CMSG_SPACE(sizeof(uint32_t)) +
+                                         CMSG_SPACE(sizeof(struct in6_pktinfo)) +
+                                         CMSG_SPACE(sizeof(struct in_pktinfo))];
+};
 
-typedef struct {
-    int id;
-} request_entry;
+#define TX_SLOTS (2 * BATCH_SIZE)
 
-request_entry seen_requests[MAX_REQUESTS];
-int seen_count = 0;
+struct tx_batch {
+    struct mmsghdr      msgs[TX_SLOTS];
+    struct iovec        iov[TX_SLOTS];
+    union neighbor_addr to[TX_SLOTS];
+    char                buf[TX_SLOTS][MAX_BUFFER];
+    char                ctrl[TX_SLOTS][CMSG_SPACE(sizeof(struct in_pktinfo))];
+    unsigned char       forward[TX_SLOTS];  /* 1 for a forwarded request */
+    uint64_t            received_ns[TX_SLOTS];
+    unsigned int        count;
+};
 
-/* Check if a request id has already been processed */
-int already_seen(int id) {
-    for (int i = 0; i < seen_count; i++) {
-        if (seen_requests[i].id == id)
-            return 1;
+/*
+ * struct agent:
+ *   Everything the receive loop works with. The agent is single-threaded:
+ *   the metrics are read by the loop itself, between batches.
+ */
+struct agent {
+    int                      sockfd;
+    int                      family;              /* AF_INET6 (dual-stack) or AF_INET */
+    long long                aggregate_window;    /* ms per hop, 0 not to aggregate */
+    char                     hostname[256];       /* read again for every batch */
+    struct rx_batch         *rx;
+    struct tx_batch         *tx;
+    struct seen_cache        seen;
+    struct forwarder         fw;
+    struct aggregator        agg;
+    struct agent_counters    counters;
+    struct metrics_histogram response_ns;         /* immediate responses */
+    long long                started_ms;
+};
+
+/* usage:
+ * Prints the correct command-line usage and exits.
+ */
+static void usage(const char *progname) {
+    fprintf(stderr, "Usage: %s [-r <receive buffer bytes>] [-c <seen entries>] [-t <seen ttl s>]\n"
+                    "       [-d <forward delay ms>] [-k <suppress threshold>] [-R <forwards/s>]\n"
+                    "       [-a <aggregation window ms per hop>] [-m <metrics port>]\n"
+                    "       [-l error|warn|info|debug]\n",
+            progname);
+    fprintf(stderr, "  -k 0 never suppresses forwards.\n");
+    fprintf(stderr, "  -a 0 disables aggregation (relays answer only for themselves); otherwise it\n"
+                    "     must be at least -d, which downstream relays may wait before forwarding\n"
+                    "     (default %d ms, raised to -d).\n", AGGREGATE_WINDOW);
+    fprintf(stderr, "  -m serves Prometheus metrics on 127.0.0.1:<metrics port>/metrics.\n");
+    fprintf(stderr, "  -l sets the least severe messages logged (default info; debug shows a\n"
+                    "  sample of the invalid datagrams).\n");
+    exit(EXIT_FAILURE);
+}
+
+/*
+ * size_receive_buffer:
+ *   Ask for a receive buffer of size bytes: SO_RCVBUFFORCE can exceed
+ *   net.core.rmem_max but needs CAP_NET_ADMIN, SO_RCVBUF is capped by it.
+ *   Reports what the kernel actually granted.
+ */
+static void size_receive_buffer(int sockfd, int size) {
+    if (setsockopt(sockfd, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) < 0 &&
+        setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0)
+        perror("setsockopt (SO_RCVBUF)");
+
+    int granted = 0;
+    socklen_t len = sizeof(granted);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &granted, &len) == 0) {
+        /* The kernel reports twice what it grants, to account for its overhead. */
+        printf("Receive buffer: %d bytes", granted);
+        if (granted < size)
+            printf(" (asked for %d, raise net.core.rmem_max)", size);
+        printf("\n");
     }
-    return 0;
 }
 
-/* Add a request id to the cache */
-void add_request(int id) {
-    if (seen_count < MAX_REQUESTS) {
-        seen_requests[seen_count].id = id;
-        seen_count++;
+/*
+ * socket_backlog:
+ *   Bytes currently queued in the socket receive buffer (SO_MEMINFO), or 0
+ *   if the kernel cannot tell.
+ */
+static unsigned int socket_backlog(int sockfd) {
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+    if (getsockopt(sockfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) < 0 ||
+        len <= SK_MEMINFO_RMEM_ALLOC * sizeof(uint32_t))
+        return 0;
+    return meminfo[SK_MEMINFO_RMEM_ALLOC];
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static long long monotonic_ms(void) {
+    return (long long)(monotonic_ns() / 1000000);
+}
+
+/*
+ * send_batch:
+ *   Send the queued datagrams with as few sendmmsg() calls as possible. A
+ *   datagram the kernel refuses is counted and skipped.
+ */
+static void send_batch(struct agent *ag) {
+    struct tx_batch *tx = ag->tx;
+    unsigned int sent = 0;
+    while (sent < tx->count) {
+        int n = sendmmsg(ag->sockfd, tx->msgs + sent, tx->count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG(LOG_LEVEL_ERROR, log_socket, "sendmmsg: %m");
+            ag->counters.send_errors++;
+            n = 1;
+        } else {
+            uint64_t now_ns = monotonic_ns();
+            for (int i = 0; i < n; i++) {
+                if (tx->forward[sent + i])
+                    ag->counters.forwards++;
+                else
+                    ag->counters.responses++;
+                if (tx->received_ns[sent + i] != 0)
+                    metrics_histogram_record(&ag->response_ns,
+                                             now_ns - tx->received_ns[sent + i]);
+            }
+        }
+        sent += (unsigned int) n;
     }
+    tx->count = 0;
 }
 
-int main(void) {
-    int sockfd;
-    struct sockaddr_in addr;
-    char buffer[MAX_BUFFER];
-    socklen_t addr_len;
+/*
+ * queue_datagram:
+ *   Add a datagram to the outgoing batch, sending the batch first if it is
+ *   full. IPv4 destinations are v4-mapped on the dual-stack socket. ifindex,
+ *   if not 0, is the interface an IPv4 multicast datagram leaves on (an
+ *   IPv6 group address carries its own). received_ns is when the request it
+ *   answers at once was read, 0 if it is not such a response.
+ */
+static void queue_datagram(struct agent *ag, const union neighbor_addr *to, const char *text,
+                           int forward, unsigned int ifindex, uint64_t received_ns) {
+    struct tx_batch *tx = ag->tx;
+    if (tx->count == TX_SLOTS)
+        send_batch(ag);
+    unsigned int i = tx->count++;
+    tx->forward[i] = (unsigned char) forward;
+    tx->received_ns[i] = received_ns;
+    size_t len = strlen(text);
+    memcpy(tx->buf[i], text, len);
+    neighbor_addr_for(ag->family, to, &tx->to[i]);
+    tx->iov[i].iov_base = tx->buf[i];
+    tx->iov[i].iov_len = len;
+    struct msghdr *hdr = &tx->msgs[i].msg_hdr;
+    memset(&tx->msgs[i], 0, sizeof(tx->msgs[i]));
+    hdr->msg_name = &tx->to[i];
+    hdr->msg_namelen = neighbor_addr_len(&tx->to[i]);
+    hdr->msg_iov = &tx->iov[i];
+    hdr->msg_iovlen = 1;
+    if (ifindex != 0) {
+        struct in_pktinfo info;
+        memset(&info, 0, sizeof(info));
+        info.ipi_ifindex = (int) ifindex;
+        memset(tx->ctrl[i], 0, sizeof(tx->ctrl[i]));
+        hdr->msg_control = tx->ctrl[i];
+        hdr->msg_controllen = sizeof(tx->ctrl[i]);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(hdr);
+        cm->cmsg_level = IPPROTO_IP;
+        cm->cmsg_type = IP_PKTINFO;
+        cm->cmsg_len = CMSG_LEN(sizeof(info));
+        memcpy(CMSG_DATA(cm), &info, sizeof(info));
+    }
+}
 
-    /* Create a UDP socket */
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
-        perror("socket");
-        exit(EXIT_FAILURE);
+/* aggregator_flush() callback: queue one packed response. */
+static void emit_response(void *ctx, const union neighbor_addr *to, const char *text) {
+    queue_datagram(ctx, to, text, 0, 0, 0);
+}
+
+/*
+ * struct stat_line:
+ *   One metric of the agent: its name (prefixed with "neighborshow_", and
+ *   suffixed with "_total" for counters, in the Prometheus output), its
+ *   Prometheus type and help, and its value.
+ */
+struct stat_line {
+    const char        *name;
+    const char        *type;
+    const char        *help;
+    unsigned long long value;
+};
+
+#define MAX_STAT_LINES 32
+
+static size_t collect_stats(const struct agent *ag, struct stat_line *lines) {
+    const struct agent_counters *c = &ag->counters;
+    const struct seen_cache *seen = &ag->seen;
+    const struct forwarder *fw = &ag->fw;
+    const struct aggregator *agg = &ag->agg;
+    const struct stat_line all[] = {
+        { "uptime_seconds", "gauge", "Seconds since the agent started.",
+          (unsigned long long)(monotonic_ms() - ag->started_ms) / 1000 },
+        { "received_datagrams", "counter", "Datagrams received.", c->received },
+        { "receive_batches", "counter", "recvmmsg() batches read.", c->batches },
+        { "full_batches", "counter", "Batches that left datagrams queued.", c->full_batches },
+        { "invalid_datagrams", "counter", "Datagrams that were not valid messages.", c->invalid },
+        { "duplicate_requests", "counter", "Requests already handled.", c->duplicates },
+        { "responses", "counter", "Responses sent.", c->responses },
+        { "forwards", "counter", "Forwarded request datagrams sent.", c->forwards },
+        { "send_errors", "counter", "Datagrams the kernel refused to send.", c->send_errors },
+        { "kernel_drops", "counter", "Datagrams dropped because the receive buffer was full.",
+          c->kernel_drops },
+        { "stats_requests", "counter", "NEIGHBOR_STATS requests answered.", c->stats_requests },
+        { "multicast_requests", "counter", "Requests received through a discovery group.",
+          c->multicast_requests },
+        { "backlog_peak_bytes", "gauge", "Largest receive backlog seen after a batch.",
+          c->backlog_peak },
+        { "seen_entries", "gauge", "Requests remembered by the seen cache.", seen->count },
+        { "seen_hits", "counter", "Seen cache lookups that found the request.", seen->hits },
+        { "seen_misses", "counter", "Seen cache lookups of new requests.", seen->misses },
+        { "seen_expirations", "counter", "Seen cache entries expired.", seen->expirations },
+        { "seen_evictions", "counter", "Seen cache entries evicted while still valid.",
+          seen->evictions },
+        { "forwards_scheduled", "counter", "Forwards scheduled.", fw->scheduled },
+        { "forwards_suppressed", "counter", "Forwards dropped because neighbors forwarded.",
+          fw->suppressed },
+        { "forwards_throttled", "counter", "Times a due forward waited for the rate limit.",
+          fw->throttled },
+        { "forward_queue_overflows", "counter", "Forwards dropped because the queue was full.",
+          fw->overflows },
+        { "forward_targets", "gauge", "Broadcast addresses forwards are sent to.",
+          fw->target_count },
+        { "multicast_interfaces_ipv4", "gauge", "Interfaces the IPv4 discovery group is used on.",
+          fw->mcast4.count },
+        { "multicast_interfaces_ipv6", "gauge", "Interfaces the IPv6 discovery group is used on.",
+          ag->family == AF_INET6 ? fw->mcast6.count : 0 },
+        { "aggregations", "counter", "Answers held to merge downstream responses.",
+          agg->started },
+        { "aggregations_pending", "gauge", "Answers held now.", agg->count },
+        { "aggregated_hosts", "counter", "Downstream hosts merged into held answers.",
+          agg->merged },
+        { "aggregated_duplicates", "counter", "Downstream hosts already in the held answer.",
+          agg->duplicates },
+        { "late_responses", "counter", "Downstream responses for no held answer.", agg->late },
+        { "aggregation_overflows", "counter",
+          "Requests relayed without aggregating, too many answers held.", agg->overflows },
+    };
+    _Static_assert(sizeof(all) / sizeof(all[0]) <= MAX_STAT_LINES, "MAX_STAT_LINES too small");
+    memcpy(lines, all, sizeof(all));
+    return sizeof(all) / sizeof(all[0]);
+}
+
+/*
+ * write_stats:
+ *   The answer to NEIGHBOR_STATS: one "<name> <value>" line per metric, then
+ *   the response latency summary.
+ */
+static void write_stats(const struct agent *ag, FILE *stream) {
+    struct stat_line lines[MAX_STAT_LINES];
+    size_t count = collect_stats(ag, lines);
+    for (size_t i = 0; i < count; i++)
+        fprintf(stream, "%s %llu\n", lines[i].name, lines[i].value);
+
+    struct metrics_summary s;
+    memset(&s, 0, sizeof(s));
+    metrics_summary_add(&s, &ag->response_ns);
+    metrics_write_summary(stream, "response_duration", &s);
+}
+
+/* metrics_http_serve() callback: the same in the Prometheus text format. */
+static void write_prom(FILE *stream, void *ctx) {
+    const struct agent *ag = ctx;
+    struct stat_line lines[MAX_STAT_LINES];
+    size_t count = collect_stats(ag, lines);
+    for (size_t i = 0; i < count; i++) {
+        char name[96];
+        int counter = strcmp(lines[i].type, "counter") == 0;
+        snprintf(name, sizeof(name), "neighborshow_%s%s", lines[i].name, counter ? "_total" : "");
+        metrics_prom_header(stream, name, lines[i].type, lines[i].help);
+        metrics_prom_value(stream, name, NULL, lines[i].value);
     }
 
-    /* Bind the socket to all interfaces on NEIGHBOR_PORT */
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(NEIGHBOR_PORT);
-    addr.sin_addr.s_addr = INADDR_ANY;
-    if (bind(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
-        perror("bind");
-        exit(EXIT_FAILURE);
+    struct metrics_summary s;
+    memset(&s, 0, sizeof(s));
+    metrics_summary_add(&s, &ag->response_ns);
+    metrics_prom_header(stream, "neighborshow_response_duration_seconds", "histogram",
+                        "Time from reading a request to sending its immediate response.");
+    metrics_prom_histogram(stream, "neighborshow_response_duration_seconds", NULL, &s);
+}
+
+/*
+ * answer_stats:
+ *   Send the metrics to a local sender of NEIGHBOR_STATS; the answer may be
+ *   larger than MAX_BUFFER, so it is sent on its own.
+ */
+static void answer_stats(struct agent *ag, const union neighbor_addr *sender_addr) {
+    if (!neighbor_addr_is_loopback(sender_addr) && !forwarder_is_local(&ag->fw, sender_addr)) {
+        ag->counters.invalid++;
+        return;
+    }
+    char *text = NULL;
+    size_t len = 0;
+    FILE *stream = open_memstream(&text, &len);
+    if (stream == NULL) {
+        LOG(LOG_LEVEL_ERROR, log_system, "open_memstream: %m");
+        return;
+    }
+    write_stats(ag, stream);
+    if (fclose(stream) != 0) {
+        LOG(LOG_LEVEL_ERROR, log_system, "open_memstream: %m");
+        return;
+    }
+    if (sendto(ag->sockfd, text, len, 0, &sender_addr->sa, neighbor_addr_len(sender_addr)) < 0) {
+        LOG(LOG_LEVEL_ERROR, log_socket, "sendto: %m");
+        ag->counters.send_errors++;
+    } else {
+        ag->counters.stats_requests++;
+    }
+    free(text);
+}
+
+/*
+ * handle_request:
+ *   Process one received datagram. A request is answered at once and, if
+ *   hop > 1, its forward with hop-1 is scheduled and the downstream answers
+ *   are collected; a response from a host we forwarded a request to is
+ *   merged into the answers we hold for that request.
+ *   transport is how the datagram was sent, received_ns when it was read.
+ */
+static void handle_request(struct agent *ag, char *buffer, const union neighbor_addr *sender_addr,
+                           enum neighbor_transport transport, long long now_ms,
+                           uint64_t received_ns) {
+    /* Expected message format:
+     *   "NEIGHBOR_REQUEST <id> <hop> [<origin>]"
+     * The origin (the address of the host that started the discovery) is
+     * added by the relays; a request without one comes from its origin.
+     */
+    char prefix[32];
+    char origin_text[NEIGHBOR_ADDRSTRLEN];
+    int req_id, hop, consumed = 0;
+    if (sscanf(buffer, "%31s %d %n", prefix, &req_id, &consumed) == 2 &&
+        strcmp(prefix, RESPONSE_PREFIX) == 0) {
+        /* "NEIGHBOR_RESPONSE <id> <entry> [<entry> ...]" (see neighborshow.h) */
+        aggregator_merge(&ag->agg, req_id, sender_addr, buffer + consumed);
+        return;
+    }
+    if (strncmp(buffer, STATS_REQUEST, strlen(STATS_REQUEST)) == 0) {
+        answer_stats(ag, sender_addr);
+        return;
+    }
+    int fields = sscanf(buffer, "%31s %d %d %45s", prefix, &req_id, &hop, origin_text);
+    if (fields < 3 || strcmp(prefix, REQUEST_PREFIX) != 0) {
+        /* Invalid message format, or not a neighbor request; ignore */
+        char from[NEIGHBOR_ADDRSTRLEN];
+        ag->counters.invalid++;
+        LOG(LOG_LEVEL_DEBUG, log_invalid, "Invalid datagram from %s: %.64s",
+            neighbor_addr_ntop(sender_addr, from, sizeof(from)), buffer);
+        return;
     }
 
-    printf("neighborshow_agent listening on UDP port %d...\n", NEIGHBOR_PORT);
+    /* Our own forwards come back to us as broadcasts: they are not neighbors'. */
+    if (neighbor_addr_port(sender_addr) == htons(NEIGHBOR_PORT) &&
+        forwarder_is_local(&ag->fw, sender_addr))
+        return;
 
-    while (1) {
-        struct sockaddr_in sender_addr;
-        addr_len = sizeof(sender_addr);
-        int n = recvfrom(sockfd, buffer, MAX_BUFFER - 1, 0,
-                         (struct sockaddr *)&sender_addr, &addr_len);
-        if (n < 0) {
-            perror("recvfrom");
-            continue;
-        }
-        buffer[n] = '\0';
-
-        /* Expected message format:
-         *   "NEIGHBOR_REQUEST <id> <hop>"
-         */
-        char prefix[32];
-        int req_id, hop;
-        if (sscanf(buffer, "%31s %d %d", prefix, &req_id, &hop) != 3) {
-            /* Invalid message format; ignore */
+    /* The seen cache knows an origin by its key, IPv4 or v4-mapped alike. */
+    union neighbor_addr origin = *sender_addr;
+    if (fields == 4 && neighbor_addr_pton(origin_text, &origin) != 0) {
+        ag->counters.invalid++;
+        return;
+    }
+    if (fields < 4)
+        neighbor_addr_ntop(sender_addr, origin_text, sizeof(origin_text));
+    uint32_t origin_key = neighbor_addr_key(&origin);
+    if (transport != NEIGHBOR_BROADCAST)
+        ag->counters.multicast_requests++;
+
+    /* If we already processed this request, ignore it */
+    if (seen_cache_check(&ag->seen, origin_key, req_id, now_ms)) {
+        ag->counters.duplicates++;
+        return;
+    }
+
+    /* If hop count > 1, forward the request with hop-1 (later, see forwarder.h) */
+    if (hop > 1)
+        forwarder_schedule(&ag->fw, origin_key, origin_text, req_id, hop - 1, transport, now_ms);
+
+    /* Prepare response message:
+     *   "NEIGHBOR_RESPONSE <id> [@<origin>] <hostname>"
+     * A forwarded request is answered to a relay, which tells concurrent
+     * discoveries with the same id apart by their origin.
+     */
+    char response[MAX_BUFFER];
+    if (fields == 4)
+        snprintf(response, sizeof(response), "%s %d @%s %s", RESPONSE_PREFIX, req_id,
+                 origin_text, ag->hostname);
+    else
+        snprintf(response, sizeof(response), "%s %d %s", RESPONSE_PREFIX, req_id, ag->hostname);
+
+    /* Send the response directly to the sender */
+    queue_datagram(ag, sender_addr, response, 0, 0, received_ns);
+
+    /* A relay sends the downstream answers back once the hosts it forwards
+     * to had time to answer. */
+    if (hop > 1 && ag->aggregate_window > 0)
+        aggregator_start(&ag->agg, origin_key, fields == 4 ? origin_text : NULL, req_id,
+                         sender_addr, now_ms + (hop - 1) * ag->aggregate_window, ag->hostname);
+}
+
+/*
+ * queue_forwards:
+ *   Queue the forwards that are due, one datagram per forward target, or
+ *   per multicast interface for a request that came through a group.
+ */
+static void queue_forwards(struct agent *ag, long long now_ms) {
+    struct pending_forward p;
+    while (forwarder_next(&ag->fw, &ag->seen, now_ms, &p)) {
+        char new_request[MAX_BUFFER];
+        snprintf(new_request, sizeof(new_request), "%s %d %d %s", REQUEST_PREFIX, p.id, p.hop,
+                 p.origin_text);
+        if (p.transport == NEIGHBOR_BROADCAST) {
+            for (size_t i = 0; i < ag->fw.target_count; i++)
+                queue_datagram(ag, &ag->fw.targets[i], new_request, 1, 0, 0);
             continue;
         }
-        if (strcmp(prefix, REQUEST_PREFIX) != 0) {
-            /* Not a neighbor request; ignore */
-            continue;
+        const struct neighbor_ifaces *ifaces =
+            p.transport == NEIGHBOR_MCAST4 ? &ag->fw.mcast4 : &ag->fw.mcast6;
+        for (size_t i = 0; i < ifaces->count; i++) {
+            union neighbor_addr group;
+            neighbor_mcast_group(p.transport, ifaces->index[i], &group);
+            queue_datagram(ag, &group, new_request, 1,
+                           p.transport == NEIGHBOR_MCAST4 ? ifaces->index[i] : 0, 0);
         }
+    }
+}
 
-        /* If we already processed this request, ignore it */
-        if (already_seen(req_id))
-            continue;
-        add_request(req_id);
+/*
+ * join_groups:
+ *   Join the discovery groups on the multicast interfaces of the last scan;
+ *   groups already joined stay as they are.
+ */
+static void join_groups(struct agent *ag) {
+    const struct forwarder *fw = &ag->fw;
+    for (size_t i = 0; i < fw->mcast4.count; i++) {
+        if (neighbor_mcast_join(ag->sockfd, ag->family, NEIGHBOR_MCAST4, fw->mcast4.index[i]) < 0)
+            LOG(LOG_LEVEL_WARN, log_socket, "Cannot join %s on interface %u: %m",
+                NEIGHBOR_GROUP4, fw->mcast4.index[i]);
+    }
+    for (size_t i = 0; ag->family == AF_INET6 && i < fw->mcast6.count; i++) {
+        if (neighbor_mcast_join(ag->sockfd, ag->family, NEIGHBOR_MCAST6, fw->mcast6.index[i]) < 0)
+            LOG(LOG_LEVEL_WARN, log_socket, "Cannot join %s on interface %u: %m",
+                NEIGHBOR_GROUP6, fw->mcast6.index[i]);
+    }
+}
+
+static void report_counters(const struct agent *ag) {
+    const struct agent_counters *c = &ag->counters;
+    const struct seen_cache *seen = &ag->seen;
+    const struct forwarder *fw = &ag->fw;
+    const struct aggregator *agg = &ag->agg;
+    LOG(LOG_LEVEL_INFO, log_counters,
+        "Received %llu datagrams in %llu batches (%llu full), answered %llu, forwarded %llu, "
+        "duplicates %llu, invalid %llu, send errors %llu, kernel drops %llu, "
+        "backlog peak %u bytes",
+        c->received, c->batches, c->full_batches, c->responses, c->forwards,
+        c->duplicates, c->invalid, c->send_errors, c->kernel_drops, c->backlog_peak);
+    LOG(LOG_LEVEL_INFO, log_counters,
+        "Seen cache: %zu/%zu entries, hits %llu, misses %llu, expired %llu, evicted %llu",
+        seen->count, seen->capacity, seen->hits, seen->misses, seen->expirations,
+        seen->evictions);
+    LOG(LOG_LEVEL_INFO, log_counters,
+        "Forwarding: scheduled %llu, forwarded %llu, suppressed %llu, throttled %llu, "
+        "queue full %llu, %zu target%s, multicast on %zu IPv4 and %zu IPv6 interfaces "
+        "(%llu requests)",
+        fw->scheduled, fw->forwarded, fw->suppressed, fw->throttled, fw->overflows,
+        fw->target_count, fw->target_count == 1 ? "" : "s", fw->mcast4.count,
+        ag->family == AF_INET6 ? fw->mcast6.count : 0, c->multicast_requests);
+    LOG(LOG_LEVEL_INFO, log_counters,
+        "Aggregation: held %llu answers (%zu pending), merged %llu hosts, duplicates %llu, "
+        "late responses %llu, table full %llu",
+        agg->started, agg->count, agg->merged, agg->duplicates, agg->late, agg->overflows);
+}
 
-        /* Get the local hostname */
-        char hostname[256];
-        if (gethostname(hostname, sizeof(hostname)) != 0) {
-            perror("gethostname");
-            strcpy(hostname, "unknown");
+/*
+ * receive_batch:
+ *   Read the datagrams that have queued up (without waiting for more) and
+ *   handle them; their responses are left in the outgoing batch.
+ */
+static void receive_batch(struct agent *ag) {
+    struct rx_batch *rx = ag->rx;
+    for (int i = 0; i < BATCH_SIZE; i++) {
+        rx->iov[i].iov_base = rx->buf[i];
+        rx->iov[i].iov_len = MAX_BUFFER - 1;
+        memset(&rx->msgs[i], 0, sizeof(rx->msgs[i]));
+        rx->msgs[i].msg_hdr.msg_name = &rx->from[i];
+        rx->msgs[i].msg_hdr.msg_namelen = sizeof(rx->from[i]);
+        rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+        rx->msgs[i].msg_hdr.msg_iovlen = 1;
+        rx->msgs[i].msg_hdr.msg_control = rx->ctrl[i];
+        rx->msgs[i].msg_hdr.msg_controllen = sizeof(rx->ctrl[i]);
+    }
+
+    int n = recvmmsg(ag->sockfd, rx->msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+    if (n < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            LOG(LOG_LEVEL_ERROR, log_socket, "recvmmsg: %m");
+        return;
+    }
+    ag->counters.received += (unsigned long long) n;
+    ag->counters.batches++;
+    if (n == BATCH_SIZE)
+        ag->counters.full_batches++;
+    unsigned int backlog = socket_backlog(ag->sockfd);
+    if (backlog > ag->counters.backlog_peak)
+        ag->counters.backlog_peak = backlog;
+
+    uint64_t received_ns = monotonic_ns();
+    long long now_ms = (long long)(received_ns / 1000000);
+
+    /* Get the local hostname (once per batch) */
+    if (gethostname(ag->hostname, sizeof(ag->hostname)) != 0) {
+        LOG(LOG_LEVEL_ERROR, log_system, "gethostname: %m");
+        strcpy(ag->hostname, "unknown");
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct msghdr *hdr = &rx->msgs[i].msg_hdr;
+        union neighbor_addr dst;
+        memset(&dst, 0, sizeof(dst));
+        for (struct cmsghdr *cm = CMSG_FIRSTHDR(hdr); cm != NULL; cm = CMSG_NXTHDR(hdr, cm)) {
+            if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SO_RXQ_OVFL) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+                ag->counters.kernel_drops = drops;
+            } else if (cm->cmsg_level == IPPROTO_IPV6 && cm->cmsg_type == IPV6_PKTINFO) {
+                struct in6_pktinfo info;
+                memcpy(&info, CMSG_DATA(cm), sizeof(info));
+                dst.sin6.sin6_family = AF_INET6;
+                dst.sin6.sin6_addr = info.ipi6_addr;
+            } else if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_PKTINFO) {
+                struct in_pktinfo info;
+                memcpy(&info, CMSG_DATA(cm), sizeof(info));
+                dst.sin.sin_family = AF_INET;
+                dst.sin.sin_addr = info.ipi_addr;
+            }
         }
+        rx->buf[i][rx->msgs[i].msg_len] = '\0';
+        handle_request(ag, rx->buf[i], &rx->from[i], neighbor_addr_transport(&dst), now_ms,
+                       received_ns);
+    }
+}
 
-        /* Prepare response message:
-         *   "NEIGHBOR_RESPONSE <id> <hostname>"
-         */
-        char response[MAX_BUFFER];
-        snprintf(response, sizeof(response), "%s %d %s", RESPONSE_PREFIX, req_id, hostname);
+int main(int argc, char *argv[]) {
+    static struct agent agent;
+    struct agent *ag = &agent;
+    union neighbor_addr addr;
+    int rcvbuf = RCVBUF_SIZE;
+    long seen_capacity = SEEN_CAPACITY;
+    long seen_ttl = SEEN_TTL;
+    long forward_delay = FORWARD_DELAY;
+    long suppress = FORWARD_SUPPRESS;
+    double forward_rate = FORWARD_RATE;
+    long aggregate_window = -1;         /* AGGREGATE_WINDOW, at least -d */
+    int metrics_port = 0;
+    int log_level = LOG_LEVEL_INFO;
 
-        /* Send the response directly to the sender */
-        if (sendto(sockfd, response, strlen(response), 0,
-                   (struct sockaddr*)&sender_addr, addr_len) < 0) {
-            perror("sendto");
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            rcvbuf = atoi(argv[++i]);
+            if (rcvbuf < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            seen_capacity = atol(argv[++i]);
+            if (seen_capacity < 1 || seen_capacity >= (long) SEEN_NONE)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seen_ttl = atol(argv[++i]);
+            if (seen_ttl < 1)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            forward_delay = atol(argv[++i]);
+            if (forward_delay < 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            suppress = atol(argv[++i]);
+            if (suppress < 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            forward_rate = atof(argv[++i]);
+            if (forward_rate <= 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            aggregate_window = atol(argv[++i]);
+            if (aggregate_window < 0)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            metrics_port = atoi(argv[++i]);
+            if (metrics_port < 1 || metrics_port > 65535)
+                usage(argv[0]);
+        } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+            log_level = log_level_parse(argv[++i]);
+            if (log_level < 0)
+                usage(argv[0]);
+        } else {
+            usage(argv[0]);
         }
+    }
+    /* Downstream answers come back after the forwarding delay, at the earliest. */
+    if (aggregate_window < 0) {
+        aggregate_window = forward_delay > AGGREGATE_WINDOW ? forward_delay : AGGREGATE_WINDOW;
+    } else if (aggregate_window > 0 && aggregate_window < forward_delay) {
+        fprintf(stderr, "%s: -a %ld is shorter than -d %ld: every downstream answer would be late\n",
+                argv[0], aggregate_window, forward_delay);
+        usage(argv[0]);
+    }
+    ag->aggregate_window = aggregate_window;
 
-        /* If hop count > 1, forward the request with hop-1 */
-        if (hop > 1) {
-            hop--;
-            char new_request[MAX_BUFFER];
-            snprintf(new_request, sizeof(new_request), "%s %d %d", REQUEST_PREFIX, req_id, hop);
-
-            /* Set up broadcast address */
-            struct sockaddr_in broadcast_addr;
-            memset(&broadcast_addr, 0, sizeof(broadcast_addr));
-            broadcast_addr.sin_family = AF_INET;
-            broadcast_addr.sin_port = htons(NEIGHBOR_PORT);
-            broadcast_addr.sin_addr.s_addr = inet_addr("255.255.255.255");
-
-            /* Enable broadcasting on the socket */
-            int broadcastEnable = 1;
-            if (setsockopt(sockfd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable, sizeof(broadcastEnable)) < 0) {
-                perror("setsockopt (SO_BROADCAST)");
-            }
+    /* Create a UDP socket: dual-stack, or IPv4 only where there is no IPv6 */
+    int v6only = 0;
+    ag->family = AF_INET6;
+    if ((ag->sockfd = socket(AF_INET6, SOCK_DGRAM, 0)) < 0 ||
+        setsockopt(ag->sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &v6only, sizeof(v6only)) < 0) {
+        if (ag->sockfd >= 0)
+            close(ag->sockfd);
+        ag->family = AF_INET;
+        if ((ag->sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+            perror("socket");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Forwards are broadcast: enable it once for all of them. */
+    int broadcastEnable = 1;
+    if (setsockopt(ag->sockfd, SOL_SOCKET, SO_BROADCAST, &broadcastEnable,
+                   sizeof(broadcastEnable)) < 0) {
+        perror("setsockopt (SO_BROADCAST)");
+    }
+
+    /* Have the kernel report how many datagrams it dropped on this socket. */
+    int ovfl = 1;
+    if (setsockopt(ag->sockfd, SOL_SOCKET, SO_RXQ_OVFL, &ovfl, sizeof(ovfl)) < 0) {
+        perror("setsockopt (SO_RXQ_OVFL)");
+    }
+
+    /* The destination of a datagram tells whether it came through a group. */
+    int pktinfo = 1;
+    if ((ag->family == AF_INET6 ?
+         setsockopt(ag->sockfd, IPPROTO_IPV6, IPV6_RECVPKTINFO, &pktinfo, sizeof(pktinfo)) :
+         setsockopt(ag->sockfd, IPPROTO_IP, IP_PKTINFO, &pktinfo, sizeof(pktinfo))) < 0) {
+        perror("setsockopt (PKTINFO)");
+    }
+
+    /* Our own multicast forwards need not come back to us (broadcasts still do). */
+    int loop = 0;
+    if (setsockopt(ag->sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        (ag->family == AF_INET6 &&
+         setsockopt(ag->sockfd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)) {
+        perror("setsockopt (MULTICAST_LOOP)");
+    }
+
+    size_receive_buffer(ag->sockfd, rcvbuf);
+
+    /* Bind the socket to all interfaces on NEIGHBOR_PORT */
+    memset(&addr, 0, sizeof(addr));
+    if (ag->family == AF_INET6) {
+        addr.sin6.sin6_family = AF_INET6;
+        addr.sin6.sin6_port = htons(NEIGHBOR_PORT);
+        addr.sin6.sin6_addr = in6addr_any;
+    } else {
+        addr.sin.sin_family = AF_INET;
+        addr.sin.sin_port = htons(NEIGHBOR_PORT);
+        addr.sin.sin_addr.s_addr = INADDR_ANY;
+    }
+    if (bind(ag->sockfd, &addr.sa, neighbor_addr_len(&addr)) < 0) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+
+    int metrics_fd = -1;
+    if (metrics_port > 0 && (metrics_fd = metrics_http_listen(metrics_port)) < 0)
+        exit(EXIT_FAILURE);
+    ag->started_ms = monotonic_ms();
+
+    printf("neighborshow_agent listening on UDP port %d (%s)...\n", NEIGHBOR_PORT,
+           ag->family == AF_INET6 ? "IPv4 and IPv6" : "IPv4 only");
+    if (metrics_fd >= 0)
+        printf("Metrics on http://127.0.0.1:%d/metrics\n", metrics_port);
+    fflush(stdout);
+    if (log_ring_start((enum log_level) log_level, stdout) < 0)
+        exit(EXIT_FAILURE);
+
+    ag->rx = calloc(1, sizeof(*ag->rx));
+    ag->tx = calloc(1, sizeof(*ag->tx));
+    if (ag->rx == NULL || ag->tx == NULL ||
+        seen_cache_init(&ag->seen, (size_t) seen_capacity, seen_ttl * 1000) < 0) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
 
-            if (sendto(sockfd, new_request, strlen(new_request), 0,
-                       (struct sockaddr *)&broadcast_addr, sizeof(broadcast_addr)) < 0) {
-                perror("sendto broadcast");
+    srand((unsigned int)(time(NULL) ^ getpid()));
+    if (forwarder_init(&ag->fw, FORWARD_QUEUE, forward_delay, (unsigned int) suppress,
+                       forward_rate, FORWARD_BURST, monotonic_ms()) < 0) {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+    join_groups(ag);
+    aggregator_init(&ag->agg);
+
+    struct agent_counters reported;
+    memset(&reported, 0, sizeof(reported));
+    time_t next_report = time(NULL) + REPORT_INTERVAL;
+
+    while (1) {
+        time_t now = time(NULL);
+        if (now >= next_report) {
+            if (memcmp(&ag->counters, &reported, sizeof(reported)) != 0) {
+                report_counters(ag);
+                reported = ag->counters;
             }
+            next_report = now + REPORT_INTERVAL;
         }
+
+        long long now_ms = monotonic_ms();
+        if (forwarder_scan(&ag->fw, now_ms, 0))
+            join_groups(ag);
+        int timeout = (int)(next_report - now) * 1000;
+        int forward_timeout = forwarder_timeout(&ag->fw, now_ms);
+        if (forward_timeout >= 0 && forward_timeout < timeout)
+            timeout = forward_timeout;
+        int aggregate_timeout = aggregator_timeout(&ag->agg, now_ms);
+        if (aggregate_timeout >= 0 && aggregate_timeout < timeout)
+            timeout = aggregate_timeout;
+
+        struct pollfd pfd[2] = {
+            { .fd = ag->sockfd, .events = POLLIN, .revents = 0 },
+            { .fd = metrics_fd, .events = POLLIN, .revents = 0 },   /* ignored if -1 */
+        };
+        int ready = poll(pfd, 2, timeout);
+        if (ready < 0 && errno != EINTR) {
+            LOG(LOG_LEVEL_ERROR, log_system, "poll: %m");
+            break;
+        }
+        if (ready > 0 && (pfd[0].revents & POLLIN))
+            receive_batch(ag);
+        if (ready > 0 && (pfd[1].revents & POLLIN))
+            metrics_http_serve(metrics_fd, write_prom, ag);
+
+        now_ms = monotonic_ms();
+        queue_forwards(ag, now_ms);
+        while (aggregator_flush(&ag->agg, now_ms, emit_response, ag))
+            ;
+        send_batch(ag);
     }
 
-    close(sockfd);
+    aggregator_free(&ag->agg);
+    forwarder_free(&ag->fw);
+    seen_cache_free(&ag->seen);
+    free(ag->rx);
+    free(ag->tx);
+    if (metrics_fd >= 0)
+        close(metrics_fd);
+    close(ag->sockfd);
+    log_ring_stop();
     return 0;
 }
@@ -0,0 +1,106 @@
+/*
+ * seen_cache.c
+ *
+ * Loop suppression for neighborshow_agent: which (origin, request id) pairs
+ * were already handled (see seen_cache.h).
+ */
+
+#include "seen_cache.h"
+
+#include <stdlib.h>
+
+static size_t bucket_of(const struct seen_cache *cache, uint32_t origin, int id) {
+    uint64_t key = ((uint64_t) origin << 32) | (uint32_t) id;
+    key *= 0x9e3779b97f4a7c15ULL;
+    return (size_t)(key >> 32) & cache->bucket_mask;
+}
+
+int seen_cache_init(struct seen_cache *cache, size_t capacity, long long ttl_ms) {
+    size_t buckets = 1;
+    while (buckets < 2 * capacity)
+        buckets <<= 1;
+
+    cache->entries = calloc(capacity, sizeof(struct seen_entry));
+    cache->buckets = malloc(buckets * sizeof(uint32_t));
+    if (cache->entries == NULL || cache->buckets == NULL) {
+        free(cache->entries);
+        free(cache->buckets);
+        return -1;
+    }
+    for (size_t i = 0; i < buckets; i++)
+        cache->buckets[i] = SEEN_NONE;
+    cache->capacity = capacity;
+    cache->bucket_mask = buckets - 1;
+    cache->head = 0;
+    cache->count = 0;
+    cache->ttl_ms = ttl_ms;
+    cache->hits = cache->misses = cache->evictions = cache->expirations = 0;
+    return 0;
+}
+
+/*
+ * drop_oldest:
+ *   Remove the oldest entry of the ring from its hash chain.
+ */
+static void drop_oldest(struct seen_cache *cache) {
+    uint32_t victim = (uint32_t)((cache->head + cache->capacity - cache->count) % cache->capacity);
+    struct seen_entry *e = &cache->entries[victim];
+    uint32_t *link = &cache->buckets[bucket_of(cache, e->origin, e->id)];
+    while (*link != victim)
+        link = &cache->entries[*link].next;
+    *link = e->next;
+    cache->count--;
+}
+
+int seen_cache_check(struct seen_cache *cache, uint32_t origin, int id, long long now_ms) {
+    /* Entries are in ring order, which is also expiry order. */
+    while (cache->count > 0) {
+        size_t oldest = (cache->head + cache->capacity - cache->count) % cache->capacity;
+        if (cache->entries[oldest].expires > now_ms)
+            break;
+        drop_oldest(cache);
+        cache->expirations++;
+    }
+
+    size_t b = bucket_of(cache, origin, id);
+    for (uint32_t i = cache->buckets[b]; i != SEEN_NONE; i = cache->entries[i].next) {
+        if (cache->entries[i].origin == origin && cache->entries[i].id == id) {
+            cache->entries[i].heard++;
+            cache->hits++;
+            return 1;
+        }
+    }
+    cache->misses++;
+
+    if (cache->count == cache->capacity) {
+        drop_oldest(cache);
+        cache->evictions++;
+    }
+    uint32_t slot = (uint32_t) cache->head;
+    struct seen_entry *e = &cache->entries[slot];
+    e->origin = origin;
+    e->id = id;
+    e->heard = 0;
+    e->expires = now_ms + cache->ttl_ms;
+    e->next = cache->buckets[b];
+    cache->buckets[b] = slot;
+    cache->head = (cache->head + 1) % cache->capacity;
+    cache->count++;
+    return 0;
+}
+
+unsigned int seen_cache_heard(const struct seen_cache *cache, uint32_t origin, int id) {
+    size_t b = bucket_of(cache, origin, id);
+    for (uint32_t i = cache->buckets[b]; i != SEEN_NONE; i = cache->entries[i].next) {
+        if (cache->entries[i].origin == origin && cache->entries[i].id == id)
+            return cache->entries[i].heard;
+    }
+    return 0;
+}
+
+void seen_cache_free(struct seen_cache *cache) {
+    free(cache->entries);
+    free(cache->buckets);
+    cache->entries = NULL;
+    cache->buckets = NULL;
+}
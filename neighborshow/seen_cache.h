@@ -0,0 +1,74 @@
+#ifndef SEEN_CACHE_H
+#define SEEN_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * struct seen_entry:
+ *   One request the agent has handled, identified by the address of the
+ *   host that started the discovery (origin: an IPv4 address in network
+ *   order, or a hash of an IPv6 one, see neighbor_addr_key()) and the id it
+ *   chose. heard counts how many more times the request was received
+ *   (from neighbors forwarding it too). next chains the entries of a hash
+ *   bucket (SEEN_NONE ends it).
+ */
+struct seen_entry {
+    uint32_t  origin;
+    int       id;
+    uint32_t  heard;
+    uint32_t  next;
+    long long expires;          /* CLOCK_MONOTONIC milliseconds */
+};
+
+#define SEEN_NONE UINT32_MAX
+
+/*
+ * struct seen_cache:
+ *   Bounded set of recently handled requests, used to answer and forward a
+ *   request only once even though it comes back through several relays.
+ *   Entries live in a ring in the order they were added, so the oldest one
+ *   is always the next to go: it is dropped when its ttl has passed
+ *   (expirations) or when the ring is full and room is needed (evictions,
+ *   which mean the cache is too small for the traffic). A hash index over
+ *   the ring makes lookups O(1). Memory is allocated once, at init.
+ */
+struct seen_cache {
+    struct seen_entry *entries;
+    size_t             capacity;
+    size_t             head;        /* where the next entry goes */
+    size_t             count;       /* the oldest entry is count slots before head */
+    uint32_t          *buckets;
+    size_t             bucket_mask;
+    long long          ttl_ms;
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long expirations;
+};
+
+/*
+ * seen_cache_init:
+ *   Prepare a cache of capacity entries kept for ttl_ms milliseconds.
+ *   Returns 0 on success, -1 on allocation failure.
+ */
+int seen_cache_init(struct seen_cache *cache, size_t capacity, long long ttl_ms);
+
+/*
+ * seen_cache_check:
+ *   Tell whether (origin, id) was seen within the ttl (a hit, returns 1,
+ *   and the entry's heard count goes up); if not (a miss, returns 0) it is
+ *   recorded as seen at now_ms.
+ */
+int seen_cache_check(struct seen_cache *cache, uint32_t origin, int id, long long now_ms);
+
+/*
+ * seen_cache_heard:
+ *   How many times (origin, id) was received again after it was recorded;
+ *   0 if it is not in the cache (any more).
+ */
+unsigned int seen_cache_heard(const struct seen_cache *cache, uint32_t origin, int id);
+
+void seen_cache_free(struct seen_cache *cache);
+
+#endif /* SEEN_CACHE_H */